@@ -3,9 +3,27 @@ import pandas as pd
 import matplotlib.pyplot as plt
 import matplotlib.ticker as mticker
 
-def plot_csv(in_millions, out_file: str):
+# y axis label per column, the time columns are in seconds
+METRIC_LABELS = {
+    'MPps': "Throughput of the median run (MP/s)",
+    'GBps': "Bandwidth of the median run (GB/s)",
+    'GFlops': "Compute of the median run (GFLOP/s)",
+    'BoundGBps': "Roofline bound (GB/s)",
+    'PctOfBound': "Achieved bandwidth (% of roofline bound)",
+    'PageFaults': "Page faults per timed run",
+    'WarmupPageFaults': "Page faults of the warmup runs",
+}
+
+def plot_csv(in_millions, out_file: str, metric: str):
     csv = pd.read_csv(sys.argv[1])
 
+    if metric not in csv.columns:
+        print(f"Column {metric} not in {sys.argv[1]}")
+        exit(1)
+
+    # rows without a value for this metric (e.g. MPps of the STREAM kernels, columns of options not given)
+    csv = csv.dropna(subset=[metric])
+
     plt.rcParams["figure.autolayout"] = True
     plt.rcParams["figure.figsize"] = [12.00, 10.00]
 
@@ -16,12 +34,12 @@ def plot_csv(in_millions, out_file: str):
 
     for i, imp in enumerate(implementations):
         subset = csv[csv['Implementation'] == imp]
-        ax.plot(subset['Pixels'], subset['Average'], label=imp, marker=markers[i % len(markers)], markersize=5)
+        ax.plot(subset['Pixels'], subset[metric], label=imp, marker=markers[i % len(markers)], markersize=5)
 
     ax.set_title("BrightnessAndContrast Implementation Comparison", fontsize=16)
     ax.set_xlabel("Image size (Pixels)", fontsize=14)
-    ax.set_ylabel(f"Avg. time over {sys.argv[2]} runs (s)", fontsize=14)
-    
+    ax.set_ylabel(METRIC_LABELS.get(metric, f"{metric} over {sys.argv[2]} runs (s)"), fontsize=14)
+
     if (in_millions != "0"):
         ax.xaxis.set_major_formatter(mticker.FuncFormatter(millions))
 
@@ -35,8 +53,9 @@ def millions(x, pos):
     return f'{int(x/1e6)}M'
 
 if __name__ == '__main__':
-    if len(sys.argv) != 5:
-        print("Usage: plotter.py <input_csv> <no_runs> <output_file (.png)> <in_millions (0/1)>")
+    if len(sys.argv) not in (5, 6):
+        print("Usage: plotter.py <input_csv> <no_runs> <output_file (.png)> <in_millions (0/1)> [<metric>]")
+        print("       <metric>: CSV column to plot, e.g. Average (default), Median, MPps, GBps, GFlops, PctOfBound, PageFaults")
         exit(1)
-    
-    plot_csv(sys.argv[4], sys.argv[3]) # 1 - file, 2 - runs, 3 - outfile
+
+    plot_csv(sys.argv[4], sys.argv[3], sys.argv[5] if len(sys.argv) == 6 else 'Average') # 1 - file, 2 - runs, 3 - outfile
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "brightness_contrast.h"
+
+extern const uint32_t bc_default_batch_readers;
+extern const uint32_t bc_default_batch_writers;
+
+int bc_batch_process(const BCInput* input, const char* prog_name);
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Stateful API for adjusting the same image repeatedly, e.g. while a contrast slider is moved.
+ * The grayscale plane (incl. brightness) and its mean and variance are cached per image, coefficients and brightness,
+ * a call which only changes the contrast runs the contrast pass alone (one lookup table pass instead of three passes).
+ * The results are the same as those of the histogram implementations (V9/V10).
+ */
+typedef struct
+{
+  const uint8_t* img; // rgb, not owned
+  size_t width;
+  size_t height;
+
+  uint8_t* gray; // cached grayscale plane
+  bool gray_valid;
+  float coeffs[3]; // as given, not normalized
+  int16_t brightness;
+
+  float avg;
+  float sigma; // variance
+} BCContext;
+
+// the image has to stay valid (and unchanged, see bc_context_invalidate) until bc_context_destroy.
+// returns -1 if the grayscale plane can't be allocated, 1 if the image is too large
+int bc_context_init(BCContext* ctx, const uint8_t* img, size_t width, size_t height);
+void bc_context_destroy(BCContext* ctx);
+
+// drops the cached grayscale plane, e.g. after the pixels of the image were changed in place
+void bc_context_invalidate(BCContext* ctx);
+
+// result gets width * height grayscale values. Returns true if the cached grayscale plane was used
+bool bc_context_apply(BCContext* ctx, float a, float b, float c, int16_t brightness, float contrast, uint8_t* result);
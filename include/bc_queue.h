@@ -0,0 +1,47 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Bounded lock-free multi-producer/multi-consumer queue (Vyukov): every cell carries a sequence number, which tells
+ * producers and consumers whether the cell is free for the current round. Push/pop only need one CAS on the position.
+ * The capacity has to be a power of two.
+ * The blocking push/pop spin a few tries and then sleep on a condition variable, the other side only takes the mutex
+ * to wake them if somebody waits.
+ */
+typedef struct
+{
+  atomic_size_t sequence;
+  void* data;
+} BCQueueCell;
+
+typedef struct
+{
+  BCQueueCell* cells;
+  size_t mask;
+
+  // separate cache lines, producers and consumers don't disturb each other
+  alignas(64) atomic_size_t enqueue_pos;
+  alignas(64) atomic_size_t dequeue_pos;
+
+  // blocking push/pop only
+  alignas(64) pthread_mutex_t mutex;
+  pthread_cond_t not_full;
+  pthread_cond_t not_empty;
+  atomic_uint push_waiters;
+  atomic_uint pop_waiters;
+} BCQueue;
+
+int bc_queue_init(BCQueue* queue, size_t capacity);
+void bc_queue_destroy(BCQueue* queue);
+
+bool bc_queue_try_push(BCQueue* queue, void* data);
+bool bc_queue_try_pop(BCQueue* queue, void** data);
+
+// blocking versions, wait while the queue is full/empty
+void bc_queue_push(BCQueue* queue, void* data);
+void* bc_queue_pop(BCQueue* queue);
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The three phases of the brightness/contrast pipeline as separate kernels, so implementations can combine them
+ * (e.g. on blocks of the image). All kernels work on a span of pixels, the coefficients have to be normalized already
+ * (divided by their sum). The bc_stage_* functions pick the variant matching bc_cpu_level().
+ */
+
+#define BC_HISTOGRAM_BINS 256
+
+// converts pixel_count rgb pixels to grayscale, returns the sum of the (rounded) grayscale values.
+// the sum of their squares is stored in sum_squares (if not NULL), both are exact => see bc_stats_from_sums
+uint64_t bc_stage_grayscale(const uint8_t *img, size_t pixel_count, float a, float b, float c, int16_t brightness,
+                            uint8_t *result, uint64_t *sum_squares);
+void bc_stage_contrast(uint8_t *result, size_t pixel_count, float div, float adjusted_avg);
+
+// the contrast stage only maps bytes to bytes => it can be done via a 256 entry lookup table.
+// the table is built with the same float calculation as bc_contrast_sisd, so the result is bit-identical
+void bc_contrast_lut_build(uint8_t lut[BC_HISTOGRAM_BINS], float div, float adjusted_avg);
+void bc_stage_contrast_lut(uint8_t *result, size_t pixel_count, const uint8_t lut[BC_HISTOGRAM_BINS]);
+
+/*
+ * Fixed point variants working on 16 bit lanes (8 pixels per 128 bit register instead of 4 floats).
+ * The grayscale coefficients are quantized to Q13, pmaddubsw needs signed 8 bit factors, so each one is split into
+ * hi * 64 + lo. The contrast factors are quantized for pmulhrsw (div in Q(8 + shift), adjusted_avg in Q(shift)).
+ * Both stages differ by at most 1 from the float kernels for the same input. The whole pipeline does too, as long as
+ * bc_fixed_contrast accepts div (a grayscale value off by one gets scaled by it).
+ */
+typedef struct
+{
+  int8_t hi[3]; // Q7
+  int8_t lo[3]; // remaining Q13 part, 0..64
+} BCFixedCoeffs;
+
+typedef struct
+{
+  int16_t div;          // Q(8 + shift)
+  int16_t adjusted_avg; // Q(shift)
+  int shift;
+} BCFixedContrast;
+
+// false if the (normalized) coefficients can't be represented, e.g. negative ones
+bool bc_fixed_coeffs(float a, float b, float c, BCFixedCoeffs *coeffs);
+// false if div is too large to stay within +-1 of the float pipeline (incl. the grayscale error scaled by div)
+bool bc_fixed_contrast(float div, float adjusted_avg, BCFixedContrast *contrast);
+
+// returns the sum of the grayscale values, the sum of their squares is stored in sum_squares
+uint64_t bc_stage_grayscale_fixed(const uint8_t *img, size_t pixel_count, const BCFixedCoeffs *coeffs,
+                                  int16_t brightness, uint8_t *result, uint64_t *sum_squares);
+void bc_stage_contrast_fixed(uint8_t *result, size_t pixel_count, const BCFixedContrast *contrast);
+
+// mean and variance (sigma^2) of count values, calculated in double from their exact sum and sum of squares.
+// the asm implementations do the same calculation, so every implementation gets the same avg and sigma
+void bc_stats_from_sums(uint64_t sum, uint64_t sum_squares, uint64_t count, float *avg, float *sigma);
+
+void bc_contrast_factors(float contrast, float avg, float sigma, float (*sqrt_func)(float),
+                         float *div, float *adjusted_avg);
+
+// adds the values of data to hist, using interleaved sub-histograms to avoid store-to-load stalls on repeated values
+void bc_histogram_add(const uint8_t *data, size_t count, uint64_t hist[BC_HISTOGRAM_BINS]);
+// mean and variance (sigma^2) of the histogram
+void bc_histogram_stats(const uint64_t hist[BC_HISTOGRAM_BINS], float *avg, float *sigma);
+
+// scalar versions, also used for the remaining pixels of the SIMD kernels
+uint64_t bc_grayscale_sisd(const uint8_t *img, size_t pixel_count, float a, float b, float c, int16_t brightness,
+                           uint8_t *result, uint64_t *sum_squares);
+void bc_contrast_sisd(uint8_t *result, size_t pixel_count, float div, float adjusted_avg);
+void bc_contrast_lut_sisd(uint8_t *result, size_t pixel_count, const uint8_t lut[BC_HISTOGRAM_BINS]);
+uint64_t bc_grayscale_fixed_sisd(const uint8_t *img, size_t pixel_count, const BCFixedCoeffs *coeffs,
+                                 int16_t brightness, uint8_t *result, uint64_t *sum_squares);
+void bc_contrast_fixed_sisd(uint8_t *result, size_t pixel_count, const BCFixedContrast *contrast);
+
+uint64_t bc_grayscale_sse41(const uint8_t *img, size_t pixel_count, float a, float b, float c, int16_t brightness,
+                            uint8_t *result, uint64_t *sum_squares);
+void bc_contrast_sse41(uint8_t *result, size_t pixel_count, float div, float adjusted_avg);
+void bc_contrast_lut_sse41(uint8_t *result, size_t pixel_count, const uint8_t lut[BC_HISTOGRAM_BINS]);
+uint64_t bc_grayscale_fixed_sse41(const uint8_t *img, size_t pixel_count, const BCFixedCoeffs *coeffs,
+                                  int16_t brightness, uint8_t *result, uint64_t *sum_squares);
+void bc_contrast_fixed_sse41(uint8_t *result, size_t pixel_count, const BCFixedContrast *contrast);
+
+uint64_t bc_grayscale_avx2(const uint8_t *img, size_t pixel_count, float a, float b, float c, int16_t brightness,
+                           uint8_t *result, uint64_t *sum_squares);
+void bc_contrast_avx2(uint8_t *result, size_t pixel_count, float div, float adjusted_avg);
+void bc_contrast_lut_avx2(uint8_t *result, size_t pixel_count, const uint8_t lut[BC_HISTOGRAM_BINS]);
+uint64_t bc_grayscale_fixed_avx2(const uint8_t *img, size_t pixel_count, const BCFixedCoeffs *coeffs,
+                                 int16_t brightness, uint8_t *result, uint64_t *sum_squares);
+void bc_contrast_fixed_avx2(uint8_t *result, size_t pixel_count, const BCFixedContrast *contrast);
+
+uint64_t bc_grayscale_avx512(const uint8_t *img, size_t pixel_count, float a, float b, float c, int16_t brightness,
+                             uint8_t *result, uint64_t *sum_squares);
+void bc_contrast_avx512(uint8_t *result, size_t pixel_count, float div, float adjusted_avg);
+void bc_contrast_lut_avx512(uint8_t *result, size_t pixel_count, const uint8_t lut[BC_HISTOGRAM_BINS]);
+void bc_contrast_lut_avx512vbmi(uint8_t *result, size_t pixel_count, const uint8_t lut[BC_HISTOGRAM_BINS]);
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Per-stage and per-thread timing of the brightness/contrast pipeline.
+ * The implementations wrap their stages in bc_trace_begin()/bc_trace_end(), which only read the clock while tracing
+ * is enabled (one predictable branch otherwise). Every thread records into its own slot: per-stage sums for the
+ * summary and, if requested, the individual events for a Chrome trace (chrome://tracing, Perfetto).
+ * Compiling with -DBC_NO_TRACE removes the instrumentation completely.
+ */
+
+typedef enum
+{
+  BCTraceRun,       // a whole implementation call, recorded by the caller
+  BCTraceGrayscale, // grayscale conversion incl. the sums for mean and variance
+  BCTraceHistogram,
+  BCTraceStats,     // reduction of the partial sums, mean, variance and contrast factors
+  BCTraceContrast,
+  BCTraceMax
+} BCTraceStage;
+
+extern const char* const bc_trace_stage_name[];
+
+extern bool bc_trace_active;
+
+// record_events .. keep the individual events for bc_trace_write_chrome, else only the per-stage sums
+void bc_trace_enable(bool record_events);
+void bc_trace_disable();
+// clears everything recorded so far, no traced code may run concurrently
+void bc_trace_reset();
+// bc_trace_reset and releases the event buffers of the threads, no traced code may run concurrently
+void bc_trace_free();
+
+void bc_trace_record(BCTraceStage stage, uint64_t start, uint64_t end);
+
+// runs .. number of implementation calls the recorded data is divided by
+void bc_trace_print_summary(uint32_t runs);
+int bc_trace_write_chrome(const char* file_name, const char* prog_name);
+
+static inline uint64_t bc_trace_now()
+{
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (uint64_t) time.tv_sec * 1000000000u + (uint64_t) time.tv_nsec;
+}
+
+#ifndef BC_NO_TRACE
+
+static inline uint64_t bc_trace_begin()
+{
+  return __builtin_expect(bc_trace_active, 0) ? bc_trace_now() : 0;
+}
+
+static inline void bc_trace_end(BCTraceStage stage, uint64_t start)
+{
+  if (__builtin_expect(bc_trace_active, 0))
+    bc_trace_record(stage, start, bc_trace_now());
+}
+
+#else
+
+static inline uint64_t bc_trace_begin()
+{
+  return 0;
+}
+
+static inline void bc_trace_end(BCTraceStage stage, uint64_t start)
+{
+  (void) stage;
+  (void) start;
+}
+
+#endif
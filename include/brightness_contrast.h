@@ -4,6 +4,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "cpu_features.h"
+
 typedef enum
 {
   BCImplAsmSIMD,
@@ -13,18 +15,53 @@ typedef enum
   BCImplCSISD_MT,
   BCImplCSISD_Heron,
   BCImplCSISD_IEEE,
+  BCImplCSIMD_AVX2,
+  BCImplCSIMD_AVX512,
+  BCImplCSIMD_Hist,
+  BCImplCSIMD_Hist_MT,
+  BCImplCSIMD_LUT,
+  BCImplCSIMD_MT,
+  BCImplCSIMD_Fixed,
+  BCImplCSIMD_Tiled,
   BCImplMax
 } BCImplVersion;
 
 typedef struct
 {
   BCImplVersion impl;
+  bool impl_auto;
+  BCCpuLevel cpu_level;
+  size_t streaming_threshold; // see bc_streaming_threshold, SIZE_MAX .. default
 
   uint32_t benchmark_runs;
+  uint32_t benchmark_warmup; // untimed runs before the timed ones
+  int32_t benchmark_pin_cpu; // -1 .. not pinned
   bool benchmark_csv;
+  bool benchmark_json;
+  bool benchmark_cold; // flush the images from the caches before every timed run
+  bool benchmark_perf; // collect hardware performance counters
+  bool benchmark_roofline; // calibrate bandwidth and peak FLOP/s, report the implementations against them
+
+  bool trace; // per-stage timing, see bc_trace.h
+  char* trace_file; // Chrome trace output, NULL .. summary only
 
   char* input_file;
   char* output_file;
+  bool use_mmap;
+  size_t stream_band_rows; // 0 .. whole image in memory
+  bool fused_read;
+  bool video; // stream of concatenated frames
+  float video_alpha; // smoothing of the statistics across frames, 0 .. exact statistics per frame
+
+  int16_t* sweep_brightness; // (brightness, contrast) pairs of the sweep mode, output_file is the output directory
+  float* sweep_contrast;
+  size_t sweep_count; // 0 .. no sweep
+
+  bool batch;
+  char** batch_files; // positional arguments in batch mode (point into argv)
+  size_t batch_file_count;
+  char* batch_manifest; // one input file per line, "-" .. stdin
+  uint32_t batch_threads[3]; // readers, kernels, writers, 0 .. default
 
   float coeffs[3];
 
@@ -44,13 +81,27 @@ typedef struct
   void (*impl)(const uint8_t *img, size_t width, size_t height, float a, float b, float c,
                int16_t brightness, float contrast, uint8_t *result);
   const char* name;
+  BCCpuLevel level; // minimum instruction set needed
+  bool multithreaded; // uses all cores (OpenMP)
+  const char* streaming_name; // benchmark name of the streaming store variant (see bc_streaming_threshold), NULL .. none
 } BCImplementation;
 
 extern const BCImplementation bc_implementation[];
 
 extern const uint16_t bc_default_benchmark_runs;
+extern const uint16_t bc_default_benchmark_warmup;
 extern const uint8_t bc_default_test_delta;
 
+BCImplVersion bc_auto_implementation();
+bool bc_implementation_supported(BCImplVersion impl);
+
+#define BC_STREAMING_NEVER (SIZE_MAX - 1)
+
+// implementations with a streaming_name write results of at least this many pixels with non-temporal stores and
+// prefetch their input with prefetchnta. BC_STREAMING_NEVER (default) .. regular stores only
+size_t bc_streaming_threshold();
+void bc_set_streaming_threshold(size_t pixels);
+
 void bc_init_input(BCInput* input);
 void bc_destroy_input(BCInput* input);
 
@@ -75,3 +126,26 @@ void brightness_contrast_V5(const uint8_t *img, size_t width, size_t height, flo
 void brightness_contrast_V6(const uint8_t *img, size_t width, size_t height, float a, float b, float c, int16_t brightness,
                             float contrast, uint8_t *result); // c sisd with sqrt_quake
 
+void brightness_contrast_V7(const uint8_t *img, size_t width, size_t height, float a, float b, float c, int16_t brightness,
+                            float contrast, uint8_t *result); // c simd avx2 (256 bit)
+
+void brightness_contrast_V8(const uint8_t *img, size_t width, size_t height, float a, float b, float c, int16_t brightness,
+                            float contrast, uint8_t *result); // c simd avx-512 (512 bit)
+
+void brightness_contrast_V9(const uint8_t *img, size_t width, size_t height, float a, float b, float c, int16_t brightness,
+                            float contrast, uint8_t *result); // c simd, statistics from histogram (single pass)
+
+void brightness_contrast_V10(const uint8_t *img, size_t width, size_t height, float a, float b, float c, int16_t brightness,
+                             float contrast, uint8_t *result); // c simd, statistics from histogram, multithreaded
+
+void brightness_contrast_V11(const uint8_t *img, size_t width, size_t height, float a, float b, float c, int16_t brightness,
+                             float contrast, uint8_t *result); // c simd, contrast via lookup table
+
+void brightness_contrast_V12(const uint8_t *img, size_t width, size_t height, float a, float b, float c, int16_t brightness,
+                             float contrast, uint8_t *result); // c simd, multithreaded on row blocks
+
+void brightness_contrast_V13(const uint8_t *img, size_t width, size_t height, float a, float b, float c, int16_t brightness,
+                             float contrast, uint8_t *result); // c simd, fixed point (16 bit integer lanes)
+
+void brightness_contrast_V14(const uint8_t *img, size_t width, size_t height, float a, float b, float c, int16_t brightness,
+                             float contrast, uint8_t *result); // c simd, l2 sized tiles, contrast pass in reverse order
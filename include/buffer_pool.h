@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Allocator of the image buffers (rgb input, grayscale/result planes).
+ * Every buffer is 64 byte (cache line) aligned. Buffers of at least BC_BUFFER_HUGEPAGE_THRESHOLD bytes are mapped
+ * separately and backed by 2 MiB pages (transparent huge pages via MADV_HUGEPAGE, or explicit hugetlb pages),
+ * which saves a dTLB miss every 4 KiB and 511 of 512 page faults on the first touch.
+ *
+ * Freed buffers go back into a pool with size classes (4 per power of two, at most 25% slack) and are handed out
+ * again to the next allocation of the same class, so processing many images in one process (--batch, --video,
+ * --sweep, the size sweep of --csv) doesn't map, fault in and unmap every buffer again.
+ *
+ * The environment variable BC_HUGEPAGES selects the backing of the large buffers:
+ * "madvise" (default) .. transparent huge pages, "hugetlb" .. reserved hugetlb pages (/proc/sys/vm/nr_hugepages),
+ * falls back to madvise if none are left, "never" .. 4 KiB pages.
+ */
+
+#define BC_BUFFER_ALIGNMENT 64
+#define BC_BUFFER_HUGEPAGE_THRESHOLD (2 * 1024 * 1024)
+// pooled buffers beyond this are released to the system
+#define BC_BUFFER_POOL_MAX_BYTES ((size_t) 1 << 30)
+
+typedef struct
+{
+  uint64_t allocations;    // calls of bc_buffer_alloc
+  uint64_t reused;         // served from the pool
+  uint64_t system;         // allocated from the system (malloc/mmap)
+  // of these, hugetlb pages or MADV_HUGEPAGE accepted. Only a request for the latter: THP may still back them with
+  // 4 KiB pages (transparent_hugepage "never"/"defer", no free 2 MiB page at fault time)
+  uint64_t huge_requested;
+  size_t pooled_bytes;     // free buffers held by the pool right now
+} BCBufferStats;
+
+// returns NULL if out of memory, the buffer is not initialized
+void* bc_buffer_alloc(size_t size);
+// NULL is ignored
+void bc_buffer_free(void* buffer);
+// releases all free buffers of the pool to the system
+void bc_buffer_pool_clear();
+void bc_buffer_stats(BCBufferStats* stats);
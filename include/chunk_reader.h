@@ -0,0 +1,38 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Reads the rgb raster of an image in chunks of chunk_pixels pixels on a helper thread (double buffering),
+ * so reading the next chunk from disk overlaps with the processing of the current one.
+ */
+typedef struct
+{
+  FILE* file;
+  size_t pixel_count;
+  size_t chunk_pixels;
+
+  uint8_t* buffer[2];
+  size_t filled[2]; // pixels in the buffer, 0 .. buffer free
+
+  size_t chunks_consumed;
+  bool chunk_held; // buffer of the last returned chunk is still used by the consumer
+
+  int error;
+  bool stop;
+
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} BCChunkReader;
+
+// file has to be positioned at the start of the raster
+int bc_chunk_reader_start(BCChunkReader* reader, FILE* file, size_t pixel_count, size_t chunk_pixels);
+// returns the next chunk (count pixels), the previous one is handed back to the reader. NULL at the end or on error
+const uint8_t* bc_chunk_reader_next(BCChunkReader* reader, size_t* count);
+// stops the helper thread, returns 1 if the raster didn't match pixel_count
+int bc_chunk_reader_finish(BCChunkReader* reader);
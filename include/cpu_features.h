@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdbool.h>
+
+typedef enum
+{
+  BCCpuSSE41,
+  BCCpuAVX2,
+  BCCpuAVX512,
+  BCCpuMax
+} BCCpuLevel;
+
+extern const char* const bc_cpu_level_name[];
+
+BCCpuLevel bc_cpu_detect();
+BCCpuLevel bc_cpu_level();
+bool bc_cpu_has_vbmi();
+BCCpuLevel bc_cpu_set_level(BCCpuLevel level);
+int bc_cpu_parse_level(const char* str, BCCpuLevel* level);
@@ -1,9 +1,41 @@
 #pragma once
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+
+// image file mapped into memory, pixels points to the raster behind the header
+typedef struct
+{
+  uint8_t* pixels;
+  size_t width;
+  size_t height;
+
+  void* map;
+  size_t map_size;
+} BCMappedImage;
+
+// "-" as input/output file name reads from stdin/writes to stdout
+bool is_stdio_file_name(const char* file_name);
+int claim_stdout_for_image(const char* program_name);
 
 int read_source_image(const char* input_file_name, uint8_t** source_image, size_t* width, size_t* height,
                       const char* program_name);
 int write_to_res_img(const char* output_file_name, const uint8_t* res_image, const size_t width, const size_t height,
                      const char* program_name);
+int open_source_image(const char* input_file_name, FILE** input_file, size_t* width, size_t* height,
+                      const char* program_name);
+int open_result_image(const char* output_file_name, FILE** output_file, size_t width, size_t height, long* raster_offset,
+                      const char* program_name);
+int read_frame_header(FILE* input_file, size_t* width, size_t* height, bool* end, const char* program_name);
+int read_frame_pixels(FILE* input_file, uint8_t* frame, size_t width, size_t height, const char* program_name);
+int open_result_stream(const char* output_file_name, const char* program_name);
+int write_result_frame(int fd, const uint8_t* res_image, size_t width, size_t height, const char* program_name);
+int close_result_stream(int fd, const char* program_name);
+// 64 byte aligned, huge pages from BC_BUFFER_HUGEPAGE_THRESHOLD, free it with bc_buffer_free (see buffer_pool.h)
 int alloc_image_pointer(uint8_t** image, size_t width, size_t height, unsigned int bytes_per_pixel);
+
+int map_source_image(const char* input_file_name, BCMappedImage* image, const char* program_name);
+int map_result_image(const char* output_file_name, BCMappedImage* image, size_t width, size_t height,
+                     const char* program_name);
+int unmap_image(BCMappedImage* image, const char* program_name);
@@ -1,7 +1,24 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 float sqrt_heron_n(float s, uint8_t n);
 float sqrt_heron(float s);
 float sqrt_ieee(float z);
+
+/*
+ * Square roots of count floats, dst may be the same array as src.
+ * sqrt_heron_array and sqrt_ieee_array are bit-identical to sqrt_heron and sqrt_ieee.
+ * sqrt_rsqrt_array refines the reciprocal square root estimate (rsqrtps, 12 bit) with one Newton-Raphson step:
+ * sqrt(s) = s * r * (1.5 - 0.5 * s * r * r), 0 for s = 0. Only meant for finite, non-negative, normal inputs.
+ * The C versions use the widest vector level of bc_cpu_level() (the AVX-512 one the 14 bit estimate vrsqrt14ps),
+ * the asm versions (math_utils.S) 128 bit SSE or 256 bit VEX encoded AVX2.
+ */
+void sqrt_heron_array(const float *src, float *dst, size_t count);
+void sqrt_ieee_array(const float *src, float *dst, size_t count);
+void sqrt_rsqrt_array(const float *src, float *dst, size_t count);
+
+void sqrt_heron_array_asm(const float *src, float *dst, size_t count);
+void sqrt_ieee_array_asm(const float *src, float *dst, size_t count);
+void sqrt_rsqrt_array_asm(const float *src, float *dst, size_t count);
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Hardware performance counters around the benchmarked implementations via perf_event_open.
+ * Every counter is opened on its own, counters the kernel or the CPU doesn't allow (perf_event_paranoid, no PMU in
+ * a VM, unknown raw event) are marked unavailable, the others are still counted. The counters are inherited by
+ * threads created after bc_perf_open, so they have to be opened before the thread pools are started.
+ */
+
+typedef enum
+{
+  BCPerfCycles,
+  BCPerfInstructions,
+  BCPerfLLCMisses,
+  BCPerfBranchMisses,
+  BCPerfFPOps, // retired FP/vector arithmetic instructions (raw event, Intel and AMD only)
+  BCPerfMax
+} BCPerfCounter;
+
+extern const char* const bc_perf_counter_name[];
+
+typedef struct
+{
+  int fd[BCPerfMax]; // -1 .. not available
+} BCPerfCounters;
+
+typedef struct
+{
+  double value[BCPerfMax]; // scaled to the full enabled time if the counter was multiplexed
+  bool valid[BCPerfMax];
+} BCPerfValues;
+
+// returns the number of counters available
+int bc_perf_open(BCPerfCounters *counters);
+void bc_perf_close(BCPerfCounters *counters);
+
+void bc_perf_reset(const BCPerfCounters *counters);
+void bc_perf_enable(const BCPerfCounters *counters);
+void bc_perf_disable(const BCPerfCounters *counters);
+void bc_perf_read(const BCPerfCounters *counters, BCPerfValues *values);
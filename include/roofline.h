@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Calibration kernels for the roofline of the machine (see --roofline): STREAM-style read, write and copy bandwidth
+ * on a buffer of a given working set and peak float throughput (independent mul + add chains, no FMA, like the
+ * implementations). All kernels run single-threaded or on all cores (OpenMP), at the best vector width of bc_cpu_level().
+ */
+
+// operations of the pipeline per pixel: grayscale 3 mul + 3 add (incl. brightness), contrast 1 mul + 1 add
+#define BC_FLOPS_PER_PIXEL 8
+
+typedef enum
+{
+  BCStreamRead,
+  BCStreamWrite,
+  BCStreamCopy,
+  BCStreamMax
+} BCStreamKernel;
+
+typedef enum
+{
+  BCPeakScalar,
+  BCPeakSIMD,
+  BCPeakMax
+} BCPeakKernel;
+
+extern const char* const bc_stream_kernel_name[];
+extern const char* const bc_peak_kernel_name[];
+
+// buffer has to be 64 byte aligned, copy reads the first half and writes the second one.
+// returns the bytes moved (STREAM convention: copy counts the bytes read and the bytes written)
+size_t bc_stream_run(BCStreamKernel kernel, uint8_t *buffer, size_t size, bool multithreaded);
+
+// returns the floating point operations done
+double bc_peak_run(BCPeakKernel kernel, bool multithreaded);
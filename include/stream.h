@@ -0,0 +1,7 @@
+#pragma once
+
+#include "brightness_contrast.h"
+
+int bc_stream_image(const BCInput* input, const char* prog_name);
+int bc_fused_read_image(const BCInput* input, const char* prog_name);
+int bc_video_process(const BCInput* input, const char* prog_name);
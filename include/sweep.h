@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bc_context.h"
+#include "bc_stages.h"
+#include "brightness_contrast.h"
+
+typedef struct
+{
+  size_t index;
+  float sum; // weighted sum w of the pixel
+} BCSweepTie;
+
+/*
+ * Many (brightness, contrast) outputs of one image, see sweep.c.
+ * Either a base plane without brightness, its histogram and the pixels rounding differently once a brightness is
+ * added (ties), or - with negative coefficients or too many ties - a context with one grayscale pass per brightness.
+ */
+typedef struct
+{
+  size_t width;
+  size_t height;
+  float coeffs[3]; // as given, not normalized
+
+  bool per_brightness;
+  BCContext ctx; // per_brightness
+
+  uint8_t* base;
+  uint64_t base_hist[BC_HISTOGRAM_BINS];
+  BCSweepTie* ties;
+  size_t tie_count;
+  size_t tie_capacity;
+} BCSweep;
+
+// if sweep->per_brightness, the image has to stay valid until bc_sweep_destroy, otherwise it isn't used anymore.
+// returns -1 if out of memory, 1 if the image is too large
+int bc_sweep_init(BCSweep* sweep, const uint8_t* img, size_t width, size_t height, float a, float b, float c);
+void bc_sweep_destroy(BCSweep* sweep);
+
+// result gets width * height grayscale values, the same as those of the histogram implementations.
+// Runs on the calling thread and may be called from several threads at once unless sweep->per_brightness
+// (then on all cores, one call at a time)
+void bc_sweep_apply(BCSweep* sweep, int16_t brightness, float contrast, uint8_t* result);
+
+// writes one output per (brightness, contrast) pair of input->sweep_* into the output directory
+// (<output_dir>/<input name>_b<brightness>_c<contrast>.pgm), the rgb image is read and converted only once
+int bc_sweep(const BCInput* input, const char* prog_name);
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Persistent thread pool, the threads are started on first use and live until the process exits.
+ *
+ * bc_pool_parallel runs func on the caller and on the pool threads (one parallel region), inside of it bc_pool_for
+ * distributes tasks among the threads of the region. Each thread starts with a contiguous range of tasks and steals
+ * half of the remaining range of another thread when it runs out of work. bc_pool_for ends with a barrier,
+ * so several phases (e.g. the three passes of the brightness/contrast pipeline) can run in one region.
+ *
+ * Regions with little work run inline on the caller, there the cost of waking up threads exceeds the gain.
+ */
+
+// below this amount of work (e.g. pixels) a region runs inline, every additional thread needs at least this amount
+#define BC_POOL_MIN_WORK_PER_THREAD (64 * 1024)
+
+typedef struct
+{
+  unsigned thread;       // index of the calling thread in [0, thread_count)
+  unsigned thread_count; // threads taking part in the region
+  bool barrier_sense;
+} BCPoolRegion;
+
+typedef void (*BCPoolRegionFunc)(BCPoolRegion* region, void* ctx);
+typedef void (*BCPoolTaskFunc)(void* ctx, size_t task);
+
+// number of threads including the caller
+unsigned bc_pool_size();
+void bc_pool_parallel(size_t work, BCPoolRegionFunc func, void* ctx);
+// has to be called by all threads of the region with the same arguments
+void bc_pool_for(BCPoolRegion* region, size_t task_count, BCPoolTaskFunc func, void* ctx);
+void bc_pool_barrier(BCPoolRegion* region);
@@ -0,0 +1,466 @@
+#include "batch.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bc_queue.h"
+#include "buffer_pool.h"
+#include "image_io.h"
+
+/*
+ * Batch mode: many images in one process, in a pipeline of reader, kernel and writer threads.
+ * The stages are connected by bounded lock-free queues, so at most 2 * BATCH_QUEUE_CAPACITY images plus one per thread
+ * are in memory at the same time. Readers pick the next input file via an atomic index.
+ * When the last thread of a stage is done, it pushes one NULL per thread of the next stage to terminate them.
+ * The output names are computed before the threads start, two inputs with the same name (a/x.ppm, b/x.ppm) would
+ * overwrite each other's output => an error before any image is processed.
+ */
+
+#define BATCH_QUEUE_CAPACITY 8
+
+const uint32_t bc_default_batch_readers = 2;
+const uint32_t bc_default_batch_writers = 2;
+
+typedef struct
+{
+  const char* input_file;
+  const char* output_file;
+  uint8_t* source_image;
+  uint8_t* result_image;
+  size_t width;
+  size_t height;
+} BCBatchJob;
+
+typedef struct
+{
+  const BCInput* input;
+  const char* prog_name;
+
+  char** files;
+  char** output_files; // per input file
+  size_t file_count;
+  atomic_size_t next_file;
+
+  uint32_t threads[3]; // readers, kernels, writers
+  atomic_uint readers_running;
+  atomic_uint kernels_running;
+
+  BCQueue kernel_queue; // read images
+  BCQueue write_queue;  // processed images
+
+  atomic_size_t images_done;
+  atomic_size_t images_failed;
+  atomic_size_t pixels_done;
+} BCBatch;
+
+static void batch_job_free(BCBatchJob* job)
+{
+  bc_buffer_free(job->source_image);
+  bc_buffer_free(job->result_image);
+  free(job);
+}
+
+// <output dir>/<input file name without extension>.pgm
+static char* batch_output_file(const char* output_dir, const char* input_file)
+{
+  const char* name = strrchr(input_file, '/');
+  name = name ? name + 1 : input_file;
+
+  const char* extension = strrchr(name, '.');
+  const int name_length = (int) (extension && extension != name ? (size_t) (extension - name) : strlen(name));
+
+  const size_t size = strlen(output_dir) + 1 + (size_t) name_length + sizeof(".pgm");
+  char* output_file = malloc(size);
+  if (output_file)
+    snprintf(output_file, size, "%s/%.*s.pgm", output_dir, name_length, name);
+
+  return output_file;
+}
+
+// the last reader terminates the kernels
+static void batch_reader_done(BCBatch* batch)
+{
+  if (atomic_fetch_sub(&batch->readers_running, 1) == 1)
+  {
+    for (uint32_t i = 0; i < batch->threads[1]; ++i)
+      bc_queue_push(&batch->kernel_queue, NULL);
+  }
+}
+
+// the last kernel terminates the writers
+static void batch_kernel_done(BCBatch* batch)
+{
+  if (atomic_fetch_sub(&batch->kernels_running, 1) == 1)
+  {
+    for (uint32_t i = 0; i < batch->threads[2]; ++i)
+      bc_queue_push(&batch->write_queue, NULL);
+  }
+}
+
+static void* batch_reader(void* arg)
+{
+  BCBatch* batch = arg;
+
+  while (true)
+  {
+    const size_t idx = atomic_fetch_add(&batch->next_file, 1);
+    if (idx >= batch->file_count)
+      break;
+
+    BCBatchJob* job = calloc(1, sizeof(*job));
+    if (!job)
+    {
+      fprintf(stderr, "%s: Not enough memory\n", batch->prog_name);
+      atomic_fetch_add(&batch->images_failed, 1);
+      continue;
+    }
+
+    job->input_file = batch->files[idx];
+    job->output_file = batch->output_files[idx];
+    if (read_source_image(job->input_file, &job->source_image, &job->width, &job->height, batch->prog_name))
+    {
+      fprintf(stderr, "%s: Failed to read input image: %s\n", batch->prog_name, job->input_file);
+      batch_job_free(job);
+      atomic_fetch_add(&batch->images_failed, 1);
+      continue;
+    }
+
+    bc_queue_push(&batch->kernel_queue, job);
+  }
+
+  batch_reader_done(batch);
+  return NULL;
+}
+
+static void* batch_kernel(void* arg)
+{
+  BCBatch* batch = arg;
+  const BCInput* input = batch->input;
+
+  BCBatchJob* job;
+  while ((job = bc_queue_pop(&batch->kernel_queue)))
+  {
+    // width * height * 3 fit into size_t when the image was read. Not alloc_image_pointer: its error message uses the
+    // program name of the thread's last image_io call, this thread has none
+    job->result_image = bc_buffer_alloc(job->width * job->height);
+    if (!job->result_image)
+    {
+      fprintf(stderr, "%s: Not enough memory\n", batch->prog_name);
+      batch_job_free(job);
+      atomic_fetch_add(&batch->images_failed, 1);
+      continue;
+    }
+
+    bc_implementation[input->impl].impl(job->source_image, job->width, job->height,
+                                        input->coeffs[0], input->coeffs[1], input->coeffs[2],
+                                        input->brightness, input->contrast, job->result_image);
+
+    // the rgb image isn't needed anymore, release it before the job waits for a writer
+    bc_buffer_free(job->source_image);
+    job->source_image = NULL;
+
+    bc_queue_push(&batch->write_queue, job);
+  }
+
+  batch_kernel_done(batch);
+  return NULL;
+}
+
+static void* batch_writer(void* arg)
+{
+  BCBatch* batch = arg;
+
+  BCBatchJob* job;
+  while ((job = bc_queue_pop(&batch->write_queue)))
+  {
+    if (write_to_res_img(job->output_file, job->result_image, job->width, job->height, batch->prog_name))
+      atomic_fetch_add(&batch->images_failed, 1);
+    else
+    {
+      atomic_fetch_add(&batch->images_done, 1);
+      atomic_fetch_add(&batch->pixels_done, job->width * job->height);
+    }
+
+    batch_job_free(job);
+  }
+
+  return NULL;
+}
+
+static int batch_compare_output_file(const void* lhs, const void* rhs)
+{
+  return strcmp(**(char** const*) lhs, **(char** const*) rhs);
+}
+
+// output file of every input file, returns -1 if out of memory, 1 if two inputs would write the same output
+static int batch_output_files(BCBatch* batch, const char* output_dir, const char* prog_name)
+{
+  int ret = 0;
+  char*** sorted = NULL;
+
+  batch->output_files = calloc(batch->file_count, sizeof(*batch->output_files));
+  if (!batch->output_files)
+    goto OUT_OF_MEMORY;
+
+  for (size_t i = 0; i < batch->file_count; ++i)
+  {
+    if (!(batch->output_files[i] = batch_output_file(output_dir, batch->files[i])))
+      goto OUT_OF_MEMORY;
+  }
+
+  // pointers into output_files, the input of a name follows from its index
+  sorted = malloc(batch->file_count * sizeof(*sorted));
+  if (!sorted)
+    goto OUT_OF_MEMORY;
+
+  for (size_t i = 0; i < batch->file_count; ++i)
+    sorted[i] = &batch->output_files[i];
+
+  qsort(sorted, batch->file_count, sizeof(*sorted), &batch_compare_output_file);
+
+  for (size_t i = 1; i < batch->file_count; ++i)
+  {
+    if (strcmp(*sorted[i - 1], *sorted[i]) == 0)
+    {
+      fprintf(stderr, "%s: %s and %s would both be written to %s\n", prog_name,
+              batch->files[sorted[i - 1] - batch->output_files], batch->files[sorted[i] - batch->output_files],
+              *sorted[i]);
+      ret = 1;
+    }
+  }
+
+  free(sorted);
+  return ret;
+
+OUT_OF_MEMORY:
+  fprintf(stderr, "%s: Not enough memory\n", prog_name);
+  free(sorted);
+  return -1;
+}
+
+// starting a thread of the stage failed after <started> of them. The later stages are started first, so they run
+// already and no thread of the earlier stages does => no further input is read, and the missing threads finish
+// as if they had run, so the pipeline drains and terminates
+static void batch_start_failed(BCBatch* batch, int stage, uint32_t started)
+{
+  atomic_store(&batch->next_file, batch->file_count);
+
+  if (stage == 0)
+  {
+    for (uint32_t i = started; i < batch->threads[0]; ++i)
+      batch_reader_done(batch);
+  }
+  else if (stage == 1)
+  {
+    // the started kernels still wait for their NULL => the missing ones can't be the last
+    const uint32_t kernels = batch->threads[1];
+    batch->threads[1] = started;
+    for (uint32_t i = started; i < kernels; ++i)
+      batch_kernel_done(batch);
+
+    for (uint32_t i = 0; i < batch->threads[0]; ++i)
+      batch_reader_done(batch);
+  }
+  else
+  {
+    batch->threads[2] = started;
+    for (uint32_t i = 0; i < batch->threads[1]; ++i)
+      batch_kernel_done(batch);
+  }
+}
+
+// one input file per line, empty lines are skipped
+static int batch_read_manifest(const char* manifest, char*** files, size_t* file_count, const char* prog_name)
+{
+  FILE* file = strcmp(manifest, "-") == 0 ? stdin : fopen(manifest, "r");
+  if (!file)
+  {
+    fprintf(stderr, "%s: Error opening manifest file: %s\n", prog_name, manifest);
+    return -1;
+  }
+
+  int ret = 0;
+  size_t capacity = 0;
+  char* line = NULL;
+  size_t line_size = 0;
+  ssize_t length;
+
+  while ((length = getline(&line, &line_size, file)) >= 0)
+  {
+    while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+      line[--length] = '\0';
+
+    if (length == 0)
+      continue;
+
+    if (*file_count == capacity)
+    {
+      capacity = capacity ? 2 * capacity : 64;
+      char** resized = realloc(*files, capacity * sizeof(**files));
+      if (!resized)
+      {
+        fprintf(stderr, "%s: Not enough memory\n", prog_name);
+        ret = -1;
+        goto END;
+      }
+
+      *files = resized;
+    }
+
+    if (!((*files)[*file_count] = strdup(line)))
+    {
+      fprintf(stderr, "%s: Not enough memory\n", prog_name);
+      ret = -1;
+      goto END;
+    }
+
+    ++*file_count;
+  }
+
+END:
+  free(line);
+  if (file != stdin)
+    fclose(file);
+
+  return ret;
+}
+
+int bc_batch_process(const BCInput* input, const char* prog_name)
+{
+  int ret = 0;
+  BCBatch batch = { .input = input, .prog_name = prog_name };
+  char** manifest_files = NULL;
+  size_t manifest_file_count = 0;
+  pthread_t* threads = NULL;
+  uint32_t threads_started = 0;
+  bool queues_initialized = false;
+
+  if (input->batch_file_count > 0)
+  {
+    batch.files = input->batch_files;
+    batch.file_count = input->batch_file_count;
+  }
+  else
+  {
+    // no files given as arguments => manifest file or list on stdin
+    if ((ret = batch_read_manifest(input->batch_manifest ? input->batch_manifest : "-", &manifest_files,
+                                   &manifest_file_count, prog_name)))
+      goto CLEANUP;
+
+    batch.files = manifest_files;
+    batch.file_count = manifest_file_count;
+  }
+
+  batch.threads[0] = input->batch_threads[0] ? input->batch_threads[0] : bc_default_batch_readers;
+  batch.threads[1] = input->batch_threads[1] ? input->batch_threads[1] : (uint32_t) sysconf(_SC_NPROCESSORS_ONLN);
+  batch.threads[2] = input->batch_threads[2] ? input->batch_threads[2] : bc_default_batch_writers;
+  if (batch.threads[1] == 0)
+    batch.threads[1] = 1;
+
+  if ((ret = batch_output_files(&batch, input->output_file, prog_name)))
+    goto CLEANUP;
+
+  atomic_init(&batch.next_file, 0);
+  atomic_init(&batch.readers_running, batch.threads[0]);
+  atomic_init(&batch.kernels_running, batch.threads[1]);
+  atomic_init(&batch.images_done, 0);
+  atomic_init(&batch.images_failed, 0);
+  atomic_init(&batch.pixels_done, 0);
+
+  if (bc_queue_init(&batch.kernel_queue, BATCH_QUEUE_CAPACITY))
+  {
+    fprintf(stderr, "%s: Not enough memory\n", prog_name);
+    ret = -1;
+    goto CLEANUP;
+  }
+
+  if (bc_queue_init(&batch.write_queue, BATCH_QUEUE_CAPACITY))
+  {
+    bc_queue_destroy(&batch.kernel_queue);
+    fprintf(stderr, "%s: Not enough memory\n", prog_name);
+    ret = -1;
+    goto CLEANUP;
+  }
+
+  queues_initialized = true;
+
+  const uint32_t thread_count = batch.threads[0] + batch.threads[1] + batch.threads[2];
+  threads = malloc(thread_count * sizeof(*threads));
+  if (!threads)
+  {
+    fprintf(stderr, "%s: Not enough memory\n", prog_name);
+    ret = -1;
+    goto CLEANUP;
+  }
+
+  printf("%s: Processing %zu images using %s (%u readers, %u kernels, %u writers)...\n", prog_name, batch.file_count,
+         bc_implementation[input->impl].name, batch.threads[0], batch.threads[1], batch.threads[2]);
+  fflush(stdout);
+
+  struct timespec time_start;
+  struct timespec time_end;
+  clock_gettime(CLOCK_MONOTONIC, &time_start);
+
+  // writers first: if a thread can't be started, everything behind it in the pipeline runs and can be drained
+  void* (*const stage_func[3])(void*) = { &batch_reader, &batch_kernel, &batch_writer };
+  for (int stage = 2; stage >= 0 && !ret; --stage)
+  {
+    for (uint32_t i = 0; i < batch.threads[stage]; ++i)
+    {
+      if (pthread_create(&threads[threads_started], NULL, stage_func[stage], &batch))
+      {
+        fprintf(stderr, "%s: Failed to start batch threads\n", prog_name);
+        batch_start_failed(&batch, stage, i);
+        ret = -1;
+        break;
+      }
+
+      ++threads_started;
+    }
+  }
+
+  for (uint32_t i = 0; i < threads_started; ++i)
+    pthread_join(threads[i], NULL);
+
+  clock_gettime(CLOCK_MONOTONIC, &time_end);
+
+  const double time_elapsed = (double) (time_end.tv_sec - time_start.tv_sec) +
+                              1e-9 * (double) (time_end.tv_nsec - time_start.tv_nsec);
+  const size_t images_done = atomic_load(&batch.images_done);
+  const size_t images_failed = atomic_load(&batch.images_failed);
+  const size_t pixels_done = atomic_load(&batch.pixels_done);
+
+  printf("========== Batch Results ==========\n");
+  printf("Images processed    : %zu (%zu failed)\n", images_done, images_failed);
+  printf("Implementation used : %s\n", bc_implementation[input->impl].name);
+  printf("Pipeline threads    : %u readers, %u kernels, %u writers\n", batch.threads[0], batch.threads[1], batch.threads[2]);
+  printf("Total time elapsed  : %.6f seconds\n", time_elapsed);
+  printf("Throughput          : %.2f images/s, %.2f MP/s\n", (double) images_done / time_elapsed,
+         (double) pixels_done / 1e6 / time_elapsed);
+
+  if (images_failed > 0 && !ret)
+    ret = 1;
+
+CLEANUP:
+  if (queues_initialized)
+  {
+    bc_queue_destroy(&batch.kernel_queue);
+    bc_queue_destroy(&batch.write_queue);
+  }
+
+  for (size_t i = 0; batch.output_files && i < batch.file_count; ++i)
+    free(batch.output_files[i]);
+
+  for (size_t i = 0; i < manifest_file_count; ++i)
+    free(manifest_files[i]);
+
+  free(batch.output_files);
+  free(manifest_files);
+  free(threads);
+  return ret;
+}
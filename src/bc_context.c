@@ -0,0 +1,106 @@
+#include "bc_context.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "bc_stages.h"
+#include "buffer_pool.h"
+#include "bc_trace.h"
+
+// 96 KiB of rgb data and 32 KiB of grayscale values per block, same as the histogram implementations
+#define CONTEXT_BLOCK_PIXELS (32 * 1024)
+
+int bc_context_init(BCContext* ctx, const uint8_t* img, size_t width, size_t height)
+{
+  ctx->img = img;
+  ctx->width = width;
+  ctx->height = height;
+  ctx->gray = NULL;
+  ctx->gray_valid = false;
+
+  const size_t pixel_count = width * height;
+  if (width != 0 && (pixel_count / width != height || pixel_count > SIZE_MAX / 3))
+    return 1;
+
+  ctx->gray = bc_buffer_alloc(pixel_count);
+  return ctx->gray ? 0 : -1;
+}
+
+void bc_context_destroy(BCContext* ctx)
+{
+  bc_buffer_free(ctx->gray);
+  ctx->gray = NULL;
+  ctx->gray_valid = false;
+}
+
+void bc_context_invalidate(BCContext* ctx)
+{
+  ctx->gray_valid = false;
+}
+
+// grayscale plane and its mean and variance from the exact sums, on all cores
+static void context_grayscale(BCContext* ctx, float a, float b, float c, int16_t brightness)
+{
+  const size_t pixel_count = ctx->width * ctx->height;
+  const size_t blocks = (pixel_count + CONTEXT_BLOCK_PIXELS - 1) / CONTEXT_BLOCK_PIXELS;
+  const float coeff_sum = a + b + c;
+  uint64_t sum = 0;
+  uint64_t sum_squares = 0;
+
+  // integer sums => the order of the reduction doesn't change the result
+  #pragma omp parallel for schedule(static) reduction(+:sum, sum_squares)
+  for (size_t block = 0; block < blocks; ++block)
+  {
+    const size_t from = block * CONTEXT_BLOCK_PIXELS;
+    const size_t count = pixel_count - from < CONTEXT_BLOCK_PIXELS ? pixel_count - from : CONTEXT_BLOCK_PIXELS;
+
+    const uint64_t trace = bc_trace_begin();
+    uint64_t block_squares;
+    sum += bc_stage_grayscale(&ctx->img[from * 3], count, a / coeff_sum, b / coeff_sum, c / coeff_sum, brightness,
+                              &ctx->gray[from], &block_squares);
+    sum_squares += block_squares;
+    bc_trace_end(BCTraceGrayscale, trace);
+  }
+
+  const uint64_t trace = bc_trace_begin();
+  bc_stats_from_sums(sum, sum_squares, pixel_count, &ctx->avg, &ctx->sigma);
+  bc_trace_end(BCTraceStats, trace);
+
+  ctx->coeffs[0] = a;
+  ctx->coeffs[1] = b;
+  ctx->coeffs[2] = c;
+  ctx->brightness = brightness;
+  ctx->gray_valid = true;
+}
+
+bool bc_context_apply(BCContext* ctx, float a, float b, float c, int16_t brightness, float contrast, uint8_t* result)
+{
+  const bool cached = ctx->gray_valid && ctx->coeffs[0] == a && ctx->coeffs[1] == b && ctx->coeffs[2] == c &&
+                      ctx->brightness == brightness;
+  if (!cached)
+    context_grayscale(ctx, a, b, c, brightness);
+
+  const size_t pixel_count = ctx->width * ctx->height;
+  const size_t blocks = (pixel_count + CONTEXT_BLOCK_PIXELS - 1) / CONTEXT_BLOCK_PIXELS;
+
+  // the cached plane stays untouched: every block is copied to result and mapped in place right after,
+  // while it is still in L1/L2 => one pass over memory
+  float div, adjusted_avg;
+  uint8_t lut[BC_HISTOGRAM_BINS];
+  bc_contrast_factors(contrast, ctx->avg, ctx->sigma, &sqrtf, &div, &adjusted_avg);
+  bc_contrast_lut_build(lut, div, adjusted_avg);
+
+  #pragma omp parallel for schedule(static)
+  for (size_t block = 0; block < blocks; ++block)
+  {
+    const size_t from = block * CONTEXT_BLOCK_PIXELS;
+    const size_t count = pixel_count - from < CONTEXT_BLOCK_PIXELS ? pixel_count - from : CONTEXT_BLOCK_PIXELS;
+
+    const uint64_t trace = bc_trace_begin();
+    memcpy(&result[from], &ctx->gray[from], count);
+    bc_stage_contrast_lut(&result[from], count, lut);
+    bc_trace_end(BCTraceContrast, trace);
+  }
+
+  return cached;
+}
@@ -0,0 +1,171 @@
+#include "bc_queue.h"
+
+#include <immintrin.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+int bc_queue_init(BCQueue* queue, size_t capacity)
+{
+  if (capacity < 2 || (capacity & (capacity - 1)) != 0)
+    return 1;
+
+  queue->cells = malloc(capacity * sizeof(*queue->cells));
+  if (!queue->cells)
+    return -1;
+
+  if (pthread_mutex_init(&queue->mutex, NULL))
+    goto MUTEX_FAILED;
+
+  if (pthread_cond_init(&queue->not_full, NULL))
+    goto NOT_FULL_FAILED;
+
+  if (pthread_cond_init(&queue->not_empty, NULL))
+    goto NOT_EMPTY_FAILED;
+
+  for (size_t i = 0; i < capacity; ++i)
+    atomic_init(&queue->cells[i].sequence, i);
+
+  queue->mask = capacity - 1;
+  atomic_init(&queue->enqueue_pos, 0);
+  atomic_init(&queue->dequeue_pos, 0);
+  atomic_init(&queue->push_waiters, 0);
+  atomic_init(&queue->pop_waiters, 0);
+  return 0;
+
+NOT_EMPTY_FAILED:
+  pthread_cond_destroy(&queue->not_full);
+NOT_FULL_FAILED:
+  pthread_mutex_destroy(&queue->mutex);
+MUTEX_FAILED:
+  free(queue->cells);
+  queue->cells = NULL;
+  return -1;
+}
+
+void bc_queue_destroy(BCQueue* queue)
+{
+  pthread_cond_destroy(&queue->not_empty);
+  pthread_cond_destroy(&queue->not_full);
+  pthread_mutex_destroy(&queue->mutex);
+  free(queue->cells);
+  queue->cells = NULL;
+}
+
+bool bc_queue_try_push(BCQueue* queue, void* data)
+{
+  size_t pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+
+  while (true)
+  {
+    BCQueueCell* cell = &queue->cells[pos & queue->mask];
+    const size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    const intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+
+    if (diff == 0) // cell is free in this round => claim it
+    {
+      if (atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed))
+      {
+        cell->data = data;
+        atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+        return true;
+      }
+      // pos was updated by the failed CAS
+    }
+    else if (diff < 0) // cell still holds an element of the last round => full
+      return false;
+    else
+      pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+  }
+}
+
+bool bc_queue_try_pop(BCQueue* queue, void** data)
+{
+  size_t pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+
+  while (true)
+  {
+    BCQueueCell* cell = &queue->cells[pos & queue->mask];
+    const size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    const intptr_t diff = (intptr_t) sequence - (intptr_t) (pos + 1);
+
+    if (diff == 0) // cell was filled in this round => take it
+    {
+      if (atomic_compare_exchange_weak_explicit(&queue->dequeue_pos, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed))
+      {
+        *data = cell->data;
+        // free for the producers of the next round
+        atomic_store_explicit(&cell->sequence, pos + queue->mask + 1, memory_order_release);
+        return true;
+      }
+    }
+    else if (diff < 0) // empty
+      return false;
+    else
+      pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+  }
+}
+
+// tries of the blocking push/pop before they sleep, an element usually arrives within a few hundred cycles
+#define QUEUE_SPIN_TRIES 64
+
+// the waiter increments its counter and tries again with the mutex held, the waker makes its change and then reads the
+// counter. The seq_cst fences order both (Dekker): either the waiter's try sees the change or the waker sees the waiter
+// and signals after it released the mutex in pthread_cond_wait
+static void queue_wake(BCQueue* queue, atomic_uint* waiters, pthread_cond_t* cond)
+{
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(waiters, memory_order_relaxed) == 0)
+    return;
+
+  pthread_mutex_lock(&queue->mutex);
+  pthread_cond_broadcast(cond);
+  pthread_mutex_unlock(&queue->mutex);
+}
+
+void bc_queue_push(BCQueue* queue, void* data)
+{
+  bool pushed = false;
+  for (int i = 0; i < QUEUE_SPIN_TRIES && !(pushed = bc_queue_try_push(queue, data)); ++i)
+    _mm_pause();
+
+  if (!pushed)
+  {
+    pthread_mutex_lock(&queue->mutex);
+    atomic_fetch_add_explicit(&queue->push_waiters, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    while (!bc_queue_try_push(queue, data))
+      pthread_cond_wait(&queue->not_full, &queue->mutex);
+
+    atomic_fetch_sub_explicit(&queue->push_waiters, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&queue->mutex);
+  }
+
+  queue_wake(queue, &queue->pop_waiters, &queue->not_empty);
+}
+
+void* bc_queue_pop(BCQueue* queue)
+{
+  void* data;
+  bool popped = false;
+  for (int i = 0; i < QUEUE_SPIN_TRIES && !(popped = bc_queue_try_pop(queue, &data)); ++i)
+    _mm_pause();
+
+  if (!popped)
+  {
+    pthread_mutex_lock(&queue->mutex);
+    atomic_fetch_add_explicit(&queue->pop_waiters, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    while (!bc_queue_try_pop(queue, &data))
+      pthread_cond_wait(&queue->not_empty, &queue->mutex);
+
+    atomic_fetch_sub_explicit(&queue->pop_waiters, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&queue->mutex);
+  }
+
+  queue_wake(queue, &queue->push_waiters, &queue->not_full);
+  return data;
+}
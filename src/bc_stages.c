@@ -0,0 +1,572 @@
+#include "bc_stages.h"
+
+#include <math.h>
+#include <string.h>
+#include <emmintrin.h> //SSE2
+#include <smmintrin.h> //SSE4.1
+
+#include "cpu_features.h"
+
+static inline float clamp_float(float min, float max, float val)
+{
+  const float t = val < min ? min : val;
+  return t > max ? max : t;
+}
+
+// ================================================================
+// Dispatch
+// ================================================================
+
+uint64_t bc_stage_grayscale(const uint8_t *img, size_t pixel_count, float a, float b, float c, int16_t brightness,
+                            uint8_t *result, uint64_t *sum_squares)
+{
+  switch (bc_cpu_level())
+  {
+    case BCCpuAVX512:
+      return bc_grayscale_avx512(img, pixel_count, a, b, c, brightness, result, sum_squares);
+    case BCCpuAVX2:
+      return bc_grayscale_avx2(img, pixel_count, a, b, c, brightness, result, sum_squares);
+    default:
+      return bc_grayscale_sse41(img, pixel_count, a, b, c, brightness, result, sum_squares);
+  }
+}
+
+void bc_stage_contrast(uint8_t *result, size_t pixel_count, float div, float adjusted_avg)
+{
+  switch (bc_cpu_level())
+  {
+    case BCCpuAVX512:
+      bc_contrast_avx512(result, pixel_count, div, adjusted_avg);
+      break;
+    case BCCpuAVX2:
+      bc_contrast_avx2(result, pixel_count, div, adjusted_avg);
+      break;
+    default:
+      bc_contrast_sse41(result, pixel_count, div, adjusted_avg);
+      break;
+  }
+}
+
+void bc_stage_contrast_lut(uint8_t *result, size_t pixel_count, const uint8_t lut[BC_HISTOGRAM_BINS])
+{
+  if (bc_cpu_has_vbmi())
+  {
+    bc_contrast_lut_avx512vbmi(result, pixel_count, lut);
+    return;
+  }
+
+  switch (bc_cpu_level())
+  {
+    case BCCpuAVX512:
+      bc_contrast_lut_avx512(result, pixel_count, lut);
+      break;
+    case BCCpuAVX2:
+      bc_contrast_lut_avx2(result, pixel_count, lut);
+      break;
+    default:
+      bc_contrast_lut_sse41(result, pixel_count, lut);
+      break;
+  }
+}
+
+// the fixed point kernels have no 512 bit variant yet, the AVX-512 level uses the AVX2 one
+uint64_t bc_stage_grayscale_fixed(const uint8_t *img, size_t pixel_count, const BCFixedCoeffs *coeffs,
+                                  int16_t brightness, uint8_t *result, uint64_t *sum_squares)
+{
+  if (bc_cpu_level() >= BCCpuAVX2)
+    return bc_grayscale_fixed_avx2(img, pixel_count, coeffs, brightness, result, sum_squares);
+
+  return bc_grayscale_fixed_sse41(img, pixel_count, coeffs, brightness, result, sum_squares);
+}
+
+void bc_stage_contrast_fixed(uint8_t *result, size_t pixel_count, const BCFixedContrast *contrast)
+{
+  if (bc_cpu_level() >= BCCpuAVX2)
+    bc_contrast_fixed_avx2(result, pixel_count, contrast);
+  else
+    bc_contrast_fixed_sse41(result, pixel_count, contrast);
+}
+
+void bc_contrast_lut_build(uint8_t lut[BC_HISTOGRAM_BINS], float div, float adjusted_avg)
+{
+  for (int val = 0; val < BC_HISTOGRAM_BINS; ++val)
+    lut[val] = (uint8_t) val;
+
+  bc_contrast_sisd(lut, BC_HISTOGRAM_BINS, div, adjusted_avg);
+}
+
+void bc_stats_from_sums(uint64_t sum, uint64_t sum_squares, uint64_t count, float *avg, float *sigma)
+{
+  // E[x^2] - E[x]^2 is exact enough in double: both sums are exact integers (< 2^53 up to ~10^11 pixels)
+  const double mean = (double) sum / (double) count;
+  const double variance = (double) sum_squares / (double) count - mean * mean;
+
+  *avg = (float) mean;
+  *sigma = (float) (variance > 0.0 ? variance : 0.0);
+}
+
+void bc_contrast_factors(float contrast, float avg, float sigma, float (*sqrt_func)(float),
+                         float *div, float *adjusted_avg)
+{
+  *div = (sigma == 0.0f && contrast == sigma) ? 0.0f : contrast / sqrt_func(sigma);
+  *adjusted_avg = (1.0f - *div) * avg;
+}
+
+// ================================================================
+// Fixed point quantization
+// ================================================================
+
+#define FIXED_COEFF_BITS 13
+#define FIXED_COEFF_LO_BITS 6
+#define FIXED_CONTRAST_MAX_SHIFT 7
+// with shift >= 2 the quantization errors add up to less than 0.5, so rounding gives at most +-1
+#define FIXED_CONTRAST_MIN_SHIFT 2
+// the fixed point grayscale values can be off by one, the contrast stage scales that by div. Up to 15/16 the scaled
+// error plus the quantization errors of the contrast stage (< 0.02 at shift 7) and the slightly shifted avg and sigma
+// stay below 1 => +-1 after rounding. From 1 on, a single off-by-one grayscale value can differ by 2 in the output
+#define FIXED_CONTRAST_MAX_DIV 0.9375f
+
+bool bc_fixed_coeffs(float a, float b, float c, BCFixedCoeffs *coeffs)
+{
+  const float coeff[3] = { a, b, c };
+
+  for (int i = 0; i < 3; ++i)
+  {
+    const long q = lrintf(coeff[i] * (float) (1 << FIXED_COEFF_BITS));
+    if (q < 0 || q > (1 << FIXED_COEFF_BITS))
+      return false;
+
+    // 1.0 would need hi = 128 => use hi = 127, lo = 64 instead
+    const long hi = (q >> FIXED_COEFF_LO_BITS) > INT8_MAX ? INT8_MAX : (q >> FIXED_COEFF_LO_BITS);
+    coeffs->hi[i] = (int8_t) hi;
+    coeffs->lo[i] = (int8_t) (q - (hi << FIXED_COEFF_LO_BITS));
+  }
+
+  // pmaddubsw saturates the sum of each byte pair at 32767 => 255 * (hi_r + hi_g) has to fit
+  return coeffs->hi[0] + coeffs->hi[1] <= 128;
+}
+
+bool bc_fixed_contrast(float div, float adjusted_avg, BCFixedContrast *contrast)
+{
+  if (!(fabsf(div) <= FIXED_CONTRAST_MAX_DIV))
+    return false;
+
+  for (int shift = FIXED_CONTRAST_MAX_SHIFT; shift >= FIXED_CONTRAST_MIN_SHIFT; --shift)
+  {
+    const float div_q = rintf(div * (float) (1 << (8 + shift)));
+    const float adjusted_avg_q = rintf(adjusted_avg * (float) (1 << shift));
+
+    if (fabsf(div_q) > (float) INT16_MAX || fabsf(adjusted_avg_q) > (float) INT16_MAX)
+      continue;
+
+    contrast->div = (int16_t) div_q;
+    contrast->adjusted_avg = (int16_t) adjusted_avg_q;
+    contrast->shift = shift;
+    return true;
+  }
+
+  return false;
+}
+
+// ================================================================
+// Histogram
+// ================================================================
+
+// sub-histograms count in 32 bit, so they are flushed into the 64 bit histogram at least every 2^32 - 1 values
+#define HISTOGRAM_LANES 4
+#define HISTOGRAM_FLUSH ((size_t) 1 << 30)
+
+void bc_histogram_add(const uint8_t *data, size_t count, uint64_t hist[BC_HISTOGRAM_BINS])
+{
+  uint32_t lanes[HISTOGRAM_LANES][BC_HISTOGRAM_BINS];
+
+  while (count > 0)
+  {
+    const size_t n = count < HISTOGRAM_FLUSH ? count : HISTOGRAM_FLUSH;
+    memset(lanes, 0, sizeof(lanes));
+
+    // consecutive equal values would serialize on a single counter, with 4 lanes the increments are independent.
+    // 8 values are loaded at once and extracted via shifts, which is cheaper than 8 byte loads
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+      uint64_t v;
+      memcpy(&v, &data[i], sizeof(v));
+
+      lanes[0][v & 0xFF]++;
+      lanes[1][(v >> 8) & 0xFF]++;
+      lanes[2][(v >> 16) & 0xFF]++;
+      lanes[3][(v >> 24) & 0xFF]++;
+      lanes[0][(v >> 32) & 0xFF]++;
+      lanes[1][(v >> 40) & 0xFF]++;
+      lanes[2][(v >> 48) & 0xFF]++;
+      lanes[3][v >> 56]++;
+    }
+
+    for (; i < n; ++i)
+      lanes[0][data[i]]++;
+
+    for (int bin = 0; bin < BC_HISTOGRAM_BINS; ++bin)
+      hist[bin] += (uint64_t) lanes[0][bin] + lanes[1][bin] + lanes[2][bin] + lanes[3][bin];
+
+    data += n;
+    count -= n;
+  }
+}
+
+void bc_histogram_stats(const uint64_t hist[BC_HISTOGRAM_BINS], float *avg, float *sigma)
+{
+  uint64_t count = 0;
+  uint64_t sum = 0;
+  uint64_t sum_squares = 0;
+  for (int bin = 0; bin < BC_HISTOGRAM_BINS; ++bin)
+  {
+    count += hist[bin];
+    sum += hist[bin] * (uint64_t) bin;
+    sum_squares += hist[bin] * (uint64_t) (bin * bin);
+  }
+
+  bc_stats_from_sums(sum, sum_squares, count, avg, sigma);
+}
+
+// ================================================================
+// SISD
+// ================================================================
+
+uint64_t bc_grayscale_sisd(const uint8_t *img, size_t pixel_count, float a, float b, float c, int16_t brightness,
+                           uint8_t *result, uint64_t *sum_squares)
+{
+  uint64_t sum = 0;
+  uint64_t squares = 0;
+  for (size_t i = 0; i < pixel_count; ++i)
+  {
+    const float res_val = clamp_float(0.0f, 255.0f,
+      (a * img[i * 3] + b * img[i * 3 + 1] + c * img[i * 3 + 2]) + (float) brightness);
+
+    result[i] = (uint8_t) rintf(res_val);
+    sum += result[i];
+    squares += (uint32_t) result[i] * result[i];
+  }
+
+  if (sum_squares)
+    *sum_squares = squares;
+
+  return sum;
+}
+
+void bc_contrast_sisd(uint8_t *result, size_t pixel_count, float div, float adjusted_avg)
+{
+  for (size_t i = 0; i < pixel_count; ++i)
+    result[i] = (uint8_t) rintf(clamp_float(0.0f, 255.0f, (div * (float) result[i]) + adjusted_avg));
+}
+
+void bc_contrast_lut_sisd(uint8_t *result, size_t pixel_count, const uint8_t lut[BC_HISTOGRAM_BINS])
+{
+  for (size_t i = 0; i < pixel_count; ++i)
+    result[i] = lut[result[i]];
+}
+
+static inline int16_t saturate_int16(int32_t val)
+{
+  return (int16_t) (val < INT16_MIN ? INT16_MIN : (val > INT16_MAX ? INT16_MAX : val));
+}
+
+// same integer operations as the SIMD kernels (pmaddubsw, psrlw), so the results are bit-identical
+uint64_t bc_grayscale_fixed_sisd(const uint8_t *img, size_t pixel_count, const BCFixedCoeffs *coeffs,
+                                 int16_t brightness, uint8_t *result, uint64_t *sum_squares)
+{
+  uint64_t sum = 0;
+  uint64_t squares = 0;
+  for (size_t i = 0; i < pixel_count; ++i)
+  {
+    const uint8_t* px = &img[i * 3];
+    // bc_fixed_coeffs only accepts non-negative factors
+    const uint32_t hi = (uint32_t) (px[0] * coeffs->hi[0] + px[1] * coeffs->hi[1] + px[2] * coeffs->hi[2]);
+    const uint32_t lo = (uint32_t) (px[0] * coeffs->lo[0] + px[1] * coeffs->lo[1] + px[2] * coeffs->lo[2]);
+    const int32_t val = (int32_t) ((hi + ((lo + (1 << 12)) >> 6)) >> 7) + brightness;
+
+    result[i] = (uint8_t) (val < 0 ? 0 : (val > 255 ? 255 : val));
+    sum += result[i];
+    squares += (uint32_t) result[i] * result[i];
+  }
+
+  if (sum_squares)
+    *sum_squares = squares;
+
+  return sum;
+}
+
+void bc_contrast_fixed_sisd(uint8_t *result, size_t pixel_count, const BCFixedContrast *contrast)
+{
+  const int16_t round = (int16_t) ((1 << contrast->shift) >> 1);
+
+  for (size_t i = 0; i < pixel_count; ++i)
+  {
+    // pmulhrsw: (a * b + 2^14) >> 15
+    const int32_t scaled = ((int32_t) (result[i] << 7) * contrast->div + (1 << 14)) >> 15;
+    const int32_t val = saturate_int16(saturate_int16(scaled + contrast->adjusted_avg) + round) >> contrast->shift;
+
+    result[i] = (uint8_t) (val < 0 ? 0 : (val > 255 ? 255 : val));
+  }
+}
+
+// ================================================================
+// SSE4.1: 16 pixels per iteration
+// ================================================================
+
+// the squares of 16 grayscale values are summed up in 4 x 32 bit lanes (4 * 255^2 per lane),
+// they have to be added to the 64 bit sums at least every 2^32 / (4 * 255^2) = 16513 iterations
+#define SQUARES_FLUSH_ITERATIONS 8192
+
+static inline __m128i squares_16_sse41(__m128i bytes)
+{
+  const __m128i lo = _mm_cvtepu8_epi16(bytes);
+  const __m128i hi = _mm_unpackhi_epi8(bytes, _mm_setzero_si128());
+
+  return _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi));
+}
+
+static inline __m128i add_epu32_to_epi64_sse41(__m128i sum, __m128i val)
+{
+  sum = _mm_add_epi64(sum, _mm_cvtepu32_epi64(val));
+  return _mm_add_epi64(sum, _mm_cvtepu32_epi64(_mm_srli_si128(val, 8)));
+}
+
+static inline __m128 gray_4_sse41(const uint8_t* img, __m128i mask_r, __m128i mask_g, __m128i mask_b,
+                                  __m128 coeff_a, __m128 coeff_b, __m128 coeff_c, __m128 brightness)
+{
+  // 16 bytes loaded, 12 bytes = 4 pixels used
+  const __m128i raw = _mm_loadu_si128((const __m128i*) img);
+
+  const __m128 red = _mm_cvtepi32_ps(_mm_shuffle_epi8(raw, mask_r));
+  const __m128 green = _mm_cvtepi32_ps(_mm_shuffle_epi8(raw, mask_g));
+  const __m128 blue = _mm_cvtepi32_ps(_mm_shuffle_epi8(raw, mask_b));
+
+  __m128 res = _mm_add_ps(_mm_add_ps(_mm_mul_ps(red, coeff_a), _mm_mul_ps(green, coeff_b)), _mm_mul_ps(blue, coeff_c));
+  res = _mm_add_ps(res, brightness);
+
+  return _mm_min_ps(_mm_max_ps(res, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+}
+
+static inline __m128i pack_16_sse41(__m128 v0, __m128 v1, __m128 v2, __m128 v3)
+{
+  const __m128i p01 = _mm_packus_epi32(_mm_cvtps_epi32(v0), _mm_cvtps_epi32(v1));
+  const __m128i p23 = _mm_packus_epi32(_mm_cvtps_epi32(v2), _mm_cvtps_epi32(v3));
+
+  return _mm_packus_epi16(p01, p23);
+}
+
+static inline __m128 load_4_bytes_as_ps_sse41(const uint8_t* src)
+{
+  return _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_loadu_si32(src)));
+}
+
+uint64_t bc_grayscale_sse41(const uint8_t *img, size_t pixel_count, float a, float b, float c, int16_t brightness,
+                            uint8_t *result, uint64_t *sum_squares)
+{
+  const __m128 coeff_a = _mm_set1_ps(a);
+  const __m128 coeff_b = _mm_set1_ps(b);
+  const __m128 coeff_c = _mm_set1_ps(c);
+  const __m128 brightness_ps = _mm_set1_ps((float) brightness);
+
+  const __m128i mask_r = _mm_setr_epi8(0, -1, -1, -1, 3, -1, -1, -1, 6, -1, -1, -1, 9, -1, -1, -1);
+  const __m128i mask_g = _mm_setr_epi8(1, -1, -1, -1, 4, -1, -1, -1, 7, -1, -1, -1, 10, -1, -1, -1);
+  const __m128i mask_b = _mm_setr_epi8(2, -1, -1, -1, 5, -1, -1, -1, 8, -1, -1, -1, 11, -1, -1, -1);
+
+  // the last load of an iteration reads 16 bytes at offset 36 => 52 bytes = 18 pixels have to be left
+  __m128i sum = _mm_setzero_si128();
+  __m128i squares = _mm_setzero_si128();
+  __m128i squares_32 = _mm_setzero_si128();
+  size_t iterations = 0;
+  size_t i = 0;
+  for (; i + 18 <= pixel_count; i += 16)
+  {
+    const uint8_t* src = &img[i * 3];
+    const __m128 g0 = gray_4_sse41(src,      mask_r, mask_g, mask_b, coeff_a, coeff_b, coeff_c, brightness_ps);
+    const __m128 g1 = gray_4_sse41(src + 12, mask_r, mask_g, mask_b, coeff_a, coeff_b, coeff_c, brightness_ps);
+    const __m128 g2 = gray_4_sse41(src + 24, mask_r, mask_g, mask_b, coeff_a, coeff_b, coeff_c, brightness_ps);
+    const __m128 g3 = gray_4_sse41(src + 36, mask_r, mask_g, mask_b, coeff_a, coeff_b, coeff_c, brightness_ps);
+
+    const __m128i bytes = pack_16_sse41(g0, g1, g2, g3);
+    sum = _mm_add_epi64(sum, _mm_sad_epu8(bytes, _mm_setzero_si128()));
+    squares_32 = _mm_add_epi32(squares_32, squares_16_sse41(bytes));
+    _mm_storeu_si128((__m128i*) &result[i], bytes);
+
+    if (++iterations == SQUARES_FLUSH_ITERATIONS)
+    {
+      squares = add_epu32_to_epi64_sse41(squares, squares_32);
+      squares_32 = _mm_setzero_si128();
+      iterations = 0;
+    }
+  }
+
+  squares = add_epu32_to_epi64_sse41(squares, squares_32);
+
+  uint64_t tail_squares;
+  const uint64_t tail_sum = bc_grayscale_sisd(&img[i * 3], pixel_count - i, a, b, c, brightness, &result[i],
+                                              &tail_squares);
+
+  if (sum_squares)
+    *sum_squares = (uint64_t) _mm_cvtsi128_si64(squares) + (uint64_t) _mm_extract_epi64(squares, 1) + tail_squares;
+
+  return (uint64_t) _mm_cvtsi128_si64(sum) + (uint64_t) _mm_extract_epi64(sum, 1) + tail_sum;
+}
+
+void bc_contrast_sse41(uint8_t *result, size_t pixel_count, float div, float adjusted_avg)
+{
+  const __m128 div_ps = _mm_set1_ps(div);
+  const __m128 adjusted_avg_ps = _mm_set1_ps(adjusted_avg);
+  const __m128 clamp_min = _mm_setzero_ps();
+  const __m128 clamp_max = _mm_set1_ps(255.0f);
+
+  size_t i = 0;
+  for (; i + 16 <= pixel_count; i += 16)
+  {
+    __m128 v[4];
+    for (size_t j = 0; j < 4; ++j)
+    {
+      v[j] = _mm_add_ps(_mm_mul_ps(div_ps, load_4_bytes_as_ps_sse41(&result[i + 4 * j])), adjusted_avg_ps);
+      v[j] = _mm_min_ps(_mm_max_ps(v[j], clamp_min), clamp_max);
+    }
+
+    _mm_storeu_si128((__m128i*) &result[i], pack_16_sse41(v[0], v[1], v[2], v[3]));
+  }
+
+  bc_contrast_sisd(&result[i], pixel_count - i, div, adjusted_avg);
+}
+
+/*
+ * pshufb can only look up 16 entries => the table is split into 16 parts of 16 entries (nibble splitting).
+ * For part k, idx = val - 16 * k is in [0, 15] only for the values belonging to this part. Adding 0x70 with
+ * unsigned saturation keeps the low nibble of those and sets bit 7 for all others (>= 16 or wrapped around),
+ * which makes pshufb write zero => or-ing the 16 lookups gives the result.
+ */
+void bc_contrast_lut_sse41(uint8_t *result, size_t pixel_count, const uint8_t lut[BC_HISTOGRAM_BINS])
+{
+  __m128i table[16];
+  for (int k = 0; k < 16; ++k)
+    table[k] = _mm_loadu_si128((const __m128i*) &lut[16 * k]);
+
+  const __m128i bias = _mm_set1_epi8(0x70);
+  const __m128i step = _mm_set1_epi8(16);
+
+  size_t i = 0;
+  for (; i + 16 <= pixel_count; i += 16)
+  {
+    __m128i idx = _mm_loadu_si128((const __m128i*) &result[i]);
+    __m128i res = _mm_setzero_si128();
+
+    for (int k = 0; k < 16; ++k)
+    {
+      res = _mm_or_si128(res, _mm_shuffle_epi8(table[k], _mm_adds_epu8(idx, bias)));
+      idx = _mm_sub_epi8(idx, step);
+    }
+
+    _mm_storeu_si128((__m128i*) &result[i], res);
+  }
+
+  bc_contrast_lut_sisd(&result[i], pixel_count - i, lut);
+}
+
+/*
+ * 8 pixels (24 bytes) from two overlapping loads: lo holds bytes 0..15, hi bytes 8..23.
+ * r and g of each pixel are gathered into byte pairs, b is paired with a zero byte, pmaddubsw then sums up each pair.
+ */
+#define FIXED_SHUFFLE_RG_LO _mm_setr_epi8(0, 1, 3, 4, 6, 7, 9, 10, -1, -1, -1, -1, -1, -1, -1, -1)
+#define FIXED_SHUFFLE_RG_HI _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 4, 5, 7, 8, 10, 11, 13, 14)
+#define FIXED_SHUFFLE_B_LO  _mm_setr_epi8(2, -1, 5, -1, 8, -1, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1)
+#define FIXED_SHUFFLE_B_HI  _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 6, -1, 9, -1, 12, -1, 15, -1)
+
+
+static inline __m128i gray_8_fixed_sse41(const uint8_t* img, __m128i hi_rg, __m128i hi_b, __m128i lo_rg, __m128i lo_b,
+                                         __m128i brightness)
+{
+  const __m128i raw_lo = _mm_loadu_si128((const __m128i*) img);
+  const __m128i raw_hi = _mm_loadu_si128((const __m128i*) (img + 8));
+
+  const __m128i rg = _mm_or_si128(_mm_shuffle_epi8(raw_lo, FIXED_SHUFFLE_RG_LO),
+                                  _mm_shuffle_epi8(raw_hi, FIXED_SHUFFLE_RG_HI));
+  const __m128i b = _mm_or_si128(_mm_shuffle_epi8(raw_lo, FIXED_SHUFFLE_B_LO),
+                                 _mm_shuffle_epi8(raw_hi, FIXED_SHUFFLE_B_HI));
+
+  // hi part in Q7 fits into int16, the lo part only as unsigned => add it after shifting it to Q7 (rounded)
+  const __m128i hi = _mm_add_epi16(_mm_maddubs_epi16(rg, hi_rg), _mm_maddubs_epi16(b, hi_b));
+  const __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_maddubs_epi16(rg, lo_rg), _mm_maddubs_epi16(b, lo_b)),
+                                   _mm_set1_epi16(1 << 12));
+  const __m128i gray = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(lo, 6)), 7);
+
+  return _mm_adds_epi16(gray, brightness);
+}
+
+uint64_t bc_grayscale_fixed_sse41(const uint8_t *img, size_t pixel_count, const BCFixedCoeffs *coeffs,
+                                  int16_t brightness, uint8_t *result, uint64_t *sum_squares)
+{
+  const __m128i hi_rg = _mm_set1_epi16((int16_t) ((uint8_t) coeffs->hi[1] << 8 | (uint8_t) coeffs->hi[0]));
+  const __m128i hi_b = _mm_set1_epi16(coeffs->hi[2]);
+  const __m128i lo_rg = _mm_set1_epi16((int16_t) ((uint8_t) coeffs->lo[1] << 8 | (uint8_t) coeffs->lo[0]));
+  const __m128i lo_b = _mm_set1_epi16(coeffs->lo[2]);
+  const __m128i brightness_epi16 = _mm_set1_epi16(brightness);
+
+  __m128i sum = _mm_setzero_si128();
+  __m128i squares = _mm_setzero_si128();
+  __m128i squares_32 = _mm_setzero_si128();
+  size_t iterations = 0;
+  size_t i = 0;
+  for (; i + 16 <= pixel_count; i += 16)
+  {
+    const uint8_t* src = &img[i * 3];
+    const __m128i g0 = gray_8_fixed_sse41(src,      hi_rg, hi_b, lo_rg, lo_b, brightness_epi16);
+    const __m128i g1 = gray_8_fixed_sse41(src + 24, hi_rg, hi_b, lo_rg, lo_b, brightness_epi16);
+
+    const __m128i bytes = _mm_packus_epi16(g0, g1);
+    sum = _mm_add_epi64(sum, _mm_sad_epu8(bytes, _mm_setzero_si128()));
+    squares_32 = _mm_add_epi32(squares_32, squares_16_sse41(bytes));
+    _mm_storeu_si128((__m128i*) &result[i], bytes);
+
+    if (++iterations == SQUARES_FLUSH_ITERATIONS)
+    {
+      squares = add_epu32_to_epi64_sse41(squares, squares_32);
+      squares_32 = _mm_setzero_si128();
+      iterations = 0;
+    }
+  }
+
+  squares = add_epu32_to_epi64_sse41(squares, squares_32);
+
+  uint64_t tail_squares;
+  const uint64_t tail_sum = bc_grayscale_fixed_sisd(&img[i * 3], pixel_count - i, coeffs, brightness, &result[i],
+                                                    &tail_squares);
+
+  if (sum_squares)
+    *sum_squares = (uint64_t) _mm_cvtsi128_si64(squares) + (uint64_t) _mm_extract_epi64(squares, 1) + tail_squares;
+
+  return (uint64_t) _mm_cvtsi128_si64(sum) + (uint64_t) _mm_extract_epi64(sum, 1) + tail_sum;
+}
+
+static inline __m128i contrast_8_fixed_sse41(__m128i val, __m128i div, __m128i adjusted_avg, __m128i round,
+                                             __m128i shift)
+{
+  const __m128i scaled = _mm_mulhrs_epi16(_mm_slli_epi16(val, 7), div);
+  return _mm_sra_epi16(_mm_adds_epi16(_mm_adds_epi16(scaled, adjusted_avg), round), shift);
+}
+
+void bc_contrast_fixed_sse41(uint8_t *result, size_t pixel_count, const BCFixedContrast *contrast)
+{
+  const __m128i div = _mm_set1_epi16(contrast->div);
+  const __m128i adjusted_avg = _mm_set1_epi16(contrast->adjusted_avg);
+  const __m128i round = _mm_set1_epi16((int16_t) ((1 << contrast->shift) >> 1));
+  const __m128i shift = _mm_cvtsi32_si128(contrast->shift);
+
+  size_t i = 0;
+  for (; i + 16 <= pixel_count; i += 16)
+  {
+    const __m128i bytes = _mm_loadu_si128((const __m128i*) &result[i]);
+    const __m128i lo = contrast_8_fixed_sse41(_mm_cvtepu8_epi16(bytes), div, adjusted_avg, round, shift);
+    const __m128i hi = contrast_8_fixed_sse41(_mm_unpackhi_epi8(bytes, _mm_setzero_si128()), div, adjusted_avg, round,
+                                              shift);
+
+    _mm_storeu_si128((__m128i*) &result[i], _mm_packus_epi16(lo, hi));
+  }
+
+  bc_contrast_fixed_sisd(&result[i], pixel_count - i, contrast);
+}
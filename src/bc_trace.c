@@ -0,0 +1,243 @@
+#include "bc_trace.h"
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_MAX_THREADS 256
+// events kept per thread for the Chrome trace, later events are only counted (about 1.5 MB per thread)
+#define TRACE_EVENTS_PER_THREAD (64 * 1024)
+
+const char* const bc_trace_stage_name[] =
+{
+  "run",       // BCTraceRun
+  "grayscale", // BCTraceGrayscale
+  "histogram", // BCTraceHistogram
+  "stats",     // BCTraceStats
+  "contrast",  // BCTraceContrast
+};
+
+static_assert((sizeof(bc_trace_stage_name) / sizeof(*bc_trace_stage_name)) == BCTraceMax, "Stage declared in enum is missing in "
+                                                                                        "bc_trace_stage_name array");
+
+typedef struct
+{
+  uint64_t start; // ns since the trace was enabled
+  uint64_t duration;
+  BCTraceStage stage;
+} BCTraceEvent;
+
+// written by its thread only, read while no traced code runs
+typedef struct
+{
+  uint64_t stage_ns[BCTraceMax];
+  uint64_t stage_calls[BCTraceMax];
+
+  BCTraceEvent *events;
+  size_t event_count;
+  size_t events_dropped;
+} BCTraceThread;
+
+bool bc_trace_active = false;
+
+static struct
+{
+  bool record_events;
+  uint64_t epoch;
+
+  atomic_uint thread_count;
+  atomic_size_t threads_dropped; // events of threads beyond TRACE_MAX_THREADS
+  BCTraceThread threads[TRACE_MAX_THREADS];
+} trace;
+
+static _Thread_local BCTraceThread *thread_slot = NULL;
+
+void bc_trace_enable(bool record_events)
+{
+  trace.record_events = record_events;
+  trace.epoch = bc_trace_now();
+  bc_trace_active = true;
+}
+
+void bc_trace_disable()
+{
+  bc_trace_active = false;
+}
+
+void bc_trace_reset()
+{
+  const unsigned threads = atomic_load(&trace.thread_count);
+
+  for (unsigned i = 0; i < threads && i < TRACE_MAX_THREADS; ++i)
+  {
+    BCTraceThread *thread = &trace.threads[i];
+    memset(thread->stage_ns, 0, sizeof(thread->stage_ns));
+    memset(thread->stage_calls, 0, sizeof(thread->stage_calls));
+    thread->event_count = 0;
+    thread->events_dropped = 0;
+  }
+
+  atomic_store(&trace.threads_dropped, 0);
+  trace.epoch = bc_trace_now();
+}
+
+void bc_trace_free()
+{
+  bc_trace_reset();
+
+  const unsigned threads = atomic_load(&trace.thread_count);
+  for (unsigned i = 0; i < threads && i < TRACE_MAX_THREADS; ++i)
+  {
+    free(trace.threads[i].events);
+    trace.threads[i].events = NULL;
+  }
+}
+
+void bc_trace_record(BCTraceStage stage, uint64_t start, uint64_t end)
+{
+  BCTraceThread *thread = thread_slot;
+  if (!thread)
+  {
+    // slots are handed out in the order the threads record their first event, they are never given back
+    const unsigned index = atomic_fetch_add(&trace.thread_count, 1);
+    if (index >= TRACE_MAX_THREADS)
+    {
+      atomic_fetch_add(&trace.threads_dropped, 1);
+      return;
+    }
+
+    thread = thread_slot = &trace.threads[index];
+  }
+
+  thread->stage_ns[stage] += end - start;
+  ++thread->stage_calls[stage];
+
+  if (!trace.record_events)
+    return;
+
+  if (!thread->events)
+    thread->events = malloc(TRACE_EVENTS_PER_THREAD * sizeof(*thread->events));
+
+  if (!thread->events || thread->event_count == TRACE_EVENTS_PER_THREAD)
+  {
+    ++thread->events_dropped;
+    return;
+  }
+
+  thread->events[thread->event_count++] = (BCTraceEvent)
+  {
+    .start = start - trace.epoch,
+    .duration = end - start,
+    .stage = stage
+  };
+}
+
+void bc_trace_print_summary(uint32_t runs)
+{
+  const unsigned threads = atomic_load(&trace.thread_count) < TRACE_MAX_THREADS ?
+                           atomic_load(&trace.thread_count) : TRACE_MAX_THREADS;
+  const double per_run = runs > 0 ? 1.0 / runs : 0.0;
+
+  uint64_t stage_ns[BCTraceMax] = { 0 };
+  uint64_t stage_calls[BCTraceMax] = { 0 };
+  uint64_t pipeline_ns = 0; // all stages except the whole run
+  for (unsigned i = 0; i < threads; ++i)
+  {
+    for (int stage = 0; stage < BCTraceMax; ++stage)
+    {
+      stage_ns[stage] += trace.threads[i].stage_ns[stage];
+      stage_calls[stage] += trace.threads[i].stage_calls[stage];
+      if (stage != BCTraceRun)
+        pipeline_ns += trace.threads[i].stage_ns[stage];
+    }
+  }
+
+  printf("========== Stage Summary ==========\n");
+  printf("%-10s %12s %18s %8s\n", "Stage", "Calls/run", "Seconds/run", "Share");
+  for (int stage = 0; stage < BCTraceMax; ++stage)
+  {
+    if (stage_calls[stage] == 0)
+      continue;
+
+    // the time is summed over all threads, the share is relative to the sum of all stages
+    printf("%-10s %12.1f %18.6f ", bc_trace_stage_name[stage], (double) stage_calls[stage] * per_run,
+           1e-9 * (double) stage_ns[stage] * per_run);
+    if (stage != BCTraceRun && pipeline_ns > 0)
+      printf("%7.1f%%\n", 100.0 * (double) stage_ns[stage] / (double) pipeline_ns);
+    else
+      printf("%8s\n", "-");
+  }
+
+  if (pipeline_ns == 0)
+    printf("(no stages recorded, the implementation is not instrumented)\n");
+
+  if (threads > 1)
+  {
+    printf("Seconds/run per thread:\n");
+    printf("%-10s", "Thread");
+    for (int stage = 0; stage < BCTraceMax; ++stage)
+      printf(" %12s", bc_trace_stage_name[stage]);
+    printf("\n");
+
+    for (unsigned i = 0; i < threads; ++i)
+    {
+      printf("%-10u", i);
+      for (int stage = 0; stage < BCTraceMax; ++stage)
+        printf(" %12.6f", 1e-9 * (double) trace.threads[i].stage_ns[stage] * per_run);
+      printf("\n");
+    }
+  }
+}
+
+// Chrome trace event format: complete events ("X") with timestamps in microseconds, one track per thread
+int bc_trace_write_chrome(const char* file_name, const char* prog_name)
+{
+  const unsigned threads = atomic_load(&trace.thread_count) < TRACE_MAX_THREADS ?
+                           atomic_load(&trace.thread_count) : TRACE_MAX_THREADS;
+  size_t dropped = atomic_load(&trace.threads_dropped);
+
+  FILE* json = fopen(file_name, "w+");
+  if (!json)
+  {
+    fprintf(stderr, "%s: Couldn't open %s\n", prog_name, file_name);
+    return -1;
+  }
+
+  fprintf(json, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+  fprintf(json, "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 0, \"args\": {\"name\": \"%s\"}}", prog_name);
+
+  for (unsigned i = 0; i < threads; ++i)
+  {
+    const BCTraceThread *thread = &trace.threads[i];
+    dropped += thread->events_dropped;
+
+    fprintf(json, ",\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %u, "
+                  "\"args\": {\"name\": \"thread %u\"}}", i, i);
+
+    for (size_t e = 0; e < thread->event_count; ++e)
+    {
+      const BCTraceEvent *event = &thread->events[e];
+      fprintf(json, ",\n  {\"name\": \"%s\", \"cat\": \"stage\", \"ph\": \"X\", \"pid\": 0, \"tid\": %u, "
+                    "\"ts\": %.3f, \"dur\": %.3f}",
+              bc_trace_stage_name[event->stage], i, 1e-3 * (double) event->start, 1e-3 * (double) event->duration);
+    }
+  }
+
+  fprintf(json, "\n]}\n");
+
+  int ret = 0;
+  if (ferror(json))
+  {
+    fprintf(stderr, "%s: Error writing %s\n", prog_name, file_name);
+    ret = -1;
+  }
+
+  fclose(json);
+
+  if (dropped > 0)
+    fprintf(stderr, "%s: %lu trace events didn't fit into the buffers and are missing in %s\n", prog_name, dropped, file_name);
+
+  return ret;
+}
@@ -1,106 +1,833 @@
+#define _GNU_SOURCE // sched_setaffinity
 #include "benchmark.h"
 
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <math.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <immintrin.h>
 
 #include "brightness_contrast.h"
+#include "buffer_pool.h"
+#include "cpu_features.h"
 #include "math_utils.h"
+#include "bc_trace.h"
+#include "perf_counters.h"
+#include "roofline.h"
 
-#define IT_PER_IMPL 7
+// the --csv sweep starts at this working set and grows by a factor of sqrt(2) up to the input image
+#define SWEEP_MIN_WORKING_SET (16 << 10)
+#define SWEEP_STEPS_PER_DOUBLING 2
+
+// minimum memory traffic of every implementation: 3 bytes read, 1 byte written per pixel
+#define BYTES_PER_PIXEL 4
+
+#define CACHE_LINE_SIZE 64
 
 const char* benchmark_csv_out_file = "benchmark.csv";
+const char* benchmark_json_out_file = "benchmark.json";
 
-const uint8_t benchmark_iterations_per_implementation = IT_PER_IMPL;
+// all times in seconds, calculated from the individually timed runs (warmup runs excluded)
+struct bench_stats
+{
+  double total;
+  double mean;
+  double min;
+  double median;
+  double p90;
+  double p99;
+  double stddev;
+};
 
+// an implementation or, with --roofline, a calibration kernel
 struct bench_result
 {
-  BCImplementation impl;
+  const char* name;
+  bool image; // an implementation => MP/s
   size_t pixels;
-  double times[2]; // [0] .. total | [1] .. avg
+  size_t working_set; // bytes, 0 .. no memory traffic (peak kernels)
+  const char* cache; // smallest cache level the working set fits in
+  double bytes; // memory traffic per run, 0 .. none
+  double flops; // float operations per run, 0 .. not counted
+  double bound_gbps; // roofline bound of an implementation, 0 .. not calibrated
+  struct bench_stats stats;
+  BCPerfValues perf; // per run, nothing valid without --perf
+  uint64_t warmup_page_faults; // minor + major, all warmup runs together (first touch of the result)
+  double page_faults; // minor + major per timed run
 };
 
-static int benchmark_write_csv(struct bench_result results[BCImplMax][IT_PER_IMPL], const char* prog_name);
-static void benchmark_sqrt_internal(const char* name, const size_t runs, float (*sqrt_func)(float));
+// bandwidth and compute limits of the machine at one working set, [0] .. single-threaded, [1] .. all cores
+struct roofline
+{
+  double copy_gbps[2];
+  double peak_gflops[2];
+};
+
+static int benchmark_write_csv(const struct bench_result *results, size_t result_count, const char* prog_name);
+static int benchmark_write_json(const BCInput *input, const struct bench_result *results, size_t result_count,
+                                const char* prog_name);
+static const char* benchmark_cache_level(size_t pixels);
+
+static inline double benchmark_now()
+{
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double) time.tv_sec + 1e-9 * (double) time.tv_nsec;
+}
+
+static inline double mpixels_per_second(const struct bench_result *result)
+{
+  return result->stats.median > 0.0 ? 1e-6 * (double) result->pixels / result->stats.median : 0.0;
+}
+
+static inline double gbytes_per_second(const struct bench_result *result)
+{
+  return result->stats.median > 0.0 ? 1e-9 * result->bytes / result->stats.median : 0.0;
+}
+
+static inline double gflops_per_second(const struct bench_result *result)
+{
+  return result->stats.median > 0.0 ? 1e-9 * result->flops / result->stats.median : 0.0;
+}
+
+// memory traffic and float operations of an implementation, as in the roofline model
+static void benchmark_image_result(BCImplVersion impl, size_t pixels, struct bench_result *result)
+{
+  result->name = bc_implementation[impl].name;
+  result->image = true;
+  result->pixels = pixels;
+  result->working_set = pixels * BYTES_PER_PIXEL;
+  result->cache = benchmark_cache_level(pixels);
+  result->bytes = (double) (pixels * BYTES_PER_PIXEL);
+  result->flops = (double) (pixels * BC_FLOPS_PER_PIXEL);
+  result->bound_gbps = 0.0;
+}
+
+static const char* benchmark_cache_level(size_t pixels)
+{
+  static const int level_conf[] = { _SC_LEVEL1_DCACHE_SIZE, _SC_LEVEL2_CACHE_SIZE, _SC_LEVEL3_CACHE_SIZE };
+  static const char* const level_name[] = { "L1", "L2", "L3" };
+
+  for (size_t i = 0; i < sizeof(level_conf) / sizeof(*level_conf); ++i)
+  {
+    const long size = sysconf(level_conf[i]); // 0 or -1 if unknown
+    if (size > 0 && pixels * BYTES_PER_PIXEL <= (size_t) size)
+      return level_name[i];
+  }
+
+  return "DRAM";
+}
+
+// the cpu of --pin and the mask of the process before, set by benchmark_pin_cpu
+static bool benchmark_pinned = false;
+static cpu_set_t benchmark_pinned_set;
+static cpu_set_t benchmark_unpinned_set;
+
+// pins the calling thread to the given cpu, the multithreaded runs switch back to the previous mask
+// (benchmark_affinity). A failure is only reported, the benchmark still runs unpinned
+static void benchmark_pin_cpu(const BCInput *input, const char* prog_name)
+{
+  if (input->benchmark_pin_cpu < 0 || benchmark_pinned)
+    return;
+
+  if (input->benchmark_pin_cpu >= CPU_SETSIZE)
+  {
+    fprintf(stderr, "%s: Can't pin to CPU %d, running unpinned\n", prog_name, input->benchmark_pin_cpu);
+    return;
+  }
+
+  CPU_ZERO(&benchmark_pinned_set);
+  CPU_SET((size_t) input->benchmark_pin_cpu, &benchmark_pinned_set); // >= 0, checked above
+
+  if (sched_getaffinity(0, sizeof(benchmark_unpinned_set), &benchmark_unpinned_set) ||
+      sched_setaffinity(0, sizeof(benchmark_pinned_set), &benchmark_pinned_set))
+  {
+    fprintf(stderr, "%s: Can't pin to CPU %d (%s), running unpinned\n", prog_name, input->benchmark_pin_cpu, strerror(errno));
+    return;
+  }
+
+  benchmark_pinned = true;
+}
+
+// called before every benchmarked implementation or kernel. Single-threaded ones run on the pinned cpu, multithreaded
+// ones with the previous mask, so thread pools and OpenMP threads created during their warmup runs inherit all cpus
+// (and the calling thread, which takes part in the work, isn't stuck on one of them)
+static void benchmark_affinity(bool multithreaded)
+{
+  if (!benchmark_pinned)
+    return;
 
+  sched_setaffinity(0, sizeof(cpu_set_t), multithreaded ? &benchmark_unpinned_set : &benchmark_pinned_set);
+}
+
+// opened before the first implementation runs, so the counters are inherited by the thread pools
+static int benchmark_perf_open(const BCInput *input, BCPerfCounters *perf, const char* prog_name)
+{
+  if (!input->benchmark_perf)
+    return 0;
+
+  const int available = bc_perf_open(perf);
+  if (available == 0)
+  {
+    fprintf(stderr, "%s: No performance counters available (see /proc/sys/kernel/perf_event_paranoid), "
+                    "reporting times only\n", prog_name);
+    return 0;
+  }
+
+  for (int i = 0; i < BCPerfMax; ++i)
+  {
+    if (perf->fd[i] < 0)
+      fprintf(stderr, "%s: Performance counter %s not available\n", prog_name, bc_perf_counter_name[i]);
+  }
+
+  return available;
+}
+
+static void flush_cache_lines(const uint8_t *data, size_t size)
+{
+  for (size_t i = 0; i < size; i += CACHE_LINE_SIZE)
+    _mm_clflush(data + i);
+
+  if (size > 0)
+    _mm_clflush(data + size - 1);
+}
+
+static int compare_double(const void *a, const void *b)
+{
+  const double x = *(const double*) a;
+  const double y = *(const double*) b;
+  return (x > y) - (x < y);
+}
+
+// nearest-rank percentile of sorted samples
+static inline double percentile(const double *sorted, size_t count, double p)
+{
+  size_t rank = (size_t) ceil(p * (double) count);
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+// sorts the samples
+static void benchmark_stats(double *samples, size_t count, struct bench_stats *stats)
+{
+  if (count == 0)
+  {
+    *stats = (struct bench_stats) { 0 };
+    return;
+  }
+
+  double total = 0.0;
+  for (size_t i = 0; i < count; ++i)
+    total += samples[i];
+
+  const double mean = total / (double) count;
+  double squared_deviations = 0.0;
+  for (size_t i = 0; i < count; ++i)
+    squared_deviations += (samples[i] - mean) * (samples[i] - mean);
+
+  qsort(samples, count, sizeof(*samples), compare_double);
+
+  stats->total = total;
+  stats->mean = mean;
+  stats->min = samples[0];
+  stats->median = count % 2 ? samples[count / 2] : 0.5 * (samples[count / 2 - 1] + samples[count / 2]);
+  stats->p90 = percentile(samples, count, 0.90);
+  stats->p99 = percentile(samples, count, 0.99);
+  stats->stddev = count > 1 ? sqrt(squared_deviations / (double) (count - 1)) : 0.0;
+}
+
+// minor + major page faults of the process so far (all threads)
+static uint64_t benchmark_page_faults()
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage))
+    return 0;
+
+  return (uint64_t) usage.ru_minflt + (uint64_t) usage.ru_majflt;
+}
+
+// samples has to hold input->benchmark_runs values, perf is NULL if no counters are collected
 static void benchmark_implementation_internal(const BCInput *input, const size_t width, const size_t height,
                                               const uint8_t *source_image, uint8_t *result_image,
-                                              double *time_elapsed, double *time_avg)
+                                              double *samples, const BCPerfCounters *perf, struct bench_result *result)
+{
+  const BCImplementation *impl = &bc_implementation[input->impl];
+  benchmark_affinity(impl->multithreaded);
+  const uint64_t page_faults_start = benchmark_page_faults();
+
+  // first touch of the result pages, lazily created thread pools, frequency ramp-up
+  for (uint32_t i = 0; i < input->benchmark_warmup; ++i)
+  {
+    impl->impl(source_image, width, height, input->coeffs[0], input->coeffs[1], input->coeffs[2],
+               input->brightness, input->contrast, result_image);
+  }
+
+  const uint64_t page_faults_warm = benchmark_page_faults();
+
+  if (perf)
+    bc_perf_reset(perf);
+
+  // only the timed runs are traced
+  if (input->trace)
+    bc_trace_enable(input->trace_file != NULL);
+
+  for (uint32_t i = 0; i < input->benchmark_runs; ++i)
+  {
+    if (input->benchmark_cold)
+    {
+      // every run starts with input and result in memory only, the flush itself is not timed
+      flush_cache_lines(source_image, width * height * 3);
+      flush_cache_lines(result_image, width * height);
+      _mm_mfence();
+    }
+
+    // the counters only run around the timed part (not during the flush)
+    if (perf)
+      bc_perf_enable(perf);
+
+    const double start = benchmark_now();
+    const uint64_t trace = bc_trace_begin();
+    impl->impl(source_image, width, height, input->coeffs[0], input->coeffs[1], input->coeffs[2],
+               input->brightness, input->contrast, result_image);
+    bc_trace_end(BCTraceRun, trace);
+    samples[i] = benchmark_now() - start;
+
+    if (perf)
+      bc_perf_disable(perf);
+  }
+
+  bc_trace_disable();
+
+  const uint64_t page_faults_end = benchmark_page_faults();
+  result->warmup_page_faults = page_faults_warm - page_faults_start;
+  result->page_faults = input->benchmark_runs > 0 ?
+                        (double) (page_faults_end - page_faults_warm) / input->benchmark_runs : 0.0;
+
+  benchmark_stats(samples, input->benchmark_runs, &result->stats);
+
+  memset(&result->perf, 0, sizeof(result->perf));
+  if (perf && input->benchmark_runs > 0)
+  {
+    bc_perf_read(perf, &result->perf);
+    for (int i = 0; i < BCPerfMax; ++i)
+      result->perf.value[i] /= input->benchmark_runs;
+  }
+}
+
+// times one STREAM kernel on a buffer of result->working_set bytes (warm caches, no counters)
+static void benchmark_stream_internal(const BCInput *input, BCStreamKernel kernel, bool multithreaded, uint8_t *buffer,
+                                      double *samples, struct bench_result *result)
 {
-  struct timespec time_start;
-  struct timespec time_end;
+  static const char* const name[BCStreamMax][2] =
+  {
+    { "STREAM Read",  "STREAM Read MT"  },
+    { "STREAM Write", "STREAM Write MT" },
+    { "STREAM Copy",  "STREAM Copy MT"  },
+  };
 
-  clock_gettime(CLOCK_MONOTONIC, &time_start);
+  benchmark_affinity(multithreaded);
+  size_t bytes = 0;
+  for (uint32_t i = 0; i < input->benchmark_warmup; ++i)
+    bc_stream_run(kernel, buffer, result->working_set, multithreaded);
 
   for (uint32_t i = 0; i < input->benchmark_runs; ++i)
   {
-    bc_implementation[input->impl].impl(source_image, width, height,
-                                        input->coeffs[0], input->coeffs[1], input->coeffs[2],
-                                        input->brightness, input->contrast, result_image);
+    const double start = benchmark_now();
+    bytes = bc_stream_run(kernel, buffer, result->working_set, multithreaded);
+    samples[i] = benchmark_now() - start;
   }
 
-  clock_gettime(CLOCK_MONOTONIC, &time_end);
+  benchmark_stats(samples, input->benchmark_runs, &result->stats);
+  result->name = name[kernel][multithreaded];
+  result->image = false;
+  result->bytes = (double) bytes;
+  result->flops = 0.0;
+  result->bound_gbps = 0.0;
+  memset(&result->perf, 0, sizeof(result->perf));
+  result->warmup_page_faults = 0;
+  result->page_faults = 0.0;
+}
+
+static void benchmark_peak_internal(const BCInput *input, BCPeakKernel kernel, bool multithreaded,
+                                    double *samples, struct bench_result *result)
+{
+  static const char* const name[BCPeakMax][2] =
+  {
+    { "Peak Scalar", "Peak Scalar MT" },
+    { "Peak SIMD",   "Peak SIMD MT"   },
+  };
 
-  *time_elapsed = (double) (time_end.tv_sec - time_start.tv_sec) +
-                  1e-9 * (double) (time_end.tv_nsec - time_start.tv_nsec);
-  *time_avg = *time_elapsed / input->benchmark_runs;
+  benchmark_affinity(multithreaded);
+  double flops = 0.0;
+  for (uint32_t i = 0; i < input->benchmark_warmup; ++i)
+    bc_peak_run(kernel, multithreaded);
+
+  for (uint32_t i = 0; i < input->benchmark_runs; ++i)
+  {
+    const double start = benchmark_now();
+    flops = bc_peak_run(kernel, multithreaded);
+    samples[i] = benchmark_now() - start;
+  }
+
+  benchmark_stats(samples, input->benchmark_runs, &result->stats);
+  *result = (struct bench_result)
+  {
+    .name = name[kernel][multithreaded],
+    .cache = "-",
+    .flops = flops,
+    .stats = result->stats
+  };
 }
 
-void benchmark_implementation(const BCInput *input, const size_t width, const size_t height,
-                              const uint8_t *source_image, uint8_t *result_image, const char* prog_name)
+// STREAM kernels on a buffer of the given working set, single-threaded and on all cores.
+// results has to hold BCStreamMax * 2 entries, returns -1 if the buffer can't be allocated
+static int benchmark_stream_calibrate(const BCInput *input, size_t pixels, double *samples, struct bench_result *results,
+                                      struct roofline *roofline)
 {
-  double time_elapsed, time_avg;
+  const size_t size = (pixels * BYTES_PER_PIXEL + 127) & ~(size_t) 127;
+  uint8_t *buffer = aligned_alloc(CACHE_LINE_SIZE, size);
+  if (!buffer)
+    return -1;
+
+  memset(buffer, 1, size);
+
+  for (int kernel = 0; kernel < BCStreamMax; ++kernel)
+  {
+    for (int multithreaded = 0; multithreaded < 2; ++multithreaded)
+    {
+      struct bench_result *result = &results[kernel * 2 + multithreaded];
+      result->pixels = pixels;
+      result->working_set = size;
+      result->cache = benchmark_cache_level(pixels);
+
+      benchmark_stream_internal(input, (BCStreamKernel) kernel, multithreaded, buffer, samples, result);
+
+      if (kernel == BCStreamCopy)
+        roofline->copy_gbps[multithreaded] = gbytes_per_second(result);
+    }
+  }
+
+  free(buffer);
+  return 0;
+}
+
+// peak float throughput, independent of the working set. results has to hold BCPeakMax * 2 entries
+static void benchmark_peak_calibrate(const BCInput *input, double *samples, struct bench_result *results,
+                                     struct roofline *roofline)
+{
+  for (int kernel = 0; kernel < BCPeakMax; ++kernel)
+  {
+    for (int multithreaded = 0; multithreaded < 2; ++multithreaded)
+    {
+      struct bench_result *result = &results[kernel * 2 + multithreaded];
+      benchmark_peak_internal(input, (BCPeakKernel) kernel, multithreaded, samples, result);
+
+      if (kernel == BCPeakSIMD)
+        roofline->peak_gflops[multithreaded] = gflops_per_second(result);
+    }
+  }
+}
+
+// min(bandwidth, peak / arithmetic intensity) with the limits of the threads the implementation uses
+static double roofline_bound_gbps(const struct roofline *roofline, BCImplVersion impl)
+{
+  const int multithreaded = bc_implementation[impl].multithreaded;
+  const double intensity = (double) BC_FLOPS_PER_PIXEL / BYTES_PER_PIXEL;
+  const double compute_gbps = roofline->peak_gflops[multithreaded] / intensity;
+
+  return roofline->copy_gbps[multithreaded] < compute_gbps ? roofline->copy_gbps[multithreaded] : compute_gbps;
+}
+
+// per run counts for CSV/JSON, "missing" if the counter wasn't collected
+struct perf_fields
+{
+  char value[BCPerfMax + 1][32]; // the counters and the IPC
+};
+
+static void format_perf_fields(const BCPerfValues *perf, const char* missing, struct perf_fields *fields)
+{
+  for (int i = 0; i < BCPerfMax; ++i)
+  {
+    if (perf->valid[i])
+      snprintf(fields->value[i], sizeof(fields->value[i]), "%.0f", perf->value[i]);
+    else
+      snprintf(fields->value[i], sizeof(fields->value[i]), "%s", missing);
+  }
+
+  if (perf->valid[BCPerfCycles] && perf->valid[BCPerfInstructions] && perf->value[BCPerfCycles] > 0.0)
+    snprintf(fields->value[BCPerfMax], sizeof(fields->value[BCPerfMax]), "%.3f",
+             perf->value[BCPerfInstructions] / perf->value[BCPerfCycles]);
+  else
+    snprintf(fields->value[BCPerfMax], sizeof(fields->value[BCPerfMax]), "%s", missing);
+}
+
+// throughput, roofline and page fault columns, "missing" where they don't apply (e.g. MP/s of the STREAM kernels)
+enum { RateMPps, RateGBps, RateGFlops, RateBoundGBps, RatePctOfBound, RatePageFaults, RateWarmupPageFaults, RateMax };
+
+struct rate_fields
+{
+  char value[RateMax][32];
+};
+
+static void format_rate_field(double value, bool valid, const char* missing, char field[32])
+{
+  if (valid)
+    snprintf(field, 32, "%.3f", value);
+  else
+    snprintf(field, 32, "%s", missing);
+}
+
+static void format_rate_fields(const struct bench_result *result, const char* missing, struct rate_fields *fields)
+{
+  const double gbps = gbytes_per_second(result);
+
+  format_rate_field(mpixels_per_second(result), result->image, missing, fields->value[RateMPps]);
+  format_rate_field(gbps, result->bytes > 0.0, missing, fields->value[RateGBps]);
+  format_rate_field(gflops_per_second(result), result->flops > 0.0, missing, fields->value[RateGFlops]);
+  format_rate_field(result->bound_gbps, result->bound_gbps > 0.0, missing, fields->value[RateBoundGBps]);
+  format_rate_field(result->bound_gbps > 0.0 ? 100.0 * gbps / result->bound_gbps : 0.0, result->bound_gbps > 0.0,
+                    missing, fields->value[RatePctOfBound]);
+  format_rate_field(result->page_faults, result->image, missing, fields->value[RatePageFaults]);
+
+  if (result->image)
+    snprintf(fields->value[RateWarmupPageFaults], 32, "%lu", result->warmup_page_faults);
+  else
+    snprintf(fields->value[RateWarmupPageFaults], 32, "%s", missing);
+}
+
+static void print_buffer_stats()
+{
+  BCBufferStats stats;
+  bc_buffer_stats(&stats);
+  printf("Buffer allocations  : %lu (%lu from the pool, %lu from the system, %lu of them with huge pages requested)\n",
+         stats.allocations, stats.reused, stats.system, stats.huge_requested);
+}
+
+static void print_perf_value(const char* label, const BCPerfValues *perf, BCPerfCounter counter, size_t pixels)
+{
+  if (perf->valid[counter])
+    printf("%-20s: %.0f (%.3f per pixel)\n", label, perf->value[counter], perf->value[counter] / (double) pixels);
+  else
+    printf("%-20s: n/a\n", label);
+}
+
+int benchmark_implementation(const BCInput *input, const size_t width, const size_t height,
+                             const uint8_t *source_image, uint8_t *result_image, const char* prog_name)
+{
+  struct bench_result result;
+  benchmark_image_result(input->impl, width * height, &result);
+
+  BCPerfCounters perf;
+  double *samples = malloc(input->benchmark_runs * sizeof(*samples));
+  if (!samples)
+  {
+    fprintf(stderr, "%s: Out of memory\n", prog_name);
+    return -1;
+  }
 
-  printf("%s: Benchmarking %s over %u runs...\n", prog_name, bc_implementation[input->impl].name, input->benchmark_runs);
+  benchmark_pin_cpu(input, prog_name);
+  const bool perf_open = benchmark_perf_open(input, &perf, prog_name) > 0;
 
-  benchmark_implementation_internal(input, width, height, source_image, result_image, &time_elapsed, &time_avg);
+  printf("%s: Benchmarking %s over %u runs (%u warmup runs, %s cache)...\n", prog_name, bc_implementation[input->impl].name,
+         input->benchmark_runs, input->benchmark_warmup, input->benchmark_cold ? "cold" : "warm");
+
+  benchmark_implementation_internal(input, width, height, source_image, result_image, samples,
+                                    perf_open ? &perf : NULL, &result);
+  if (perf_open)
+    bc_perf_close(&perf);
+
+  struct roofline roofline;
+  struct bench_result calibration[BCStreamMax * 2 + BCPeakMax * 2];
+  if (input->benchmark_roofline)
+  {
+    printf("%s: Calibrating bandwidth and peak float throughput...\n", prog_name);
+    if (benchmark_stream_calibrate(input, result.pixels, samples, calibration, &roofline))
+    {
+      fprintf(stderr, "%s: Out of memory\n", prog_name);
+      free(samples);
+      return -1;
+    }
+
+    benchmark_peak_calibrate(input, samples, &calibration[BCStreamMax * 2], &roofline);
+    result.bound_gbps = roofline_bound_gbps(&roofline, input->impl);
+  }
+
+  free(samples);
 
   printf("========== Benchmark Results ==========\n");
-  printf("Number of runs      : %d\n", input->benchmark_runs);
-  printf("Implementation used : %s\n", bc_implementation[input->impl].name);
+  printf("Number of runs      : %u (+ %u warmup)\n", input->benchmark_runs, input->benchmark_warmup);
+  printf("Implementation used : %s\n", result.name);
+  printf("SIMD variant        : %s\n", bc_cpu_level_name[bc_cpu_level()]);
+  if (benchmark_pinned)
+    printf("Pinned to CPU       : %d%s\n", input->benchmark_pin_cpu,
+           bc_implementation[input->impl].multithreaded ? " (single-threaded runs only, not this implementation)" : "");
   printf("Input size          : %lux%lu = %lu pixels\n", width, height, width * height);
-  printf("Total time elapsed  : %.6f seconds\n", time_elapsed);
-  printf("Average time per run: %.6f seconds\n", time_avg);
+  printf("Working set         : %.2f MiB (%s, %s cache)\n", (double) (width * height * BYTES_PER_PIXEL) / (1 << 20),
+         result.cache, input->benchmark_cold ? "cold" : "warm");
+  printf("Throughput (median) : %.2f MP/s, %.2f GB/s\n", mpixels_per_second(&result), gbytes_per_second(&result));
+  if (input->benchmark_roofline)
+  {
+    const int mt = bc_implementation[input->impl].multithreaded;
+    for (size_t i = 0; i < sizeof(calibration) / sizeof(*calibration); ++i)
+    {
+      if (calibration[i].bytes > 0.0)
+        printf("%-20s: %.2f GB/s\n", calibration[i].name, gbytes_per_second(&calibration[i]));
+      else
+        printf("%-20s: %.2f GFLOP/s\n", calibration[i].name, gflops_per_second(&calibration[i]));
+    }
+    printf("Roofline bound      : %.2f GB/s (%s copy %.2f GB/s, %s SIMD peak %.2f GFLOP/s at %d flop/%d byte)\n",
+           result.bound_gbps, mt ? "multithreaded" : "single-threaded", roofline.copy_gbps[mt],
+           mt ? "multithreaded" : "single-threaded", roofline.peak_gflops[mt], BC_FLOPS_PER_PIXEL, BYTES_PER_PIXEL);
+    printf("Achieved            : %.1f%% of the bound\n", 100.0 * gbytes_per_second(&result) / result.bound_gbps);
+  }
+  printf("Min time per run    : %.6f seconds\n", result.stats.min);
+  printf("Median time per run : %.6f seconds\n", result.stats.median);
+  printf("P90 time per run    : %.6f seconds\n", result.stats.p90);
+  printf("P99 time per run    : %.6f seconds\n", result.stats.p99);
+  printf("Standard deviation  : %.6f seconds\n", result.stats.stddev);
+  if (perf_open)
+  {
+    print_perf_value("Cycles per run", &result.perf, BCPerfCycles, result.pixels);
+    print_perf_value("Instructions per run", &result.perf, BCPerfInstructions, result.pixels);
+    struct perf_fields fields;
+    format_perf_fields(&result.perf, "n/a", &fields);
+    printf("IPC                 : %s\n", fields.value[BCPerfMax]);
+    print_perf_value("LLC misses per run", &result.perf, BCPerfLLCMisses, result.pixels);
+    print_perf_value("Branch misses/run", &result.perf, BCPerfBranchMisses, result.pixels);
+    print_perf_value("FP ops per run", &result.perf, BCPerfFPOps, result.pixels);
+  }
+  printf("Page faults         : %lu in the warmup runs, %.1f per timed run\n", result.warmup_page_faults,
+         result.page_faults);
+  print_buffer_stats();
+  printf("Total time elapsed  : %.6f seconds\n", result.stats.total);
+  printf("Average time per run: %.6f seconds\n", result.stats.mean);
+
+  if (input->trace)
+    bc_trace_print_summary(input->benchmark_runs);
+
+  if (input->trace_file)
+  {
+    if (bc_trace_write_chrome(input->trace_file, prog_name))
+      return -1;
+
+    printf("%s: Trace stored in %s.\n", prog_name, input->trace_file);
+  }
+
+  if (input->benchmark_json)
+  {
+    if (benchmark_write_json(input, &result, 1, prog_name))
+      return -1;
+
+    printf("%s: Results stored in %s.\n", prog_name, benchmark_json_out_file);
+  }
+
+  return 0;
+}
+
+// nearest neighbour resampling, so every size of the sweep has its own buffer with the content of the whole image
+static void resample_image(const uint8_t *src, size_t src_width, size_t src_height,
+                           uint8_t *dst, size_t dst_width, size_t dst_height)
+{
+  for (size_t y = 0; y < dst_height; ++y)
+  {
+    const uint8_t *src_row = src + (y * src_height / dst_height) * src_width * 3;
+
+    for (size_t x = 0; x < dst_width; ++x)
+      memcpy(dst + (y * dst_width + x) * 3, src_row + (x * src_width / dst_width) * 3, 3);
+  }
+}
+
+// sizes of the sweep with the aspect ratio of the input, the last one is the input image itself.
+// returns the number of sizes stored in widths/heights (at most max_sizes)
+static size_t benchmark_sweep_sizes(size_t width, size_t height, size_t *widths, size_t *heights, size_t max_sizes)
+{
+  const size_t pixels = width * height;
+  size_t count = 0;
+
+  for (int step = 0; count + 1 < max_sizes; ++step)
+  {
+    const double step_pixels = (double) SWEEP_MIN_WORKING_SET / BYTES_PER_PIXEL *
+                               pow(2.0, (double) step / SWEEP_STEPS_PER_DOUBLING);
+    // less than half a step below the input image => the input image is the next size
+    if (step_pixels * pow(2.0, 0.5 / SWEEP_STEPS_PER_DOUBLING) >= (double) pixels)
+      break;
+
+    size_t w = (size_t) llround(sqrt(step_pixels * (double) width / (double) height));
+    w = w < 1 ? 1 : (w > width ? width : w);
+    size_t h = (size_t) llround(step_pixels / (double) w);
+    h = h < 1 ? 1 : (h > height ? height : h);
+
+    if (count > 0 && widths[count - 1] == w && heights[count - 1] == h)
+      continue;
+
+    widths[count] = w;
+    heights[count] = h;
+    ++count;
+  }
+
+  widths[count] = width;
+  heights[count] = height;
+  return count + 1;
 }
 
 int benchmark_implementations_write_csv(BCInput *input, const size_t width, const size_t height,
                                         const uint8_t *source_image, uint8_t *result_image, const char* prog_name)
 {
-  struct bench_result results[BCImplMax][IT_PER_IMPL];
+  enum { max_sizes = 128 };
+  size_t widths[max_sizes];
+  size_t heights[max_sizes];
+  const size_t size_count = benchmark_sweep_sizes(width, height, widths, heights, max_sizes);
 
-  printf("%s: Running benchmark of all implementations on %u different image sizes, %d runs each\n",
-          prog_name, benchmark_iterations_per_implementation, input->benchmark_runs);
-
-  const float start_width = (float) width / powf(2.0f, benchmark_iterations_per_implementation - 1);
-  const float start_height = (float) height / powf(2.0f, benchmark_iterations_per_implementation - 1);
+  // implementations with streaming stores get a second row group: regular stores in the first, streaming stores in
+  // the second at every size (instead of switching at the threshold), so the sizes where they pay off can be read off
+  int impl_count = 0;
   for (int impl = 0; impl < BCImplMax; ++impl)
+    impl_count += bc_implementation_supported(impl) * (bc_implementation[impl].streaming_name ? 2 : 1);
+
+  const size_t streaming_threshold = bc_streaming_threshold();
+
+  // with --roofline the calibration kernels follow the implementations
+  enum { stream_rows = BCStreamMax * 2, peak_rows = BCPeakMax * 2 };
+  const size_t row_groups = (size_t) impl_count + (input->benchmark_roofline ? stream_rows + peak_rows : 0);
+  struct bench_result peak[peak_rows];
+  struct roofline roofline = { 0 };
+
+  int ret = 0;
+  BCPerfCounters perf;
+  bool perf_open = false;
+  uint8_t *sized_source = NULL;
+  uint8_t *sized_result = NULL;
+  double *samples = malloc(input->benchmark_runs * sizeof(*samples));
+  // ordered by implementation (or calibration kernel), then size
+  struct bench_result *results = malloc(row_groups * size_count * sizeof(*results));
+  if (!samples || !results)
+  {
+    fprintf(stderr, "%s: Out of memory\n", prog_name);
+    ret = -1;
+    goto END;
+  }
+
+  benchmark_pin_cpu(input, prog_name);
+  perf_open = benchmark_perf_open(input, &perf, prog_name) > 0;
+
+  printf("%s: Running benchmark of all implementations on %lu different image sizes, %d runs each "
+         "(+ %u warmup, %s cache, %s kernels)\n",
+          prog_name, size_count, input->benchmark_runs, input->benchmark_warmup,
+          input->benchmark_cold ? "cold" : "warm", bc_cpu_level_name[bc_cpu_level()]);
+
+  if (input->benchmark_roofline)
+  {
+    printf("Calibrating peak float throughput...\n");
+    benchmark_peak_calibrate(input, samples, peak, &roofline);
+  }
+
+  for (size_t i = 0; i < size_count; ++i)
   {
-    input->impl = impl;
-    printf("Benchmarking %s...\n", bc_implementation[impl].name);
+    const size_t pixels = widths[i] * heights[i];
+    const uint8_t *source = source_image;
+    uint8_t *result = result_image;
+
+    // the largest size is the input image itself, its result is written to the output file
+    if (i + 1 < size_count)
+    {
+      // the buffers of the previous size are in another size class, they go back to the system instead of the pool
+      // (every size starts with fresh buffers, WarmupPageFaults counts their first touch)
+      bc_buffer_free(sized_source);
+      bc_buffer_free(sized_result);
+      bc_buffer_pool_clear();
+      sized_source = bc_buffer_alloc(pixels * 3);
+      sized_result = bc_buffer_alloc(pixels);
+      if (!sized_source || !sized_result)
+      {
+        fprintf(stderr, "%s: Out of memory\n", prog_name);
+        ret = -1;
+        goto END;
+      }
+
+      resample_image(source_image, width, height, sized_source, widths[i], heights[i]);
+      source = sized_source;
+      result = sized_result;
+    }
+
+    printf("Benchmarking %lux%lu (%.1f KiB working set, %s)...\n", widths[i], heights[i],
+           (double) (pixels * BYTES_PER_PIXEL) / 1024.0, benchmark_cache_level(pixels));
+
+    if (input->benchmark_roofline)
+    {
+      struct bench_result stream[stream_rows];
+      if (benchmark_stream_calibrate(input, pixels, samples, stream, &roofline))
+      {
+        fprintf(stderr, "%s: Out of memory\n", prog_name);
+        ret = -1;
+        goto END;
+      }
+
+      for (size_t row = 0; row < stream_rows; ++row)
+        results[((size_t) impl_count + row) * size_count + i] = stream[row];
 
-    float curr_width = start_width;
-    float curr_height = start_height;
-    for (uint8_t i = 0; i < benchmark_iterations_per_implementation; ++i)
+      // the peak doesn't depend on the size, repeated for every size so it can be plotted as a line
+      for (size_t row = 0; row < peak_rows; ++row)
+      {
+        struct bench_result *res = &results[((size_t) impl_count + stream_rows + row) * size_count + i];
+        *res = peak[row];
+        res->pixels = pixels;
+      }
+    }
+
+    int slot = 0;
+    for (int streaming = 0; streaming < 2; ++streaming)
     {
-      benchmark_implementation_internal(input, (size_t) curr_width, (size_t) curr_height, source_image, result_image,
-        &results[impl][i].times[0], &results[impl][i].times[1]);
+      bc_set_streaming_threshold(streaming ? 0 : BC_STREAMING_NEVER);
 
-      results[impl][i].pixels = (size_t) curr_width * (size_t) curr_height;
+      for (int impl = 0; impl < BCImplMax; ++impl)
+      {
+        if (!bc_implementation_supported(impl) || (streaming && !bc_implementation[impl].streaming_name))
+          continue;
 
-      curr_width *= 2;
-      curr_height *= 2;
+        struct bench_result *res = &results[(size_t) slot++ * size_count + i];
+        input->impl = impl;
+        benchmark_image_result(impl, pixels, res);
+        if (streaming)
+          res->name = bc_implementation[impl].streaming_name;
+
+        benchmark_implementation_internal(input, widths[i], heights[i], source, result, samples,
+                                          perf_open ? &perf : NULL, res);
+
+        if (input->benchmark_roofline)
+          res->bound_gbps = roofline_bound_gbps(&roofline, impl);
+      }
     }
+
+    bc_set_streaming_threshold(streaming_threshold);
   }
 
-  if (benchmark_write_csv(results, prog_name))
-    return -1;
+  if (benchmark_write_csv(results, row_groups * size_count, prog_name) ||
+      (input->benchmark_json && benchmark_write_json(input, results, row_groups * size_count, prog_name)))
+  {
+    ret = -1;
+    goto END;
+  }
 
-  printf("Successfully benchmarked %d runs of all implementations. Results stored in %s.\n",
-          input->benchmark_runs, benchmark_csv_out_file);
-  return 0;
+  printf("Successfully benchmarked %d runs of all implementations. Results stored in %s%s%s.\n",
+          input->benchmark_runs, benchmark_csv_out_file, input->benchmark_json ? " and " : "",
+          input->benchmark_json ? benchmark_json_out_file : "");
+  print_buffer_stats();
+
+END:
+  if (perf_open)
+    bc_perf_close(&perf);
+  bc_buffer_free(sized_source);
+  bc_buffer_free(sized_result);
+  free(samples);
+  free(results);
+  return ret;
 }
 
-static int benchmark_write_csv(struct bench_result results[BCImplMax][IT_PER_IMPL], const char* prog_name)
+static int benchmark_write_csv(const struct bench_result *results, size_t result_count, const char* prog_name)
 {
   int ret = 0;
   FILE* csv = fopen(benchmark_csv_out_file, "w+");
@@ -110,19 +837,33 @@ static int benchmark_write_csv(struct bench_result results[BCImplMax][IT_PER_IMP
     return -1;
   }
 
-  fprintf(csv, "Implementation,Pixels,Total,Average\n");
+  // Total and Average first, so readers of the old format keep working. MP/s and GB/s are based on the median,
+  // the counters are per run (empty if not collected). The roofline columns are empty without --roofline,
+  // the page faults only apply to the implementations
+  fprintf(csv, "Implementation,Pixels,Total,Average,Min,Median,P90,P99,Stddev,WorkingSet,Cache,MPps,GBps,"
+               "Cycles,Instructions,IPC,LLCMisses,BranchMisses,FPOps,GFlops,BoundGBps,PctOfBound,"
+               "PageFaults,WarmupPageFaults\n");
 
-  for (int impl = 0; impl < BCImplMax; ++impl)
+  for (size_t i = 0; i < result_count; ++i)
   {
-    for (uint8_t it = 0; it < benchmark_iterations_per_implementation; ++it)
+    const struct bench_stats *stats = &results[i].stats;
+    struct perf_fields perf;
+    struct rate_fields rate;
+    format_perf_fields(&results[i].perf, "", &perf);
+    format_rate_fields(&results[i], "", &rate);
+
+    if (fprintf(csv, "%s,%lu,%.9f,%.9f,%.9f,%.9f,%.9f,%.9f,%.9f,%lu,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s\n",
+         results[i].name, results[i].pixels, stats->total, stats->mean,
+         stats->min, stats->median, stats->p90, stats->p99, stats->stddev,
+         results[i].working_set, results[i].cache, rate.value[RateMPps], rate.value[RateGBps],
+         perf.value[BCPerfCycles], perf.value[BCPerfInstructions], perf.value[BCPerfMax],
+         perf.value[BCPerfLLCMisses], perf.value[BCPerfBranchMisses], perf.value[BCPerfFPOps],
+         rate.value[RateGFlops], rate.value[RateBoundGBps], rate.value[RatePctOfBound],
+         rate.value[RatePageFaults], rate.value[RateWarmupPageFaults]) < 0)
     {
-      if (fprintf(csv, "%s,%lu,%f,%f\n",
-           bc_implementation[impl].name, results[impl][it].pixels, results[impl][it].times[0], results[impl][it].times[1]) < 0)
-      {
-        fprintf(stderr, "%s: Error writing CSV\n", prog_name);
-        ret = -1;
-        goto END;
-      }
+      fprintf(stderr, "%s: Error writing CSV\n", prog_name);
+      ret = -1;
+      goto END;
     }
   }
 
@@ -131,31 +872,244 @@ END:
   return ret;
 }
 
-void benchmark_sqrt(const char* prog_name, const size_t runs)
+static int benchmark_write_json(const BCInput *input, const struct bench_result *results, size_t result_count,
+                                const char* prog_name)
 {
-  printf("%s: Benchmarking sqrt implementations over %lu runs...\n", prog_name, runs);
+  FILE* json = fopen(benchmark_json_out_file, "w+");
+  if (!json)
+  {
+    fprintf(stderr, "%s: Couldn't open %s\n", prog_name, benchmark_json_out_file);
+    return -1;
+  }
+
+  fprintf(json, "{\n");
+  fprintf(json, "  \"simd_variant\": \"%s\",\n", bc_cpu_level_name[bc_cpu_level()]);
+  fprintf(json, "  \"runs\": %u,\n", input->benchmark_runs);
+  fprintf(json, "  \"warmup\": %u,\n", input->benchmark_warmup);
+  fprintf(json, "  \"cache_mode\": \"%s\",\n", input->benchmark_cold ? "cold" : "warm");
+  if (benchmark_pinned)
+    fprintf(json, "  \"pinned_cpu\": %d,\n", input->benchmark_pin_cpu);
+  else
+    fprintf(json, "  \"pinned_cpu\": null,\n");
+  BCBufferStats buffers;
+  bc_buffer_stats(&buffers);
+  fprintf(json, "  \"buffers\": {\"allocations\": %lu, \"reused\": %lu, \"system\": %lu, \"huge_requested\": %lu},\n",
+          buffers.allocations, buffers.reused, buffers.system, buffers.huge_requested);
+  fprintf(json, "  \"unit\": \"s\",\n");
+  fprintf(json, "  \"results\": [\n");
 
-  benchmark_sqrt_internal("sqrt_heron", runs, &sqrt_heron);
-  benchmark_sqrt_internal("sqrt_ieee", runs, &sqrt_ieee);
-  benchmark_sqrt_internal("sqrtf", runs, &sqrtf);
+  for (size_t i = 0; i < result_count; ++i)
+  {
+    const struct bench_stats *stats = &results[i].stats;
+    struct perf_fields perf;
+    struct rate_fields rate;
+    format_perf_fields(&results[i].perf, "null", &perf);
+    format_rate_fields(&results[i], "null", &rate);
+
+    fprintf(json, "    {\"implementation\": \"%s\", \"pixels\": %lu, \"working_set\": %lu, \"cache\": \"%s\", "
+                  "\"total\": %.9f, \"mean\": %.9f, \"min\": %.9f, \"median\": %.9f, \"p90\": %.9f, \"p99\": %.9f, "
+                  "\"stddev\": %.9f, \"mpixels_per_s\": %s, \"gbytes_per_s\": %s, "
+                  "\"cycles\": %s, \"instructions\": %s, \"ipc\": %s, \"llc_misses\": %s, \"branch_misses\": %s, "
+                  "\"fp_ops\": %s, \"gflops_per_s\": %s, \"bound_gbytes_per_s\": %s, \"pct_of_bound\": %s, "
+                  "\"page_faults\": %s, \"warmup_page_faults\": %s}%s\n",
+            results[i].name, results[i].pixels, results[i].working_set, results[i].cache,
+            stats->total, stats->mean, stats->min, stats->median, stats->p90, stats->p99, stats->stddev,
+            rate.value[RateMPps], rate.value[RateGBps],
+            perf.value[BCPerfCycles], perf.value[BCPerfInstructions], perf.value[BCPerfMax],
+            perf.value[BCPerfLLCMisses], perf.value[BCPerfBranchMisses], perf.value[BCPerfFPOps],
+            rate.value[RateGFlops], rate.value[RateBoundGBps], rate.value[RatePctOfBound],
+            rate.value[RatePageFaults], rate.value[RateWarmupPageFaults],
+            i + 1 < result_count ? "," : "");
+  }
+
+  fprintf(json, "  ]\n}\n");
+
+  if (ferror(json))
+  {
+    fprintf(stderr, "%s: Error writing JSON\n", prog_name);
+    fclose(json);
+    return -1;
+  }
+
+  fclose(json);
+  return 0;
 }
 
-static void benchmark_sqrt_internal(const char* name, const size_t runs, float (*sqrt_func)(float))
+// runs the scalar functions over the array, so they can be compared with the array variants
+#define SQRT_SCALAR_ARRAY(func) \
+  static void func##_loop(const float *src, float *dst, size_t count) \
+  { \
+    for (size_t i = 0; i < count; ++i) \
+      dst[i] = func(src[i]); \
+  }
+
+SQRT_SCALAR_ARRAY(sqrt_heron)
+SQRT_SCALAR_ARRAY(sqrt_ieee)
+SQRT_SCALAR_ARRAY(sqrtf)
+
+struct sqrt_bench
 {
-  struct timespec time_start;
-  struct timespec time_end;
-  const float num = 1337.420f;
+  const char* name;
+  void (*array_func)(const float *src, float *dst, size_t count);
+  float (*scalar_func)(float); // latency of a single call, NULL .. measured via array_func on SQRT_LATENCY_FLOATS
+};
 
-  clock_gettime(CLOCK_MONOTONIC, &time_start);
+static const struct sqrt_bench sqrt_benches[] =
+{
+  { "sqrt_heron",           &sqrt_heron_loop,      &sqrt_heron },
+  { "sqrt_ieee",            &sqrt_ieee_loop,       &sqrt_ieee  },
+  { "sqrtf",                &sqrtf_loop,           &sqrtf      },
+  { "sqrt_heron_array",     &sqrt_heron_array,     NULL        },
+  { "sqrt_heron_array_asm", &sqrt_heron_array_asm, NULL        },
+  { "sqrt_ieee_array",      &sqrt_ieee_array,      NULL        },
+  { "sqrt_ieee_array_asm",  &sqrt_ieee_array_asm,  NULL        },
+  { "sqrt_rsqrt_array",     &sqrt_rsqrt_array,     NULL        },
+  { "sqrt_rsqrt_array_asm", &sqrt_rsqrt_array_asm, NULL        },
+};
+
+#define SQRT_BENCH_COUNT (sizeof(sqrt_benches) / sizeof(*sqrt_benches))
+
+// throughput: src and dst (2 * 16 KiB) stay in the L1 cache
+#define SQRT_ARRAY_SIZE 4096
+// the inputs are in (0, SQRT_MAX_INPUT], the variance of 8 bit values (what gets passed to sqrt) is <= 127.5^2
+#define SQRT_MAX_INPUT 16384.0
+// latency: every call depends on the result of the previous one, the array variants run in place on one
+// AVX-512 vector of floats
+#define SQRT_LATENCY_CALLS (1 << 20)
+#define SQRT_LATENCY_FLOATS 16
+
+struct sqrt_result
+{
+  struct bench_stats stats; // per pass over SQRT_ARRAY_SIZE floats
+  double latency;           // seconds per dependent call
+  double max_rel_error;
+};
+
+static void benchmark_sqrt_internal(const struct sqrt_bench *bench, const size_t runs, const float *src, float *dst,
+                                    double *samples, struct sqrt_result *result)
+{
+  // untimed pass, also gives the results for the error
+  bench->array_func(src, dst, SQRT_ARRAY_SIZE);
+
+  result->max_rel_error = 0.0;
+  for (size_t i = 0; i < SQRT_ARRAY_SIZE; ++i)
+  {
+    const double expected = sqrt((double) src[i]);
+    const double error = fabs((double) dst[i] - expected) / expected;
+    if (error > result->max_rel_error)
+      result->max_rel_error = error;
+  }
 
   for (size_t i = 0; i < runs; ++i)
-    sqrt_func(num);
+  {
+    const double start = benchmark_now();
+    bench->array_func(src, dst, SQRT_ARRAY_SIZE);
+    samples[i] = benchmark_now() - start;
+  }
+
+  benchmark_stats(samples, runs, &result->stats);
+
+  // the chain converges to sqrt(1) = 1, which doesn't change the instructions executed
+  double start;
+  if (bench->scalar_func)
+  {
+    volatile float sink;
+    float value = src[0];
 
-  clock_gettime(CLOCK_MONOTONIC, &time_end);
+    start = benchmark_now();
+    for (size_t i = 0; i < SQRT_LATENCY_CALLS; ++i)
+      value = bench->scalar_func(value);
 
-  const double time_elapsed = (double) (time_end.tv_sec - time_start.tv_sec) +
-                              1e-9 * (double) (time_end.tv_nsec - time_start.tv_nsec);
-  const double time_avg = time_elapsed / (double) runs;
+    sink = value;
+    (void) sink;
+  }
+  else
+  {
+    float chain[SQRT_LATENCY_FLOATS];
+    memcpy(chain, src, sizeof(chain));
+
+    start = benchmark_now();
+    for (size_t i = 0; i < SQRT_LATENCY_CALLS; ++i)
+      bench->array_func(chain, chain, SQRT_LATENCY_FLOATS);
+  }
+
+  result->latency = (benchmark_now() - start) / SQRT_LATENCY_CALLS;
+}
+
+static int benchmark_sqrt_write_csv(const struct sqrt_result *results, const size_t runs, const char* prog_name)
+{
+  FILE* csv = fopen(benchmark_csv_out_file, "w+");
+  if (!csv)
+  {
+    fprintf(stderr, "%s: Couldn't open %s\n", prog_name, benchmark_csv_out_file);
+    return -1;
+  }
+
+  // Median in seconds per pass over Elements floats, LatencyNs per dependent call
+  fprintf(csv, "Implementation,Elements,Runs,Median,NsPerElement,GElemps,LatencyNs,LatencyElements,MaxRelError\n");
+
+  for (size_t i = 0; i < SQRT_BENCH_COUNT; ++i)
+  {
+    const double median = results[i].stats.median;
+    fprintf(csv, "%s,%d,%lu,%.9f,%.4f,%.4f,%.3f,%d,%.9g\n", sqrt_benches[i].name, SQRT_ARRAY_SIZE, runs, median,
+            1e9 * median / SQRT_ARRAY_SIZE, median > 0.0 ? 1e-9 * SQRT_ARRAY_SIZE / median : 0.0,
+            1e9 * results[i].latency, sqrt_benches[i].scalar_func ? 1 : SQRT_LATENCY_FLOATS,
+            results[i].max_rel_error);
+  }
+
+  if (ferror(csv))
+  {
+    fprintf(stderr, "%s: Error writing CSV\n", prog_name);
+    fclose(csv);
+    return -1;
+  }
+
+  fclose(csv);
+  return 0;
+}
+
+int benchmark_sqrt(const char* prog_name, const size_t runs)
+{
+  int ret = 0;
+  struct sqrt_result results[SQRT_BENCH_COUNT];
+  float *src = malloc(SQRT_ARRAY_SIZE * sizeof(*src));
+  float *dst = malloc(SQRT_ARRAY_SIZE * sizeof(*dst));
+  double *samples = malloc(runs * sizeof(*samples));
+
+  if (!src || !dst || !samples)
+  {
+    fprintf(stderr, "%s: Out of memory\n", prog_name);
+    ret = -1;
+    goto END;
+  }
 
-  printf("%s: total=%f, avg=%f\n", name, time_elapsed, time_avg);
+  // fixed seed => every run gets the same inputs
+  srand(42);
+  for (size_t i = 0; i < SQRT_ARRAY_SIZE; ++i)
+    src[i] = (float) (SQRT_MAX_INPUT * ((double) rand() + 1.0) / ((double) RAND_MAX + 1.0));
+
+  printf("%s: Benchmarking sqrt implementations on %d random floats in (0, %.0f] over %lu runs (%s)...\n", prog_name,
+         SQRT_ARRAY_SIZE, SQRT_MAX_INPUT, runs, bc_cpu_level_name[bc_cpu_level()]);
+  printf("%-22s %12s %10s %14s %14s\n", "", "ns/element", "GElem/s", "latency (ns)", "max rel. error");
+
+  for (size_t i = 0; i < SQRT_BENCH_COUNT; ++i)
+  {
+    benchmark_sqrt_internal(&sqrt_benches[i], runs, src, dst, samples, &results[i]);
+
+    const double median = results[i].stats.median;
+    printf("%-22s %12.4f %10.4f %14.3f %14.3g\n", sqrt_benches[i].name, 1e9 * median / SQRT_ARRAY_SIZE,
+           median > 0.0 ? 1e-9 * SQRT_ARRAY_SIZE / median : 0.0, 1e9 * results[i].latency,
+           results[i].max_rel_error);
+  }
+
+  printf("Throughput from the median pass, latency per dependent call (the array variants on %d floats).\n",
+         SQRT_LATENCY_FLOATS);
+
+  ret = benchmark_sqrt_write_csv(results, runs, prog_name);
+
+END:
+  free(src);
+  free(dst);
+  free(samples);
+  return ret;
 }
@@ -4,24 +4,39 @@
 #include <stdio.h>
 #include <assert.h>
 #include <math.h>
+#include <stdatomic.h>
+#include <unistd.h>
 #include <emmintrin.h> //SSE2
 #include <smmintrin.h> //SSE4.1
 #include <omp.h>
 
+#include "bc_stages.h"
+#include "bc_trace.h"
+#include "thread_pool.h"
+#include "cpu_features.h"
 #include "math_utils.h"
 
 const uint16_t bc_default_benchmark_runs = 5000;
+const uint16_t bc_default_benchmark_warmup = 50;
 const uint8_t bc_default_test_delta = 1;
 
 const BCImplementation bc_implementation[] =
 {
-  { &brightness_contrast,    "Assembly SIMD"          }, // BCImplAsmSIMD
-  { &brightness_contrast_V1, "C SIMD"                 }, // BCImplCSIMD
-  { &brightness_contrast_V2, "Assembly SISD"          }, // BCImplAsmSISD
-  { &brightness_contrast_V3, "C SISD"                 }, // BCImplCSISD
-  { &brightness_contrast_V4, "C SISD Multithreaded"   }, // BCImplCSISD_MT
-  { &brightness_contrast_V5, "C SISD with sqrt_heron" }, // BCImplCSISD_Heron
-  { &brightness_contrast_V6, "C SISD with sqrt_ieee"  }, // BCImplCSISD_IEEE
+  { &brightness_contrast,     "Assembly SIMD",                  BCCpuSSE41,  false, "Assembly SIMD NT" }, // BCImplAsmSIMD
+  { &brightness_contrast_V1,  "C SIMD",                         BCCpuSSE41,  false, "C SIMD NT"        }, // BCImplCSIMD
+  { &brightness_contrast_V2,  "Assembly SISD",                  BCCpuSSE41,  false, NULL               }, // BCImplAsmSISD
+  { &brightness_contrast_V3,  "C SISD",                         BCCpuSSE41,  false, NULL               }, // BCImplCSISD
+  { &brightness_contrast_V4,  "C SISD Multithreaded",           BCCpuSSE41,  true,  NULL               }, // BCImplCSISD_MT
+  { &brightness_contrast_V5,  "C SISD with sqrt_heron",         BCCpuSSE41,  false, NULL               }, // BCImplCSISD_Heron
+  { &brightness_contrast_V6,  "C SISD with sqrt_ieee",          BCCpuSSE41,  false, NULL               }, // BCImplCSISD_IEEE
+  { &brightness_contrast_V7,  "C SIMD AVX2",                    BCCpuAVX2,   false, NULL               }, // BCImplCSIMD_AVX2
+  { &brightness_contrast_V8,  "C SIMD AVX-512",                 BCCpuAVX512, false, NULL               }, // BCImplCSIMD_AVX512
+  { &brightness_contrast_V9,  "C SIMD Histogram",               BCCpuSSE41,  false, NULL               }, // BCImplCSIMD_Hist
+  { &brightness_contrast_V10, "C SIMD Histogram Multithreaded", BCCpuSSE41,  true,  NULL               }, // BCImplCSIMD_Hist_MT
+  { &brightness_contrast_V11, "C SIMD LUT",                     BCCpuSSE41,  false, NULL               }, // BCImplCSIMD_LUT
+  { &brightness_contrast_V12, "C SIMD Multithreaded",           BCCpuSSE41,  true,  NULL               }, // BCImplCSIMD_MT
+  { &brightness_contrast_V13, "C SIMD Fixed Point",             BCCpuSSE41,  false, NULL               }, // BCImplCSIMD_Fixed
+  { &brightness_contrast_V14, "C SIMD Tiled",                   BCCpuSSE41,  false, NULL               }, // BCImplCSIMD_Tiled
 };
 
 static_assert((sizeof(bc_implementation) / sizeof(*bc_implementation)) == BCImplMax, "Implementation declared in enum is missing in "
@@ -31,13 +46,80 @@ static const float default_a = 0.2126f;
 static const float default_b = 0.7152f;
 static const float default_c = 0.0722f;
 
+// asm variants, see brightness_contrast_V0.S
+void brightness_contrast_sse41(const uint8_t *img, size_t width, size_t height, float a, float b, float c,
+                               int16_t brightness, float contrast, uint8_t *result);
+void brightness_contrast_avx(const uint8_t *img, size_t width, size_t height, float a, float b, float c,
+                             int16_t brightness, float contrast, uint8_t *result);
+void brightness_contrast_sse41_nt(const uint8_t *img, size_t width, size_t height, float a, float b, float c,
+                                  int16_t brightness, float contrast, uint8_t *result);
+void brightness_contrast_avx_nt(const uint8_t *img, size_t width, size_t height, float a, float b, float c,
+                                int16_t brightness, float contrast, uint8_t *result);
+
+BCImplVersion bc_auto_implementation()
+{
+  switch (bc_cpu_level())
+  {
+    case BCCpuAVX512:
+      return BCImplCSIMD_AVX512;
+    case BCCpuAVX2:
+      return BCImplCSIMD_AVX2;
+    default:
+      return BCImplAsmSIMD;
+  }
+}
+
+bool bc_implementation_supported(BCImplVersion impl)
+{
+  return bc_implementation[impl].level <= bc_cpu_level();
+}
+
+// off unless set (--nt-threshold): on the test machine the streaming variants were not faster even on images far
+// beyond the LLC. --csv shows both variants at every size
+static atomic_size_t streaming_threshold = BC_STREAMING_NEVER;
+
+size_t bc_streaming_threshold()
+{
+  return atomic_load_explicit(&streaming_threshold, memory_order_relaxed);
+}
+
+void bc_set_streaming_threshold(size_t pixels)
+{
+  atomic_store_explicit(&streaming_threshold, pixels < BC_STREAMING_NEVER ? pixels : BC_STREAMING_NEVER,
+                        memory_order_relaxed);
+}
+
 void bc_init_input(BCInput* input)
 {
-  input->impl = 0;
+  input->impl = bc_auto_implementation();
+  input->impl_auto = true;
+  input->streaming_threshold = SIZE_MAX;
+  input->cpu_level = bc_cpu_detect();
   input->benchmark_runs = 0;
+  input->benchmark_warmup = bc_default_benchmark_warmup;
+  input->benchmark_pin_cpu = -1;
   input->benchmark_csv = false;
+  input->benchmark_json = false;
+  input->benchmark_cold = false;
+  input->benchmark_perf = false;
+  input->benchmark_roofline = false;
+  input->trace = false;
+  input->trace_file = NULL;
   input->input_file = NULL;
   input->output_file = NULL;
+  input->use_mmap = false;
+  input->stream_band_rows = 0;
+  input->fused_read = false;
+  input->video = false;
+  input->video_alpha = 0.0f;
+  input->sweep_brightness = NULL;
+  input->sweep_contrast = NULL;
+  input->sweep_count = 0;
+  input->batch = false;
+  input->batch_files = NULL;
+  input->batch_file_count = 0;
+  input->batch_manifest = NULL;
+  input->batch_threads[0] = input->batch_threads[1] = input->batch_threads[2] = 0;
   input->coeffs[0] = default_a;
   input->coeffs[1] = default_b;
   input->coeffs[2] = default_c;
@@ -58,6 +140,10 @@ void bc_destroy_input(BCInput* input)
 {
   free(input->input_file);
   free(input->output_file);
+  free(input->batch_manifest);
+  free(input->sweep_brightness);
+  free(input->sweep_contrast);
+  free(input->trace_file);
 }
 
 static inline float clamp_float(float min, float max, float val)
@@ -102,8 +188,11 @@ static void brightness_contrast_c_sisd(const uint8_t *img, size_t width, size_t
   coeff_b /= coeff_sum;
   coeff_c /= coeff_sum;
 
-  float avg = 0.0f;
+  // exact integer sums of the rounded values, a float accumulator stops changing after ~16M pixels
+  uint64_t sum = 0;
+  uint64_t sum_squares = 0;
 
+  uint64_t trace = bc_trace_begin();
   size_t out_idx;
   for (out_idx = 0; out_idx < pixel_count; ++out_idx)
   {
@@ -116,31 +205,68 @@ static void brightness_contrast_c_sisd(const uint8_t *img, size_t width, size_t
       (coeff_a * r + coeff_b * g + coeff_c * b) + (float) brightness);
 
     result[out_idx] = (uint8_t) rintf(res_val);
-    avg += res_val;
+    sum += result[out_idx];
+    sum_squares += (uint32_t) result[out_idx] * result[out_idx];
   }
+  bc_trace_end(BCTraceGrayscale, trace);
 
-  avg /= (float) pixel_count;
+  trace = bc_trace_begin();
+  float avg, sigma;
+  bc_stats_from_sums(sum, sum_squares, pixel_count, &avg, &sigma);
 
-  float sigma = 0.0f;
-  for (out_idx = 0; out_idx < pixel_count; ++out_idx)
-  {
-    float val = (float) result[out_idx] - avg;
-    sigma += val * val;
-  }
-
-  sigma /= (float) pixel_count;
   const float div = (sigma == 0.0f && contrast == sigma) ? 0.0f : contrast / sqrt_func(sigma);
   const float adjusted_avg = ((1.0f - div) * avg);
+  bc_trace_end(BCTraceStats, trace);
 
+  trace = bc_trace_begin();
   for (out_idx = 0; out_idx < pixel_count; ++out_idx)
     result[out_idx] = (uint8_t) rintf(clamp_float(0.0f, 255.0f,
       (div * (float) result[out_idx]) + adjusted_avg));
+  bc_trace_end(BCTraceContrast, trace);
 }
 
-void brightness_contrast_V1(const uint8_t *img, size_t width, size_t height,
-                               float a, float b, float c,
-                               int16_t brightness, float contrast,
-                               uint8_t *result)
+void brightness_contrast(const uint8_t *img, size_t width, size_t height,
+                         float a, float b, float c,
+                         int16_t brightness, float contrast,
+                         uint8_t *result)
+{
+  const bool streaming = width * height >= bc_streaming_threshold();
+
+  // the asm kernel only uses 128 bit registers, so AVX-512 CPUs use the VEX encoded variant as well
+  if (bc_cpu_level() >= BCCpuAVX2 && streaming)
+    brightness_contrast_avx_nt(img, width, height, a, b, c, brightness, contrast, result);
+  else if (bc_cpu_level() >= BCCpuAVX2)
+    brightness_contrast_avx(img, width, height, a, b, c, brightness, contrast, result);
+  else if (streaming)
+    brightness_contrast_sse41_nt(img, width, height, a, b, c, brightness, contrast, result);
+  else
+    brightness_contrast_sse41(img, width, height, a, b, c, brightness, contrast, result);
+}
+
+// bytes the prefetchnta of the rgb input runs ahead of the loads. Tuned on a 72 MP image (216 MB rgb, twice the LLC)
+// with 256 to 4096 bytes, 2048 was the fastest for both streaming implementations
+#define STREAMING_PREFETCH_DISTANCE 2048
+
+// the 32 bit lane sums of the C SIMD implementation are added to 64 bit lanes every V1_FLUSH_ITERATIONS iterations
+// (2^15 * 255^2 < 2^31), so they can't overflow on large images
+#define V1_FLUSH_ITERATIONS (1 << 15)
+
+static inline __attribute__((always_inline)) __m128i add_epu32_to_epi64(__m128i sum, __m128i val)
+{
+  sum = _mm_add_epi64(sum, _mm_cvtepu32_epi64(val));
+  return _mm_add_epi64(sum, _mm_cvtepu32_epi64(_mm_srli_si128(val, 8)));
+}
+
+// body of the C SIMD implementation, inlined into one function per target ISA below.
+// the intrinsics stay 128 bit wide, but the compiler can use VEX/EVEX encodings for the wider targets.
+// with streaming, the rgb input is prefetched with prefetchnta and the grayscale values are written with non-temporal
+// stores. The grayscale pass only writes result[], a regular store reads every line first (read for ownership), the
+// contrast pass reads result[] anyway => streaming stores there would only evict lines which were just loaded
+static inline __attribute__((always_inline))
+void brightness_contrast_c_simd(const uint8_t *img, size_t width, size_t height,
+                                float a, float b, float c,
+                                int16_t brightness, float contrast,
+                                uint8_t *result, bool streaming)
 {
 
   //calculate coeff_sum
@@ -164,7 +290,11 @@ void brightness_contrast_V1(const uint8_t *img, size_t width, size_t height,
   __m128i brightness_int32 = _mm_cvtepi16_epi32(brightness_int16);
   __m128 brightness_float = _mm_cvtepi32_ps(brightness_int32);
 
+  //sum and sum of squares in 32 bit lanes, added to the 64 bit lanes before they can overflow
   __m128i res_sum = _mm_setzero_si128();
+  __m128i square_sum = _mm_setzero_si128();
+  __m128i res_sum_64 = _mm_setzero_si128();
+  __m128i square_sum_64 = _mm_setzero_si128();
 
   const size_t pixel_count = width * height;
 
@@ -174,9 +304,18 @@ void brightness_contrast_V1(const uint8_t *img, size_t width, size_t height,
 
   //Color conversion loop
   //read 16, move pointer by 12
+  uint64_t trace = bc_trace_begin();
   size_t i = 0;
   for (i = 0; i*12 < pixel_count * 3 - 16; ++i)
   {
+    //every 16 iterations = 192 bytes = 3 cache lines
+    if (streaming && (i & 15) == 0)
+    {
+      _mm_prefetch((const char*) &img[i*12] + STREAMING_PREFETCH_DISTANCE, _MM_HINT_NTA);
+      _mm_prefetch((const char*) &img[i*12] + STREAMING_PREFETCH_DISTANCE + 64, _MM_HINT_NTA);
+      _mm_prefetch((const char*) &img[i*12] + STREAMING_PREFETCH_DISTANCE + 128, _MM_HINT_NTA);
+    }
+
     //load 16 bytes from img; we need 4 pixels -> 4*3 = 12 and 4 unused bytes -> 16
     __m128i raw_data = _mm_loadu_si128((__m128i*) &img[i*12]);
 
@@ -208,8 +347,19 @@ void brightness_contrast_V1(const uint8_t *img, size_t width, size_t height,
     //convert to 32-bit integers
     __m128i clamped_uint32 = _mm_cvtps_epi32(res);
 
-    //add to res_sum, which is used to calculate average
+    //add to res_sum and square_sum, which are used to calculate average and variance
+    //(the upper 16 bit of each dword are zero => pmaddwd squares the values)
     res_sum = _mm_add_epi32(res_sum, clamped_uint32);
+    square_sum = _mm_add_epi32(square_sum, _mm_madd_epi16(clamped_uint32, clamped_uint32));
+
+    //each dword of square_sum grows by at most 255^2 per iteration
+    if ((i & (V1_FLUSH_ITERATIONS - 1)) == V1_FLUSH_ITERATIONS - 1)
+    {
+      res_sum_64 = add_epu32_to_epi64(res_sum_64, res_sum);
+      square_sum_64 = add_epu32_to_epi64(square_sum_64, square_sum);
+      res_sum = _mm_setzero_si128();
+      square_sum = _mm_setzero_si128();
+    }
 
     //pack 32-bit integers into 16-bit integers
     __m128i clamped_uint16 = _mm_packus_epi32(clamped_uint32, clamped_uint32);
@@ -218,14 +368,23 @@ void brightness_contrast_V1(const uint8_t *img, size_t width, size_t height,
     __m128i clamped_uint8 = _mm_packus_epi16(clamped_uint16, clamped_uint16);
 
     //store the lower 4 bytes (4 pixels) into the result array
-    _mm_storeu_si32(&result[i * 4], clamped_uint8);
+    if (streaming)
+      _mm_stream_si32((int*) &result[i * 4], _mm_cvtsi128_si32(clamped_uint8)); //movnti, no read for ownership
+    else
+      _mm_storeu_si32(&result[i * 4], clamped_uint8);
   }
 
-  //horizontal add res_sum; res_sum until now: [sum, sum, sum, sum]
-  res_sum = _mm_hadd_epi32(res_sum, res_sum);
-  res_sum = _mm_hadd_epi32(res_sum, res_sum);
+  //the streaming stores are weakly ordered
+  if (streaming)
+    _mm_sfence();
+
+  //horizontal add the 64 bit sums
+  res_sum_64 = add_epu32_to_epi64(res_sum_64, res_sum);
+  square_sum_64 = add_epu32_to_epi64(square_sum_64, square_sum);
 
-  float total_sum = (float) _mm_cvtsi128_si32(res_sum);
+  uint64_t total_sum = (uint64_t) _mm_cvtsi128_si64(res_sum_64) + (uint64_t) _mm_extract_epi64(res_sum_64, 1);
+  uint64_t total_square_sum = (uint64_t) _mm_cvtsi128_si64(square_sum_64) +
+                              (uint64_t) _mm_extract_epi64(square_sum_64, 1);
 
   //handle last pixels SISD
   for (size_t result_idx = 4 * i; result_idx < pixel_count; ++result_idx)
@@ -239,57 +398,24 @@ void brightness_contrast_V1(const uint8_t *img, size_t width, size_t height,
 
     result[result_idx] = (uint8_t) rintf(res_val);
 
-    total_sum += res_val;
-  }
-
-  float avg = total_sum / (float) pixel_count;
-
-  //get average in all 4 slots
-  __m128 avg_m128 = _mm_set1_ps(avg);
-
-  //sigma Loop
-  __m128 sigma_sum = _mm_setzero_ps();
-  for (i = 0; i <= pixel_count - 4; i += 4)
-  {
-    //sigma += (((float) result[out_idx] - avg) * ((float) result[out_idx] - avg));
-
-    //load 4 bytes from res; that's 4 pixels now, since color turned into grey
-    __m128i raw_data = _mm_loadu_si32((__m128i*) &result[i]);
-
-    //convert from 8 bit to 32 bit
-    __m128i pixels_32bit = _mm_cvtepu8_epi32(raw_data);
-
-    //convert pixel values to float
-    __m128 pixels = _mm_cvtepi32_ps(pixels_32bit);
-
-
-    pixels = _mm_sub_ps(pixels, avg_m128);
-
-    pixels = _mm_mul_ps(pixels, pixels);
-
-    sigma_sum = _mm_add_ps(pixels, sigma_sum);
-  }
-
-  sigma_sum = _mm_hadd_ps(sigma_sum, sigma_sum);
-  sigma_sum = _mm_hadd_ps(sigma_sum, sigma_sum);
-
-  float sigma = _mm_cvtss_f32(sigma_sum);
-
-  //handle last pixels
-  for (; i < pixel_count; ++i)
-  {
-    sigma += ((float) result[i] - avg) * ((float) result[i] - avg);
+    total_sum += result[result_idx];
+    total_square_sum += (uint32_t) result[result_idx] * result[result_idx];
   }
+  bc_trace_end(BCTraceGrayscale, trace);
 
-  sigma /= (float) pixel_count;
+  trace = bc_trace_begin();
+  float avg, sigma;
+  bc_stats_from_sums(total_sum, total_square_sum, pixel_count, &avg, &sigma);
 
   float div = (sigma == 0.0f && contrast == sigma) ? 0.0f : contrast / sqrtf(sigma);
+  bc_trace_end(BCTraceStats, trace);
 
   float to_add = (1.0f - div) * avg;
   __m128 to_add_m128 = _mm_set1_ps(to_add);
   __m128 div_m128 = _mm_set1_ps(div);
 
   //contrast loop
+  trace = bc_trace_begin();
   for (i = 0; i <= pixel_count-4; i += 4)
   {
     //load 4 bytes aka 4 pixels
@@ -325,6 +451,156 @@ void brightness_contrast_V1(const uint8_t *img, size_t width, size_t height,
     result[i] = (uint8_t) rintf(clamp_float(0.0f, 255.0f,
       (div * (float) result[i]) + adjusted_avg));
   }
+  bc_trace_end(BCTraceContrast, trace);
+}
+
+static void brightness_contrast_V1_sse41(const uint8_t *img, size_t width, size_t height,
+                                        float a, float b, float c,
+                                        int16_t brightness, float contrast,
+                                        uint8_t *result)
+{
+  brightness_contrast_c_simd(img, width, height, a, b, c, brightness, contrast, result,
+                             width * height >= bc_streaming_threshold());
+}
+
+__attribute__((target("avx2")))
+static void brightness_contrast_V1_avx2(const uint8_t *img, size_t width, size_t height,
+                                        float a, float b, float c,
+                                        int16_t brightness, float contrast,
+                                        uint8_t *result)
+{
+  brightness_contrast_c_simd(img, width, height, a, b, c, brightness, contrast, result,
+                             width * height >= bc_streaming_threshold());
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+static void brightness_contrast_V1_avx512(const uint8_t *img, size_t width, size_t height,
+                                          float a, float b, float c,
+                                          int16_t brightness, float contrast,
+                                          uint8_t *result)
+{
+  brightness_contrast_c_simd(img, width, height, a, b, c, brightness, contrast, result,
+                             width * height >= bc_streaming_threshold());
+}
+
+void brightness_contrast_V1(const uint8_t *img, size_t width, size_t height,
+                            float a, float b, float c,
+                            int16_t brightness, float contrast,
+                            uint8_t *result)
+{
+  switch (bc_cpu_level())
+  {
+    case BCCpuAVX512:
+      brightness_contrast_V1_avx512(img, width, height, a, b, c, brightness, contrast, result);
+      break;
+    case BCCpuAVX2:
+      brightness_contrast_V1_avx2(img, width, height, a, b, c, brightness, contrast, result);
+      break;
+    default:
+      brightness_contrast_V1_sse41(img, width, height, a, b, c, brightness, contrast, result);
+      break;
+  }
+}
+
+// pixels per task of V4, small enough for the pool to balance the load via work stealing
+#define V4_BLOCK_PIXELS (16 * 1024)
+
+typedef struct
+{
+  const uint8_t *img;
+  uint8_t *result;
+  size_t pixel_count;
+  size_t blocks;
+  float a, b, c;
+  int16_t brightness;
+  float contrast;
+
+  uint64_t *block_sum;
+  uint64_t *block_sum_squares;
+
+  // results of the reductions, every thread of the region works on its own copy of the context
+  float avg;
+  float div;
+  float adjusted_avg;
+} BCSisdMTContext;
+
+// the context fields are copied into locals, otherwise the stores to result[] force them to be reloaded (aliasing)
+static void v4_grayscale_block(void *arg, size_t block)
+{
+  const BCSisdMTContext *ctx = arg;
+  const uint8_t *img = ctx->img;
+  uint8_t *result = ctx->result;
+  const float a = ctx->a, b = ctx->b, c = ctx->c;
+  const float brightness = (float) ctx->brightness;
+
+  const size_t from = block * V4_BLOCK_PIXELS;
+  const size_t to = ctx->pixel_count - from < V4_BLOCK_PIXELS ? ctx->pixel_count : from + V4_BLOCK_PIXELS;
+
+  const uint64_t trace = bc_trace_begin();
+  uint64_t sum = 0;
+  uint64_t sum_squares = 0;
+  for (size_t out_idx = from; out_idx < to; ++out_idx)
+  {
+    const float red = img[out_idx * 3 + 0];
+    const float green = img[out_idx * 3 + 1];
+    const float blue = img[out_idx * 3 + 2];
+
+    const float res_val = clamp_float(0.0f, 255.0f, (a * red + b * green + c * blue) + brightness);
+
+    result[out_idx] = (uint8_t) rintf(res_val);
+    sum += result[out_idx];
+    sum_squares += (uint32_t) result[out_idx] * result[out_idx];
+  }
+
+  ctx->block_sum[block] = sum;
+  ctx->block_sum_squares[block] = sum_squares;
+  bc_trace_end(BCTraceGrayscale, trace);
+}
+
+static void v4_contrast_block(void *arg, size_t block)
+{
+  const BCSisdMTContext *ctx = arg;
+  uint8_t *result = ctx->result;
+  const float div = ctx->div;
+  const float adjusted_avg = ctx->adjusted_avg;
+
+  const size_t from = block * V4_BLOCK_PIXELS;
+  const size_t to = ctx->pixel_count - from < V4_BLOCK_PIXELS ? ctx->pixel_count : from + V4_BLOCK_PIXELS;
+
+  const uint64_t trace = bc_trace_begin();
+  for (size_t out_idx = from; out_idx < to; ++out_idx)
+    result[out_idx] = (uint8_t) rintf(clamp_float(0.0f, 255.0f, (div * (float) result[out_idx]) + adjusted_avg));
+  bc_trace_end(BCTraceContrast, trace);
+}
+
+// integer partials => the result is exact and the same for any number of threads
+static uint64_t v4_reduce(const uint64_t *block_partial, size_t blocks)
+{
+  uint64_t sum = 0;
+  for (size_t block = 0; block < blocks; ++block)
+    sum += block_partial[block];
+
+  return sum;
+}
+
+// both phases in one parallel region (bc_pool_for ends with a barrier),
+// the reduction is done redundantly by every thread => no further synchronization needed
+static void v4_region(BCPoolRegion *region, void *arg)
+{
+  BCSisdMTContext ctx = *(const BCSisdMTContext *) arg;
+
+  bc_pool_for(region, ctx.blocks, &v4_grayscale_block, &ctx);
+
+  const uint64_t trace = bc_trace_begin();
+  float sigma;
+  bc_stats_from_sums(v4_reduce(ctx.block_sum, ctx.blocks), v4_reduce(ctx.block_sum_squares, ctx.blocks),
+                     ctx.pixel_count, &ctx.avg, &sigma);
+
+  ctx.div = (sigma == 0.0f && ctx.contrast == sigma) ? 0.0f : ctx.contrast / sqrtf(sigma);
+  ctx.adjusted_avg = ((1.0f - ctx.div) * ctx.avg);
+  bc_trace_end(BCTraceStats, trace);
+
+  bc_pool_for(region, ctx.blocks, &v4_contrast_block, &ctx);
 }
 
 void brightness_contrast_V4(const uint8_t *img, size_t width, size_t height,
@@ -335,43 +611,397 @@ void brightness_contrast_V4(const uint8_t *img, size_t width, size_t height,
   const size_t pixel_count = width * height;
   const float coeff_sum = a + b + c;
 
+  BCSisdMTContext ctx =
+  {
+    .img = img,
+    .result = result,
+    .pixel_count = pixel_count,
+    .blocks = (pixel_count + V4_BLOCK_PIXELS - 1) / V4_BLOCK_PIXELS,
+    .a = a / coeff_sum,
+    .b = b / coeff_sum,
+    .c = c / coeff_sum,
+    .brightness = brightness,
+    .contrast = contrast,
+  };
+
+  ctx.block_sum = malloc(ctx.blocks * sizeof(*ctx.block_sum));
+  ctx.block_sum_squares = malloc(ctx.blocks * sizeof(*ctx.block_sum_squares));
+  if (!ctx.block_sum || !ctx.block_sum_squares)
+  {
+    free(ctx.block_sum);
+    free(ctx.block_sum_squares);
+    brightness_contrast_V3(img, width, height, a, b, c, brightness, contrast, result);
+    return;
+  }
+
+  bc_pool_parallel(pixel_count, &v4_region, &ctx);
+
+  free(ctx.block_sum);
+  free(ctx.block_sum_squares);
+}
+
+// pixels converted per block before they are counted, so the grayscale values are still cache-hot for the histogram
+#define HISTOGRAM_BLOCK_PIXELS (32 * 1024)
+
+static void brightness_contrast_histogram(const uint8_t *img, size_t width, size_t height,
+                                          float a, float b, float c,
+                                          int16_t brightness, float contrast,
+                                          uint8_t *result, bool multithreaded)
+{
+  const size_t pixel_count = width * height;
+  const size_t blocks = (pixel_count + HISTOGRAM_BLOCK_PIXELS - 1) / HISTOGRAM_BLOCK_PIXELS;
+  const float coeff_sum = a + b + c;
+
   a /= coeff_sum;
   b /= coeff_sum;
   c /= coeff_sum;
 
-  float avg = 0.0f;
+  // sigma is calculated from the rounded values in result[], so mean and variance follow exactly from their histogram
+  // => no second pass over result[] needed
+  uint64_t hist[BC_HISTOGRAM_BINS] = { 0 };
 
-  #pragma omp parallel for reduction (+:avg)
-  for (size_t out_idx = 0; out_idx < pixel_count; ++out_idx)
+  #pragma omp parallel if (multithreaded)
   {
-    const float red = img[out_idx * 3 + 0];
-    const float green = img[out_idx * 3 + 1];
-    const float blue = img[out_idx * 3 + 2];
+    uint64_t hist_thread[BC_HISTOGRAM_BINS] = { 0 };
+
+    #pragma omp for schedule(static)
+    for (size_t block = 0; block < blocks; ++block)
+    {
+      const size_t from = block * HISTOGRAM_BLOCK_PIXELS;
+      const size_t count = pixel_count - from < HISTOGRAM_BLOCK_PIXELS ? pixel_count - from : HISTOGRAM_BLOCK_PIXELS;
+
+      uint64_t trace = bc_trace_begin();
+      bc_stage_grayscale(&img[from * 3], count, a, b, c, brightness, &result[from], NULL);
+      bc_trace_end(BCTraceGrayscale, trace);
+
+      trace = bc_trace_begin();
+      bc_histogram_add(&result[from], count, hist_thread);
+      bc_trace_end(BCTraceHistogram, trace);
+    }
+
+    // integer counts => the order of the reduction doesn't change the result
+    #pragma omp critical
+    for (int bin = 0; bin < BC_HISTOGRAM_BINS; ++bin)
+      hist[bin] += hist_thread[bin];
+  }
 
-    const float res_val = clamp_float(0.0f, 255.0f,
-                                      (a * red + b * green + c * blue) + (float) brightness);
+  const uint64_t trace = bc_trace_begin();
+  float avg, sigma;
+  bc_histogram_stats(hist, &avg, &sigma);
 
-    result[out_idx] = (uint8_t) rintf(res_val);
-    avg += res_val;
+  float div, adjusted_avg;
+  bc_contrast_factors(contrast, avg, sigma, &sqrtf, &div, &adjusted_avg);
+  bc_trace_end(BCTraceStats, trace);
+
+  #pragma omp parallel for if (multithreaded) schedule(static)
+  for (size_t block = 0; block < blocks; ++block)
+  {
+    const size_t from = block * HISTOGRAM_BLOCK_PIXELS;
+    const size_t count = pixel_count - from < HISTOGRAM_BLOCK_PIXELS ? pixel_count - from : HISTOGRAM_BLOCK_PIXELS;
+
+    const uint64_t block_trace = bc_trace_begin();
+    bc_stage_contrast(&result[from], count, div, adjusted_avg);
+    bc_trace_end(BCTraceContrast, block_trace);
   }
+}
 
-  avg /= (float) pixel_count;
+void brightness_contrast_V9(const uint8_t *img, size_t width, size_t height,
+                            float a, float b, float c,
+                            int16_t brightness, float contrast,
+                            uint8_t *result)
+{
+  brightness_contrast_histogram(img, width, height, a, b, c, brightness, contrast, result, false);
+}
+
+void brightness_contrast_V10(const uint8_t *img, size_t width, size_t height,
+                             float a, float b, float c,
+                             int16_t brightness, float contrast,
+                             uint8_t *result)
+{
+  brightness_contrast_histogram(img, width, height, a, b, c, brightness, contrast, result, true);
+}
+
+void brightness_contrast_V11(const uint8_t *img, size_t width, size_t height,
+                             float a, float b, float c,
+                             int16_t brightness, float contrast,
+                             uint8_t *result)
+{
+  const size_t pixel_count = width * height;
+  const float coeff_sum = a + b + c;
+
+  a /= coeff_sum;
+  b /= coeff_sum;
+  c /= coeff_sum;
+
+  uint64_t trace = bc_trace_begin();
+  uint64_t sum_squares;
+  const uint64_t sum = bc_stage_grayscale(img, pixel_count, a, b, c, brightness, result, &sum_squares);
+  bc_trace_end(BCTraceGrayscale, trace);
+
+  trace = bc_trace_begin();
+  float avg, sigma;
+  bc_stats_from_sums(sum, sum_squares, pixel_count, &avg, &sigma);
+
+  float div, adjusted_avg;
+  bc_contrast_factors(contrast, avg, sigma, &sqrtf, &div, &adjusted_avg);
+
+  // only 256 different inputs => evaluate the float formula once per value instead of once per pixel
+  uint8_t lut[BC_HISTOGRAM_BINS];
+  bc_contrast_lut_build(lut, div, adjusted_avg);
+  bc_trace_end(BCTraceStats, trace);
+
+  trace = bc_trace_begin();
+  bc_stage_contrast_lut(result, pixel_count, lut);
+  bc_trace_end(BCTraceContrast, trace);
+}
 
-  float sigma = 0.0f;
-  #pragma omp parallel for reduction (+:sigma)
-  for (size_t out_idx = 0; out_idx < pixel_count; ++out_idx)
+// rows per block are chosen so that a block (rgb + grayscale) fits into L2
+#define MT_BLOCK_PIXELS (64 * 1024)
+
+void brightness_contrast_V12(const uint8_t *img, size_t width, size_t height,
+                             float a, float b, float c,
+                             int16_t brightness, float contrast,
+                             uint8_t *result)
+{
+  const size_t pixel_count = width * height;
+  const size_t block_rows = width >= MT_BLOCK_PIXELS ? 1 : MT_BLOCK_PIXELS / width;
+  const size_t blocks = (height + block_rows - 1) / block_rows;
+
+  // exact integer partial results per block => same result for any number of threads
+  uint64_t *block_sum = malloc(blocks * sizeof(*block_sum));
+  uint64_t *block_sum_squares = malloc(blocks * sizeof(*block_sum_squares));
+  if (!block_sum || !block_sum_squares)
   {
-    float val = (float) result[out_idx] - avg;
-    sigma += val * val;
+    free(block_sum);
+    free(block_sum_squares);
+    // V1 normalizes the coefficients itself
+    brightness_contrast_V1(img, width, height, a, b, c, brightness, contrast, result);
+    return;
   }
 
-  sigma /= (float) pixel_count;
+  const float coeff_sum = a + b + c;
+  a /= coeff_sum;
+  b /= coeff_sum;
+  c /= coeff_sum;
+
+  #pragma omp parallel for schedule(static)
+  for (size_t block = 0; block < blocks; ++block)
+  {
+    const size_t from = block * block_rows * width;
+    const size_t count = (height - block * block_rows < block_rows ? height - block * block_rows : block_rows) * width;
 
-  const float div = (sigma == 0.0f && contrast == sigma) ? 0.0f : contrast / sqrtf(sigma);
-  const float adjusted_avg = ((1.0f - div) * avg);
+    const uint64_t trace = bc_trace_begin();
+    block_sum[block] = bc_stage_grayscale(&img[from * 3], count, a, b, c, brightness, &result[from],
+                                          &block_sum_squares[block]);
+    bc_trace_end(BCTraceGrayscale, trace);
+  }
 
-  #pragma omp parallel for
-  for (size_t out_idx = 0; out_idx < pixel_count; ++out_idx)
-    result[out_idx] = (uint8_t) rintf(clamp_float(0.0f, 255.0f,
-                                                 (div * (float) result[out_idx]) + adjusted_avg));
+  const uint64_t trace = bc_trace_begin();
+  uint64_t sum = 0;
+  uint64_t sum_squares = 0;
+  for (size_t block = 0; block < blocks; ++block)
+  {
+    sum += block_sum[block];
+    sum_squares += block_sum_squares[block];
+  }
+
+  float avg, sigma;
+  bc_stats_from_sums(sum, sum_squares, pixel_count, &avg, &sigma);
+
+  float div, adjusted_avg;
+  bc_contrast_factors(contrast, avg, sigma, &sqrtf, &div, &adjusted_avg);
+  bc_trace_end(BCTraceStats, trace);
+
+  #pragma omp parallel for schedule(static)
+  for (size_t block = 0; block < blocks; ++block)
+  {
+    const size_t from = block * block_rows * width;
+    const size_t count = (height - block * block_rows < block_rows ? height - block * block_rows : block_rows) * width;
+
+    const uint64_t block_trace = bc_trace_begin();
+    bc_stage_contrast(&result[from], count, div, adjusted_avg);
+    bc_trace_end(BCTraceContrast, block_trace);
+  }
+
+  free(block_sum);
+  free(block_sum_squares);
+}
+
+// only every V13_SAMPLE_ROW_STEP-th row is used to estimate div before the fixed point grayscale pass
+#define V13_SAMPLE_ROW_STEP 64
+
+// float grayscale and contrast stage (normalized coefficients), the fallback if the fixed point ones are too inexact
+static void v13_float_stages(const uint8_t *img, size_t pixel_count, float a, float b, float c,
+                             int16_t brightness, float contrast, uint8_t *result)
+{
+  uint64_t trace = bc_trace_begin();
+  uint64_t sum_squares;
+  const uint64_t sum = bc_stage_grayscale(img, pixel_count, a, b, c, brightness, result, &sum_squares);
+  bc_trace_end(BCTraceGrayscale, trace);
+
+  trace = bc_trace_begin();
+  float avg, sigma;
+  bc_stats_from_sums(sum, sum_squares, pixel_count, &avg, &sigma);
+
+  float div, adjusted_avg;
+  bc_contrast_factors(contrast, avg, sigma, &sqrtf, &div, &adjusted_avg);
+  bc_trace_end(BCTraceStats, trace);
+
+  trace = bc_trace_begin();
+  bc_stage_contrast(result, pixel_count, div, adjusted_avg);
+  bc_trace_end(BCTraceContrast, trace);
+}
+
+// estimates div from a few rows (written to result, it's overwritten afterwards anyway). Only decides whether the
+// fixed point pass is tried, a wrong estimate costs time but never exactness
+static bool v13_fixed_contrast_expected(const uint8_t *img, size_t width, size_t height, float a, float b, float c,
+                                        int16_t brightness, float contrast, uint8_t *result)
+{
+  const uint64_t trace = bc_trace_begin();
+  uint64_t sum = 0;
+  uint64_t sum_squares = 0;
+  size_t rows = 0;
+  for (size_t y = 0; y < height; y += V13_SAMPLE_ROW_STEP, ++rows)
+  {
+    uint64_t row_squares;
+    sum += bc_stage_grayscale(&img[y * width * 3], width, a, b, c, brightness, &result[y * width], &row_squares);
+    sum_squares += row_squares;
+  }
+
+  float avg, sigma;
+  bc_stats_from_sums(sum, sum_squares, rows * width, &avg, &sigma);
+
+  float div, adjusted_avg;
+  bc_contrast_factors(contrast, avg, sigma, &sqrtf, &div, &adjusted_avg);
+
+  BCFixedContrast fixed_contrast;
+  const bool expected = bc_fixed_contrast(div, adjusted_avg, &fixed_contrast);
+  bc_trace_end(BCTraceStats, trace);
+
+  return expected;
+}
+
+void brightness_contrast_V13(const uint8_t *img, size_t width, size_t height,
+                             float a, float b, float c,
+                             int16_t brightness, float contrast,
+                             uint8_t *result)
+{
+  const size_t pixel_count = width * height;
+  const float coeff_sum = a + b + c;
+
+  a /= coeff_sum;
+  b /= coeff_sum;
+  c /= coeff_sum;
+
+  BCFixedCoeffs coeffs;
+  if (!bc_fixed_coeffs(a, b, c, &coeffs))
+  {
+    v13_float_stages(img, pixel_count, a, b, c, brightness, contrast, result);
+    return;
+  }
+
+  // the float contrast stage would still scale the error of the fixed point grayscale values by div => with a div
+  // out of the fixed point range (high contrast, low variance) the grayscale values have to be computed in float
+  if (!v13_fixed_contrast_expected(img, width, height, a, b, c, brightness, contrast, result))
+  {
+    v13_float_stages(img, pixel_count, a, b, c, brightness, contrast, result);
+    return;
+  }
+
+  uint64_t trace = bc_trace_begin();
+  uint64_t sum_squares;
+  const uint64_t sum = bc_stage_grayscale_fixed(img, pixel_count, &coeffs, brightness, result, &sum_squares);
+  bc_trace_end(BCTraceGrayscale, trace);
+
+  trace = bc_trace_begin();
+  float avg, sigma;
+  bc_stats_from_sums(sum, sum_squares, pixel_count, &avg, &sigma);
+
+  float div, adjusted_avg;
+  bc_contrast_factors(contrast, avg, sigma, &sqrtf, &div, &adjusted_avg);
+
+  BCFixedContrast fixed_contrast;
+  const bool fixed = bc_fixed_contrast(div, adjusted_avg, &fixed_contrast);
+  bc_trace_end(BCTraceStats, trace);
+
+  // the estimate was wrong (only close to the limit)
+  if (!fixed)
+  {
+    v13_float_stages(img, pixel_count, a, b, c, brightness, contrast, result);
+    return;
+  }
+
+  trace = bc_trace_begin();
+  bc_stage_contrast_fixed(result, pixel_count, &fixed_contrast);
+  bc_trace_end(BCTraceContrast, trace);
+}
+
+// a tile (rgb + grayscale) fills half of L2, the other half is left for the next tile brought in by the prefetchers
+#define TILE_BYTES_PER_PIXEL 4
+#define TILE_DEFAULT_L2_SIZE (256 * 1024)
+
+static size_t tile_pixels()
+{
+  static atomic_size_t cached_pixels = 0;
+
+  size_t pixels = atomic_load_explicit(&cached_pixels, memory_order_relaxed);
+  if (!pixels)
+  {
+    const long l2_size = sysconf(_SC_LEVEL2_CACHE_SIZE); // 0 or -1 if unknown
+    pixels = (l2_size > 0 ? (size_t) l2_size : TILE_DEFAULT_L2_SIZE) / 2 / TILE_BYTES_PER_PIXEL;
+    pixels = pixels < 64 ? 64 : pixels & ~(size_t) 63; // whole SIMD iterations
+    atomic_store_explicit(&cached_pixels, pixels, memory_order_relaxed);
+  }
+
+  return pixels;
+}
+
+void brightness_contrast_V14(const uint8_t *img, size_t width, size_t height,
+                             float a, float b, float c,
+                             int16_t brightness, float contrast,
+                             uint8_t *result)
+{
+  const size_t pixel_count = width * height;
+  const size_t tile = tile_pixels();
+  const size_t tiles = (pixel_count + tile - 1) / tile;
+  const float coeff_sum = a + b + c;
+
+  a /= coeff_sum;
+  b /= coeff_sum;
+  c /= coeff_sum;
+
+  // grayscale and sums of a tile in one go, the tile is never read again before the contrast pass
+  uint64_t sum = 0;
+  uint64_t sum_squares = 0;
+  for (size_t t = 0; t < tiles; ++t)
+  {
+    const size_t from = t * tile;
+    const size_t count = pixel_count - from < tile ? pixel_count - from : tile;
+
+    const uint64_t trace = bc_trace_begin();
+    uint64_t tile_squares;
+    sum += bc_stage_grayscale(&img[from * 3], count, a, b, c, brightness, &result[from], &tile_squares);
+    sum_squares += tile_squares;
+    bc_trace_end(BCTraceGrayscale, trace);
+  }
+
+  const uint64_t trace = bc_trace_begin();
+  float avg, sigma;
+  bc_stats_from_sums(sum, sum_squares, pixel_count, &avg, &sigma);
+
+  float div, adjusted_avg;
+  bc_contrast_factors(contrast, avg, sigma, &sqrtf, &div, &adjusted_avg);
+  bc_trace_end(BCTraceStats, trace);
+
+  // last tile first: the most recently written grayscale values are still in L2/LLC, only the first part of
+  // result[] has been evicted once the image exceeds the caches
+  for (size_t t = tiles; t-- > 0;)
+  {
+    const size_t from = t * tile;
+    const size_t count = pixel_count - from < tile ? pixel_count - from : tile;
+
+    const uint64_t tile_trace = bc_trace_begin();
+    bc_stage_contrast(&result[from], count, div, adjusted_avg);
+    bc_trace_end(BCTraceContrast, tile_trace);
+  }
 }
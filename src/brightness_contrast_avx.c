@@ -0,0 +1,557 @@
+#include "brightness_contrast.h"
+
+#include <math.h>
+#include <immintrin.h>
+
+#include "bc_stages.h"
+#include "bc_trace.h"
+
+/*
+ * 256 and 512 bit variants of the C SIMD implementation.
+ * Both only get called if bc_cpu_level() reports support (see bc_implementation[].level),
+ * the whole file is compiled with the SSE4.1 baseline, the kernels themselves via target attributes.
+ *
+ * The calculations are done in the same order as in the SISD implementations, so the grayscale values are bit-identical.
+ * The average is built from the rounded grayscale values via (v)psadbw, which sums bytes into 64 bit lanes
+ * and therefore can't overflow. The squares are summed up via (v)pmaddwd in 32 bit lanes, which get 4 squares per
+ * iteration and are added to 64 bit lanes every SQUARES_FLUSH_ITERATIONS iterations (same as in bc_stages.c).
+ */
+
+// extract r, g, b of 4 pixels (12 bytes) into the lowest byte of 4 dwords, -1 sets the byte to zero
+#define MASK_EXTRACT(off) _mm_setr_epi8(0 + off, -1, -1, -1, 3 + off, -1, -1, -1, \
+                                         6 + off, -1, -1, -1, 9 + off, -1, -1, -1)
+
+#define SQUARES_FLUSH_ITERATIONS 8192
+
+// ================================================================
+// AVX2: 32 pixels per iteration in the grayscale loop, 32 bytes per iteration in the contrast loop
+// ================================================================
+
+__attribute__((target("avx2")))
+static inline __m256i add_epu32_to_epi64_avx2(__m256i sum, __m256i val)
+{
+  sum = _mm256_add_epi64(sum, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(val)));
+  return _mm256_add_epi64(sum, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(val, 1)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i squares_32_avx2(__m256i bytes)
+{
+  const __m256i lo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(bytes));
+  const __m256i hi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(bytes, 1));
+
+  return _mm256_add_epi32(_mm256_madd_epi16(lo, lo), _mm256_madd_epi16(hi, hi));
+}
+
+__attribute__((target("avx2")))
+static inline __m256 gray_8_avx2(const uint8_t* img, __m256i mask_r, __m256i mask_g, __m256i mask_b, __m256i spread,
+                                 __m256 coeff_a, __m256 coeff_b, __m256 coeff_c, __m256 brightness)
+{
+  // 8 rgb pixels = 24 bytes: move bytes 0..11 into the lower and bytes 12..23 into the upper lane,
+  // so the in-lane vpshufb can extract 4 pixels per lane
+  const __m256i raw = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i*) img), spread);
+
+  const __m256 red = _mm256_cvtepi32_ps(_mm256_shuffle_epi8(raw, mask_r));
+  const __m256 green = _mm256_cvtepi32_ps(_mm256_shuffle_epi8(raw, mask_g));
+  const __m256 blue = _mm256_cvtepi32_ps(_mm256_shuffle_epi8(raw, mask_b));
+
+  __m256 res = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(red, coeff_a), _mm256_mul_ps(green, coeff_b)),
+                             _mm256_mul_ps(blue, coeff_c));
+  res = _mm256_add_ps(res, brightness);
+
+  return _mm256_min_ps(_mm256_max_ps(res, _mm256_setzero_ps()), _mm256_set1_ps(255.0f));
+}
+
+// packs 4x8 floats in [0, 255] into 32 bytes (with rounding) in the original order
+__attribute__((target("avx2")))
+static inline __m256i pack_32_avx2(__m256 v0, __m256 v1, __m256 v2, __m256 v3)
+{
+  const __m256i p01 = _mm256_packus_epi32(_mm256_cvtps_epi32(v0), _mm256_cvtps_epi32(v1));
+  const __m256i p23 = _mm256_packus_epi32(_mm256_cvtps_epi32(v2), _mm256_cvtps_epi32(v3));
+
+  // packs work per lane: lane 0 = [v0[0..3], v1[0..3], v2[0..3], v3[0..3]], lane 1 = [v0[4..7], ...]
+  return _mm256_permutevar8x32_epi32(_mm256_packus_epi16(p01, p23), _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+__attribute__((target("avx2")))
+static inline __m256 load_8_bytes_as_ps_avx2(const uint8_t* src)
+{
+  return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) src)));
+}
+
+__attribute__((target("avx2")))
+uint64_t bc_grayscale_avx2(const uint8_t *img, size_t pixel_count, float a, float b, float c, int16_t brightness,
+                           uint8_t *result, uint64_t *sum_squares)
+{
+  const __m256 coeff_a = _mm256_set1_ps(a);
+  const __m256 coeff_b = _mm256_set1_ps(b);
+  const __m256 coeff_c = _mm256_set1_ps(c);
+  const __m256 brightness_ps = _mm256_set1_ps((float) brightness);
+
+  const __m256i mask_r = _mm256_broadcastsi128_si256(MASK_EXTRACT(0));
+  const __m256i mask_g = _mm256_broadcastsi128_si256(MASK_EXTRACT(1));
+  const __m256i mask_b = _mm256_broadcastsi128_si256(MASK_EXTRACT(2));
+  const __m256i spread = _mm256_setr_epi32(0, 1, 2, 0, 3, 4, 5, 0);
+
+  // the last group of an iteration reads 32 bytes at offset 72 => 104 bytes = 35 pixels have to be left
+  __m256i sum = _mm256_setzero_si256();
+  __m256i squares = _mm256_setzero_si256();
+  __m256i squares_32 = _mm256_setzero_si256();
+  size_t iterations = 0;
+  size_t i = 0;
+  for (; i + 35 <= pixel_count; i += 32)
+  {
+    const uint8_t* src = &img[i * 3];
+    const __m256 g0 = gray_8_avx2(src,      mask_r, mask_g, mask_b, spread, coeff_a, coeff_b, coeff_c, brightness_ps);
+    const __m256 g1 = gray_8_avx2(src + 24, mask_r, mask_g, mask_b, spread, coeff_a, coeff_b, coeff_c, brightness_ps);
+    const __m256 g2 = gray_8_avx2(src + 48, mask_r, mask_g, mask_b, spread, coeff_a, coeff_b, coeff_c, brightness_ps);
+    const __m256 g3 = gray_8_avx2(src + 72, mask_r, mask_g, mask_b, spread, coeff_a, coeff_b, coeff_c, brightness_ps);
+
+    const __m256i bytes = pack_32_avx2(g0, g1, g2, g3);
+    sum = _mm256_add_epi64(sum, _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+    squares_32 = _mm256_add_epi32(squares_32, squares_32_avx2(bytes));
+    _mm256_storeu_si256((__m256i*) &result[i], bytes);
+
+    if (++iterations == SQUARES_FLUSH_ITERATIONS)
+    {
+      squares = add_epu32_to_epi64_avx2(squares, squares_32);
+      squares_32 = _mm256_setzero_si256();
+      iterations = 0;
+    }
+  }
+
+  squares = add_epu32_to_epi64_avx2(squares, squares_32);
+
+  uint64_t tail_squares;
+  const uint64_t tail_sum = bc_grayscale_sisd(&img[i * 3], pixel_count - i, a, b, c, brightness, &result[i],
+                                              &tail_squares);
+
+  if (sum_squares)
+    *sum_squares = (uint64_t) _mm256_extract_epi64(squares, 0) + (uint64_t) _mm256_extract_epi64(squares, 1) +
+                   (uint64_t) _mm256_extract_epi64(squares, 2) + (uint64_t) _mm256_extract_epi64(squares, 3) +
+                   tail_squares;
+
+  return (uint64_t) _mm256_extract_epi64(sum, 0) + (uint64_t) _mm256_extract_epi64(sum, 1) +
+         (uint64_t) _mm256_extract_epi64(sum, 2) + (uint64_t) _mm256_extract_epi64(sum, 3) + tail_sum;
+}
+
+__attribute__((target("avx2")))
+void bc_contrast_avx2(uint8_t *result, size_t pixel_count, float div, float adjusted_avg)
+{
+  const __m256 div_ps = _mm256_set1_ps(div);
+  const __m256 adjusted_avg_ps = _mm256_set1_ps(adjusted_avg);
+  const __m256 clamp_min = _mm256_setzero_ps();
+  const __m256 clamp_max = _mm256_set1_ps(255.0f);
+
+  size_t i = 0;
+  for (; i + 32 <= pixel_count; i += 32)
+  {
+    __m256 v[4];
+    for (size_t j = 0; j < 4; ++j)
+    {
+      v[j] = _mm256_add_ps(_mm256_mul_ps(div_ps, load_8_bytes_as_ps_avx2(&result[i + 8 * j])), adjusted_avg_ps);
+      v[j] = _mm256_min_ps(_mm256_max_ps(v[j], clamp_min), clamp_max);
+    }
+
+    _mm256_storeu_si256((__m256i*) &result[i], pack_32_avx2(v[0], v[1], v[2], v[3]));
+  }
+
+  bc_contrast_sisd(&result[i], pixel_count - i, div, adjusted_avg);
+}
+
+// nibble splitting as in bc_contrast_lut_sse41, each table part is broadcast into both lanes
+__attribute__((target("avx2")))
+void bc_contrast_lut_avx2(uint8_t *result, size_t pixel_count, const uint8_t lut[BC_HISTOGRAM_BINS])
+{
+  __m256i table[16];
+  for (int k = 0; k < 16; ++k)
+    table[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) &lut[16 * k]));
+
+  const __m256i bias = _mm256_set1_epi8(0x70);
+  const __m256i step = _mm256_set1_epi8(16);
+
+  size_t i = 0;
+  for (; i + 32 <= pixel_count; i += 32)
+  {
+    __m256i idx = _mm256_loadu_si256((const __m256i*) &result[i]);
+    __m256i res = _mm256_setzero_si256();
+
+    for (int k = 0; k < 16; ++k)
+    {
+      res = _mm256_or_si256(res, _mm256_shuffle_epi8(table[k], _mm256_adds_epu8(idx, bias)));
+      idx = _mm256_sub_epi8(idx, step);
+    }
+
+    _mm256_storeu_si256((__m256i*) &result[i], res);
+  }
+
+  bc_contrast_lut_sisd(&result[i], pixel_count - i, lut);
+}
+
+// fixed point kernels, see bc_grayscale_fixed_sse41: the lower lane works on pixels 0..7, the upper one on 8..15
+#define FIXED_SHUFFLE_RG_LO _mm_setr_epi8(0, 1, 3, 4, 6, 7, 9, 10, -1, -1, -1, -1, -1, -1, -1, -1)
+#define FIXED_SHUFFLE_RG_HI _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 4, 5, 7, 8, 10, 11, 13, 14)
+#define FIXED_SHUFFLE_B_LO  _mm_setr_epi8(2, -1, 5, -1, 8, -1, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1)
+#define FIXED_SHUFFLE_B_HI  _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 6, -1, 9, -1, 12, -1, 15, -1)
+
+__attribute__((target("avx2")))
+static inline __m256i gray_16_fixed_avx2(const uint8_t* img, __m256i hi_rg, __m256i hi_b, __m256i lo_rg, __m256i lo_b,
+                                         __m256i brightness)
+{
+  const __m256i raw_lo = _mm256_loadu2_m128i((const __m128i*) (img + 24), (const __m128i*) img);
+  const __m256i raw_hi = _mm256_loadu2_m128i((const __m128i*) (img + 32), (const __m128i*) (img + 8));
+
+  const __m256i rg = _mm256_or_si256(_mm256_shuffle_epi8(raw_lo, _mm256_broadcastsi128_si256(FIXED_SHUFFLE_RG_LO)),
+                                     _mm256_shuffle_epi8(raw_hi, _mm256_broadcastsi128_si256(FIXED_SHUFFLE_RG_HI)));
+  const __m256i b = _mm256_or_si256(_mm256_shuffle_epi8(raw_lo, _mm256_broadcastsi128_si256(FIXED_SHUFFLE_B_LO)),
+                                    _mm256_shuffle_epi8(raw_hi, _mm256_broadcastsi128_si256(FIXED_SHUFFLE_B_HI)));
+
+  const __m256i hi = _mm256_add_epi16(_mm256_maddubs_epi16(rg, hi_rg), _mm256_maddubs_epi16(b, hi_b));
+  const __m256i lo = _mm256_add_epi16(_mm256_add_epi16(_mm256_maddubs_epi16(rg, lo_rg), _mm256_maddubs_epi16(b, lo_b)),
+                                      _mm256_set1_epi16(1 << 12));
+  const __m256i gray = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(lo, 6)), 7);
+
+  return _mm256_adds_epi16(gray, brightness);
+}
+
+__attribute__((target("avx2")))
+uint64_t bc_grayscale_fixed_avx2(const uint8_t *img, size_t pixel_count, const BCFixedCoeffs *coeffs,
+                                 int16_t brightness, uint8_t *result, uint64_t *sum_squares)
+{
+  const __m256i hi_rg = _mm256_set1_epi16((int16_t) ((uint8_t) coeffs->hi[1] << 8 | (uint8_t) coeffs->hi[0]));
+  const __m256i hi_b = _mm256_set1_epi16(coeffs->hi[2]);
+  const __m256i lo_rg = _mm256_set1_epi16((int16_t) ((uint8_t) coeffs->lo[1] << 8 | (uint8_t) coeffs->lo[0]));
+  const __m256i lo_b = _mm256_set1_epi16(coeffs->lo[2]);
+  const __m256i brightness_epi16 = _mm256_set1_epi16(brightness);
+
+  __m256i sum = _mm256_setzero_si256();
+  __m256i squares = _mm256_setzero_si256();
+  __m256i squares_32 = _mm256_setzero_si256();
+  size_t iterations = 0;
+  size_t i = 0;
+  for (; i + 32 <= pixel_count; i += 32)
+  {
+    const uint8_t* src = &img[i * 3];
+    const __m256i g0 = gray_16_fixed_avx2(src,      hi_rg, hi_b, lo_rg, lo_b, brightness_epi16);
+    const __m256i g1 = gray_16_fixed_avx2(src + 48, hi_rg, hi_b, lo_rg, lo_b, brightness_epi16);
+
+    // packus works per lane => pixels 0..7, 16..23 | 8..15, 24..31
+    const __m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(g0, g1), 0xD8);
+
+    sum = _mm256_add_epi64(sum, _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+    squares_32 = _mm256_add_epi32(squares_32, squares_32_avx2(bytes));
+    _mm256_storeu_si256((__m256i*) &result[i], bytes);
+
+    if (++iterations == SQUARES_FLUSH_ITERATIONS)
+    {
+      squares = add_epu32_to_epi64_avx2(squares, squares_32);
+      squares_32 = _mm256_setzero_si256();
+      iterations = 0;
+    }
+  }
+
+  squares = add_epu32_to_epi64_avx2(squares, squares_32);
+
+  uint64_t tail_squares;
+  const uint64_t tail_sum = bc_grayscale_fixed_sisd(&img[i * 3], pixel_count - i, coeffs, brightness, &result[i],
+                                                    &tail_squares);
+
+  if (sum_squares)
+    *sum_squares = (uint64_t) _mm256_extract_epi64(squares, 0) + (uint64_t) _mm256_extract_epi64(squares, 1) +
+                   (uint64_t) _mm256_extract_epi64(squares, 2) + (uint64_t) _mm256_extract_epi64(squares, 3) +
+                   tail_squares;
+
+  return (uint64_t) _mm256_extract_epi64(sum, 0) + (uint64_t) _mm256_extract_epi64(sum, 1) +
+         (uint64_t) _mm256_extract_epi64(sum, 2) + (uint64_t) _mm256_extract_epi64(sum, 3) + tail_sum;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i contrast_16_fixed_avx2(__m256i val, __m256i div, __m256i adjusted_avg, __m256i round,
+                                             __m128i shift)
+{
+  const __m256i scaled = _mm256_mulhrs_epi16(_mm256_slli_epi16(val, 7), div);
+  return _mm256_sra_epi16(_mm256_adds_epi16(_mm256_adds_epi16(scaled, adjusted_avg), round), shift);
+}
+
+__attribute__((target("avx2")))
+void bc_contrast_fixed_avx2(uint8_t *result, size_t pixel_count, const BCFixedContrast *contrast)
+{
+  const __m256i div = _mm256_set1_epi16(contrast->div);
+  const __m256i adjusted_avg = _mm256_set1_epi16(contrast->adjusted_avg);
+  const __m256i round = _mm256_set1_epi16((int16_t) ((1 << contrast->shift) >> 1));
+  const __m128i shift = _mm_cvtsi32_si128(contrast->shift);
+
+  size_t i = 0;
+  for (; i + 32 <= pixel_count; i += 32)
+  {
+    const __m256i bytes = _mm256_loadu_si256((const __m256i*) &result[i]);
+    const __m256i lo = contrast_16_fixed_avx2(_mm256_cvtepu8_epi16(_mm256_castsi256_si128(bytes)), div, adjusted_avg,
+                                              round, shift);
+    const __m256i hi = contrast_16_fixed_avx2(_mm256_cvtepu8_epi16(_mm256_extracti128_si256(bytes, 1)), div,
+                                              adjusted_avg, round, shift);
+
+    _mm256_storeu_si256((__m256i*) &result[i], _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8));
+  }
+
+  bc_contrast_fixed_sisd(&result[i], pixel_count - i, contrast);
+}
+
+// ================================================================
+// AVX-512: 64 pixels per iteration in the grayscale loop, 64 bytes per iteration in the contrast loop
+// ================================================================
+
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512vl")))
+
+TARGET_AVX512
+static inline __m512 gray_16_avx512(const uint8_t* img, __m512i mask_r, __m512i mask_g, __m512i mask_b, __m512i spread,
+                                    __m512 coeff_a, __m512 coeff_b, __m512 coeff_c, __m512 brightness)
+{
+  // 16 rgb pixels = 48 bytes (masked load => no overread), 12 bytes = 4 pixels are moved into each lane
+  const __m512i raw = _mm512_permutexvar_epi32(spread, _mm512_maskz_loadu_epi32(0x0FFF, img));
+
+  const __m512 red = _mm512_cvtepi32_ps(_mm512_shuffle_epi8(raw, mask_r));
+  const __m512 green = _mm512_cvtepi32_ps(_mm512_shuffle_epi8(raw, mask_g));
+  const __m512 blue = _mm512_cvtepi32_ps(_mm512_shuffle_epi8(raw, mask_b));
+
+  __m512 res = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(red, coeff_a), _mm512_mul_ps(green, coeff_b)),
+                             _mm512_mul_ps(blue, coeff_c));
+  res = _mm512_add_ps(res, brightness);
+
+  return _mm512_min_ps(_mm512_max_ps(res, _mm512_setzero_ps()), _mm512_set1_ps(255.0f));
+}
+
+// packs 4x16 floats in [0, 255] into 64 bytes (with rounding) in the original order
+TARGET_AVX512
+static inline __m512i pack_64_avx512(__m512 v0, __m512 v1, __m512 v2, __m512 v3)
+{
+  const __m512i p01 = _mm512_packus_epi32(_mm512_cvtps_epi32(v0), _mm512_cvtps_epi32(v1));
+  const __m512i p23 = _mm512_packus_epi32(_mm512_cvtps_epi32(v2), _mm512_cvtps_epi32(v3));
+
+  // lane k = [v0[4k..4k+3], v1[4k..4k+3], v2[4k..4k+3], v3[4k..4k+3]]
+  return _mm512_permutexvar_epi32(_mm512_setr_epi32(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15),
+                                  _mm512_packus_epi16(p01, p23));
+}
+
+TARGET_AVX512
+static inline __m512i squares_64_avx512(__m512i bytes)
+{
+  const __m512i lo = _mm512_cvtepu8_epi16(_mm512_castsi512_si256(bytes));
+  const __m512i hi = _mm512_cvtepu8_epi16(_mm512_extracti64x4_epi64(bytes, 1));
+
+  return _mm512_add_epi32(_mm512_madd_epi16(lo, lo), _mm512_madd_epi16(hi, hi));
+}
+
+TARGET_AVX512
+static inline __m512i add_epu32_to_epi64_avx512(__m512i sum, __m512i val)
+{
+  sum = _mm512_add_epi64(sum, _mm512_cvtepu32_epi64(_mm512_castsi512_si256(val)));
+  return _mm512_add_epi64(sum, _mm512_cvtepu32_epi64(_mm512_extracti64x4_epi64(val, 1)));
+}
+
+TARGET_AVX512
+static inline __m512 load_16_bytes_as_ps_avx512(const uint8_t* src)
+{
+  return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*) src)));
+}
+
+TARGET_AVX512
+uint64_t bc_grayscale_avx512(const uint8_t *img, size_t pixel_count, float a, float b, float c, int16_t brightness,
+                             uint8_t *result, uint64_t *sum_squares)
+{
+  const __m512 coeff_a = _mm512_set1_ps(a);
+  const __m512 coeff_b = _mm512_set1_ps(b);
+  const __m512 coeff_c = _mm512_set1_ps(c);
+  const __m512 brightness_ps = _mm512_set1_ps((float) brightness);
+
+  const __m512i mask_r = _mm512_broadcast_i32x4(MASK_EXTRACT(0));
+  const __m512i mask_g = _mm512_broadcast_i32x4(MASK_EXTRACT(1));
+  const __m512i mask_b = _mm512_broadcast_i32x4(MASK_EXTRACT(2));
+  const __m512i spread = _mm512_setr_epi32(0, 1, 2, 0, 3, 4, 5, 0, 6, 7, 8, 0, 9, 10, 11, 0);
+
+  __m512i sum = _mm512_setzero_si512();
+  __m512i squares = _mm512_setzero_si512();
+  __m512i squares_32 = _mm512_setzero_si512();
+  size_t iterations = 0;
+  size_t i = 0;
+  for (; i + 64 <= pixel_count; i += 64)
+  {
+    const uint8_t* src = &img[i * 3];
+    const __m512 g0 = gray_16_avx512(src,       mask_r, mask_g, mask_b, spread, coeff_a, coeff_b, coeff_c, brightness_ps);
+    const __m512 g1 = gray_16_avx512(src + 48,  mask_r, mask_g, mask_b, spread, coeff_a, coeff_b, coeff_c, brightness_ps);
+    const __m512 g2 = gray_16_avx512(src + 96,  mask_r, mask_g, mask_b, spread, coeff_a, coeff_b, coeff_c, brightness_ps);
+    const __m512 g3 = gray_16_avx512(src + 144, mask_r, mask_g, mask_b, spread, coeff_a, coeff_b, coeff_c, brightness_ps);
+
+    const __m512i bytes = pack_64_avx512(g0, g1, g2, g3);
+    sum = _mm512_add_epi64(sum, _mm512_sad_epu8(bytes, _mm512_setzero_si512()));
+    squares_32 = _mm512_add_epi32(squares_32, squares_64_avx512(bytes));
+    _mm512_storeu_si512(&result[i], bytes);
+
+    if (++iterations == SQUARES_FLUSH_ITERATIONS)
+    {
+      squares = add_epu32_to_epi64_avx512(squares, squares_32);
+      squares_32 = _mm512_setzero_si512();
+      iterations = 0;
+    }
+  }
+
+  squares = add_epu32_to_epi64_avx512(squares, squares_32);
+
+  uint64_t tail_squares;
+  const uint64_t tail_sum = bc_grayscale_sisd(&img[i * 3], pixel_count - i, a, b, c, brightness, &result[i],
+                                              &tail_squares);
+
+  if (sum_squares)
+    *sum_squares = (uint64_t) _mm512_reduce_add_epi64(squares) + tail_squares;
+
+  return (uint64_t) _mm512_reduce_add_epi64(sum) + tail_sum;
+}
+
+TARGET_AVX512
+void bc_contrast_avx512(uint8_t *result, size_t pixel_count, float div, float adjusted_avg)
+{
+  const __m512 div_ps = _mm512_set1_ps(div);
+  const __m512 adjusted_avg_ps = _mm512_set1_ps(adjusted_avg);
+  const __m512 clamp_min = _mm512_setzero_ps();
+  const __m512 clamp_max = _mm512_set1_ps(255.0f);
+
+  size_t i = 0;
+  for (; i + 64 <= pixel_count; i += 64)
+  {
+    __m512 v[4];
+    for (size_t j = 0; j < 4; ++j)
+    {
+      v[j] = _mm512_add_ps(_mm512_mul_ps(div_ps, load_16_bytes_as_ps_avx512(&result[i + 16 * j])), adjusted_avg_ps);
+      v[j] = _mm512_min_ps(_mm512_max_ps(v[j], clamp_min), clamp_max);
+    }
+
+    _mm512_storeu_si512(&result[i], pack_64_avx512(v[0], v[1], v[2], v[3]));
+  }
+
+  bc_contrast_sisd(&result[i], pixel_count - i, div, adjusted_avg);
+}
+
+TARGET_AVX512
+void bc_contrast_lut_avx512(uint8_t *result, size_t pixel_count, const uint8_t lut[BC_HISTOGRAM_BINS])
+{
+  __m512i table[16];
+  for (int k = 0; k < 16; ++k)
+    table[k] = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i*) &lut[16 * k]));
+
+  const __m512i bias = _mm512_set1_epi8(0x70);
+  const __m512i step = _mm512_set1_epi8(16);
+
+  size_t i = 0;
+  for (; i + 64 <= pixel_count; i += 64)
+  {
+    __m512i idx = _mm512_loadu_si512(&result[i]);
+    __m512i res = _mm512_setzero_si512();
+
+    for (int k = 0; k < 16; ++k)
+    {
+      res = _mm512_or_si512(res, _mm512_shuffle_epi8(table[k], _mm512_adds_epu8(idx, bias)));
+      idx = _mm512_sub_epi8(idx, step);
+    }
+
+    _mm512_storeu_si512(&result[i], res);
+  }
+
+  bc_contrast_lut_sisd(&result[i], pixel_count - i, lut);
+}
+
+// vpermi2b looks up 128 entries from two registers => the whole table fits into 4 registers,
+// bit 7 of the value selects the upper or lower half
+__attribute__((target("avx512f,avx512bw,avx512vl,avx512vbmi")))
+void bc_contrast_lut_avx512vbmi(uint8_t *result, size_t pixel_count, const uint8_t lut[BC_HISTOGRAM_BINS])
+{
+  const __m512i table_0 = _mm512_loadu_si512(&lut[0]);
+  const __m512i table_1 = _mm512_loadu_si512(&lut[64]);
+  const __m512i table_2 = _mm512_loadu_si512(&lut[128]);
+  const __m512i table_3 = _mm512_loadu_si512(&lut[192]);
+
+  size_t i = 0;
+  for (; i + 64 <= pixel_count; i += 64)
+  {
+    const __m512i idx = _mm512_loadu_si512(&result[i]);
+
+    const __m512i low = _mm512_permutex2var_epi8(table_0, idx, table_1);
+    const __m512i high = _mm512_permutex2var_epi8(table_2, idx, table_3);
+
+    _mm512_storeu_si512(&result[i], _mm512_mask_blend_epi8(_mm512_movepi8_mask(idx), low, high));
+  }
+
+  // remaining bytes via masked load/store
+  if (i < pixel_count)
+  {
+    const __mmask64 mask = ~0ULL >> (64 - (pixel_count - i));
+    const __m512i idx = _mm512_maskz_loadu_epi8(mask, &result[i]);
+
+    const __m512i low = _mm512_permutex2var_epi8(table_0, idx, table_1);
+    const __m512i high = _mm512_permutex2var_epi8(table_2, idx, table_3);
+
+    _mm512_mask_storeu_epi8(&result[i], mask, _mm512_mask_blend_epi8(_mm512_movepi8_mask(idx), low, high));
+  }
+}
+
+// ================================================================
+// Implementations
+// ================================================================
+
+void brightness_contrast_V7(const uint8_t *img, size_t width, size_t height,
+                            float a, float b, float c,
+                            int16_t brightness, float contrast,
+                            uint8_t *result)
+{
+  const size_t pixel_count = width * height;
+  const float coeff_sum = a + b + c;
+
+  a /= coeff_sum;
+  b /= coeff_sum;
+  c /= coeff_sum;
+
+  uint64_t trace = bc_trace_begin();
+  uint64_t sum_squares;
+  const uint64_t sum = bc_grayscale_avx2(img, pixel_count, a, b, c, brightness, result, &sum_squares);
+  bc_trace_end(BCTraceGrayscale, trace);
+
+  trace = bc_trace_begin();
+  float avg, sigma;
+  bc_stats_from_sums(sum, sum_squares, pixel_count, &avg, &sigma);
+
+  float div, adjusted_avg;
+  bc_contrast_factors(contrast, avg, sigma, &sqrtf, &div, &adjusted_avg);
+  bc_trace_end(BCTraceStats, trace);
+
+  trace = bc_trace_begin();
+  bc_contrast_avx2(result, pixel_count, div, adjusted_avg);
+  bc_trace_end(BCTraceContrast, trace);
+}
+
+void brightness_contrast_V8(const uint8_t *img, size_t width, size_t height,
+                            float a, float b, float c,
+                            int16_t brightness, float contrast,
+                            uint8_t *result)
+{
+  const size_t pixel_count = width * height;
+  const float coeff_sum = a + b + c;
+
+  a /= coeff_sum;
+  b /= coeff_sum;
+  c /= coeff_sum;
+
+  uint64_t trace = bc_trace_begin();
+  uint64_t sum_squares;
+  const uint64_t sum = bc_grayscale_avx512(img, pixel_count, a, b, c, brightness, result, &sum_squares);
+  bc_trace_end(BCTraceGrayscale, trace);
+
+  trace = bc_trace_begin();
+  float avg, sigma;
+  bc_stats_from_sums(sum, sum_squares, pixel_count, &avg, &sigma);
+
+  float div, adjusted_avg;
+  bc_contrast_factors(contrast, avg, sigma, &sqrtf, &div, &adjusted_avg);
+  bc_trace_end(BCTraceStats, trace);
+
+  trace = bc_trace_begin();
+  bc_contrast_avx512(result, pixel_count, div, adjusted_avg);
+  bc_trace_end(BCTraceContrast, trace);
+}
@@ -0,0 +1,234 @@
+#include "buffer_pool.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define BUFFER_HUGEPAGE_SIZE ((size_t) 2 * 1024 * 1024)
+// smallest class, all smaller buffers share it
+#define BUFFER_MIN_CAPACITY_LOG2 12
+#define BUFFER_CLASSES (1 + (64 - BUFFER_MIN_CAPACITY_LOG2) * 4)
+
+typedef enum
+{
+  BufferHugeMadvise,
+  BufferHugeTLB,
+  BufferHugeNever,
+} BufferHugeMode;
+
+// in front of every buffer, keeps the data cache line aligned
+typedef struct BufferHeader
+{
+  alignas(BC_BUFFER_ALIGNMENT) size_t capacity;
+  unsigned size_class;
+  bool mapped;
+  bool huge; // requested, see BCBufferStats
+  void* base;      // start of the allocation/mapping
+  size_t map_size; // 0 .. malloc'd
+  struct BufferHeader* next; // in the free list of its class
+} BufferHeader;
+
+static_assert(sizeof(BufferHeader) == BC_BUFFER_ALIGNMENT, "Buffer header has to keep the data aligned");
+
+static struct
+{
+  pthread_once_t once;
+  pthread_mutex_t mutex;
+  BufferHugeMode huge_mode;
+  bool hugetlb_failed; // no reserved pages left, don't try again
+
+  BufferHeader* free[BUFFER_CLASSES];
+  size_t pooled_bytes;
+  BCBufferStats stats;
+} buffers = { .once = PTHREAD_ONCE_INIT, .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+static void buffer_pool_init()
+{
+  const char* mode = getenv("BC_HUGEPAGES");
+  if (mode && strcmp(mode, "never") == 0)
+    buffers.huge_mode = BufferHugeNever;
+  else if (mode && strcmp(mode, "hugetlb") == 0)
+    buffers.huge_mode = BufferHugeTLB;
+  else
+    buffers.huge_mode = BufferHugeMadvise;
+}
+
+// rounds size up to its class: 4 classes between two powers of two, 0 if size can't be represented
+static size_t buffer_class_capacity(size_t size, unsigned* size_class)
+{
+  if (size <= (size_t) 1 << BUFFER_MIN_CAPACITY_LOG2)
+  {
+    *size_class = 0;
+    return (size_t) 1 << BUFFER_MIN_CAPACITY_LOG2;
+  }
+
+  if (size > SIZE_MAX / 2)
+    return 0;
+
+  // 2^k < size <= 2^(k+1), classes at 2^k + j * 2^(k-2) for j in [1, 4]
+  const unsigned k = 63 - (unsigned) __builtin_clzll(size - 1);
+  const size_t step = (size_t) 1 << (k - 2);
+  const size_t j = (size - ((size_t) 1 << k) + step - 1) / step;
+
+  *size_class = 1 + (k - BUFFER_MIN_CAPACITY_LOG2) * 4 + (unsigned) (j - 1);
+  return ((size_t) 1 << k) + j * step;
+}
+
+// mapping of map_size bytes (a multiple of BUFFER_HUGEPAGE_SIZE) aligned to BUFFER_HUGEPAGE_SIZE, so every 2 MiB
+// of it can be backed by a huge page. Called with the mutex held (hugetlb_failed)
+static void* buffer_map(size_t map_size, bool* huge)
+{
+  *huge = false;
+  if (buffers.huge_mode == BufferHugeTLB && !buffers.hugetlb_failed)
+  {
+    // 2 MiB pages explicitly, the default hugetlb page size may be 1 GiB
+    void* map = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+    if (map != MAP_FAILED)
+    {
+      *huge = true;
+      return map;
+    }
+
+    buffers.hugetlb_failed = true;
+  }
+
+  // over-allocate by one huge page and cut off the unaligned head and tail
+  uint8_t* map = mmap(NULL, map_size + BUFFER_HUGEPAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED)
+    return NULL;
+
+  const size_t head = (BUFFER_HUGEPAGE_SIZE - (uintptr_t) map % BUFFER_HUGEPAGE_SIZE) % BUFFER_HUGEPAGE_SIZE;
+  if (head)
+    munmap(map, head);
+  munmap(map + head + map_size, BUFFER_HUGEPAGE_SIZE - head);
+
+  map += head;
+  if (buffers.huge_mode != BufferHugeNever)
+    *huge = madvise(map, map_size, MADV_HUGEPAGE) == 0;
+  else
+    madvise(map, map_size, MADV_NOHUGEPAGE);
+
+  return map;
+}
+
+static BufferHeader* buffer_system_alloc(size_t capacity, unsigned size_class)
+{
+  BufferHeader* header;
+  const size_t size = capacity + sizeof(BufferHeader);
+
+  if (size >= BC_BUFFER_HUGEPAGE_THRESHOLD)
+  {
+    const size_t map_size = (size + BUFFER_HUGEPAGE_SIZE - 1) / BUFFER_HUGEPAGE_SIZE * BUFFER_HUGEPAGE_SIZE;
+    bool huge; // requested, see BCBufferStats
+    void* map = buffer_map(map_size, &huge);
+    if (!map)
+      return NULL;
+
+    header = map;
+    *header = (BufferHeader) { .capacity = capacity, .size_class = size_class, .mapped = true, .huge = huge,
+                               .base = map, .map_size = map_size };
+  }
+  else
+  {
+    void* base = aligned_alloc(BC_BUFFER_ALIGNMENT, size);
+    if (!base)
+      return NULL;
+
+    header = base;
+    *header = (BufferHeader) { .capacity = capacity, .size_class = size_class, .base = base };
+  }
+
+  ++buffers.stats.system;
+  buffers.stats.huge_requested += header->huge;
+  return header;
+}
+
+static void buffer_system_free(BufferHeader* header)
+{
+  if (header->mapped)
+    munmap(header->base, header->map_size);
+  else
+    free(header->base);
+}
+
+void* bc_buffer_alloc(size_t size)
+{
+  pthread_once(&buffers.once, &buffer_pool_init);
+
+  unsigned size_class;
+  const size_t capacity = buffer_class_capacity(size, &size_class);
+  if (!capacity)
+    return NULL;
+
+  pthread_mutex_lock(&buffers.mutex);
+
+  ++buffers.stats.allocations;
+  BufferHeader* header = buffers.free[size_class];
+  if (header)
+  {
+    buffers.free[size_class] = header->next;
+    buffers.pooled_bytes -= header->capacity;
+    ++buffers.stats.reused;
+  }
+  else
+    header = buffer_system_alloc(capacity, size_class);
+
+  pthread_mutex_unlock(&buffers.mutex);
+
+  return header ? header + 1 : NULL;
+}
+
+void bc_buffer_free(void* buffer)
+{
+  if (!buffer)
+    return;
+
+  BufferHeader* header = (BufferHeader*) buffer - 1;
+
+  pthread_mutex_lock(&buffers.mutex);
+
+  const bool pooled = buffers.pooled_bytes + header->capacity <= BC_BUFFER_POOL_MAX_BYTES;
+  if (pooled)
+  {
+    header->next = buffers.free[header->size_class];
+    buffers.free[header->size_class] = header;
+    buffers.pooled_bytes += header->capacity;
+  }
+
+  pthread_mutex_unlock(&buffers.mutex);
+
+  if (!pooled)
+    buffer_system_free(header);
+}
+
+void bc_buffer_pool_clear()
+{
+  pthread_mutex_lock(&buffers.mutex);
+
+  for (unsigned i = 0; i < BUFFER_CLASSES; ++i)
+  {
+    while (buffers.free[i])
+    {
+      BufferHeader* header = buffers.free[i];
+      buffers.free[i] = header->next;
+      buffer_system_free(header);
+    }
+  }
+
+  buffers.pooled_bytes = 0;
+
+  pthread_mutex_unlock(&buffers.mutex);
+}
+
+void bc_buffer_stats(BCBufferStats* stats)
+{
+  pthread_mutex_lock(&buffers.mutex);
+  *stats = buffers.stats;
+  stats->pooled_bytes = buffers.pooled_bytes;
+  pthread_mutex_unlock(&buffers.mutex);
+}
@@ -0,0 +1,141 @@
+#include "chunk_reader.h"
+
+#include <stdlib.h>
+
+static void* chunk_reader_thread(void* arg)
+{
+  BCChunkReader* reader = arg;
+  int error = 0;
+
+  for (size_t chunk = 0, from = 0; from < reader->pixel_count; ++chunk, from += reader->chunk_pixels)
+  {
+    const int slot = (int) (chunk & 1);
+    const size_t count = reader->pixel_count - from < reader->chunk_pixels ? reader->pixel_count - from
+                                                                         : reader->chunk_pixels;
+
+    pthread_mutex_lock(&reader->mutex);
+    while (reader->filled[slot] && !reader->stop)
+      pthread_cond_wait(&reader->cond, &reader->mutex);
+
+    const bool stop = reader->stop;
+    pthread_mutex_unlock(&reader->mutex);
+
+    if (stop)
+      return NULL;
+
+    // the buffer is owned by this thread until filled[slot] is set
+    if (fread(reader->buffer[slot], 3, count, reader->file) != count)
+    {
+      error = 1;
+      break;
+    }
+
+    pthread_mutex_lock(&reader->mutex);
+    reader->filled[slot] = count;
+    pthread_cond_broadcast(&reader->cond);
+    pthread_mutex_unlock(&reader->mutex);
+  }
+
+  // no data allowed behind the raster
+  if (!error && fgetc(reader->file) != EOF)
+    error = 1;
+
+  if (error)
+  {
+    pthread_mutex_lock(&reader->mutex);
+    reader->error = error;
+    pthread_cond_broadcast(&reader->cond);
+    pthread_mutex_unlock(&reader->mutex);
+  }
+
+  return NULL;
+}
+
+int bc_chunk_reader_start(BCChunkReader* reader, FILE* file, size_t pixel_count, size_t chunk_pixels)
+{
+  reader->file = file;
+  reader->pixel_count = pixel_count;
+  reader->chunk_pixels = chunk_pixels < pixel_count ? chunk_pixels : pixel_count;
+  reader->filled[0] = reader->filled[1] = 0;
+  reader->chunks_consumed = 0;
+  reader->chunk_held = false;
+  reader->error = 0;
+  reader->stop = false;
+
+  // chunk_pixels * 3 can't overflow, it's at most the size of the raster which was checked by the caller
+  reader->buffer[0] = malloc(reader->chunk_pixels * 3);
+  reader->buffer[1] = malloc(reader->chunk_pixels * 3);
+  if (!reader->buffer[0] || !reader->buffer[1])
+    goto ERROR;
+
+  pthread_mutex_init(&reader->mutex, NULL);
+  pthread_cond_init(&reader->cond, NULL);
+
+  if (pthread_create(&reader->thread, NULL, &chunk_reader_thread, reader))
+  {
+    pthread_cond_destroy(&reader->cond);
+    pthread_mutex_destroy(&reader->mutex);
+    goto ERROR;
+  }
+
+  return 0;
+
+ERROR:
+  free(reader->buffer[0]);
+  free(reader->buffer[1]);
+  return -1;
+}
+
+const uint8_t* bc_chunk_reader_next(BCChunkReader* reader, size_t* count)
+{
+  pthread_mutex_lock(&reader->mutex);
+
+  if (reader->chunk_held)
+  {
+    reader->filled[(reader->chunks_consumed - 1) & 1] = 0;
+    reader->chunk_held = false;
+    pthread_cond_broadcast(&reader->cond);
+  }
+
+  const size_t from = reader->chunks_consumed * reader->chunk_pixels;
+  const int slot = (int) (reader->chunks_consumed & 1);
+
+  if (from < reader->pixel_count)
+  {
+    while (!reader->filled[slot] && !reader->error)
+      pthread_cond_wait(&reader->cond, &reader->mutex);
+  }
+
+  const uint8_t* chunk = NULL;
+  if (from < reader->pixel_count && reader->filled[slot])
+  {
+    *count = reader->filled[slot];
+    chunk = reader->buffer[slot];
+
+    ++reader->chunks_consumed;
+    reader->chunk_held = true;
+  }
+
+  pthread_mutex_unlock(&reader->mutex);
+  return chunk;
+}
+
+int bc_chunk_reader_finish(BCChunkReader* reader)
+{
+  pthread_mutex_lock(&reader->mutex);
+  reader->stop = true;
+  pthread_cond_broadcast(&reader->cond);
+  pthread_mutex_unlock(&reader->mutex);
+
+  pthread_join(reader->thread, NULL);
+
+  pthread_cond_destroy(&reader->cond);
+  pthread_mutex_destroy(&reader->mutex);
+  free(reader->buffer[0]);
+  free(reader->buffer[1]);
+
+  if (reader->error || reader->chunks_consumed * reader->chunk_pixels < reader->pixel_count)
+    return 1;
+
+  return 0;
+}
@@ -0,0 +1,80 @@
+#include "cpu_features.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+const char* const bc_cpu_level_name[] =
+{
+  "sse4.1", // BCCpuSSE41
+  "avx2",   // BCCpuAVX2
+  "avx512", // BCCpuAVX512
+};
+
+static_assert((sizeof(bc_cpu_level_name) / sizeof(*bc_cpu_level_name)) == BCCpuMax, "CPU level declared in enum is missing in "
+                                                                                     "bc_cpu_level_name array");
+
+static bool level_initialized = false;
+static BCCpuLevel level_selected = BCCpuSSE41;
+
+BCCpuLevel bc_cpu_detect()
+{
+  // __builtin_cpu_supports also checks whether the OS saves the extended register state (XGETBV)
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl"))
+    return BCCpuAVX512;
+
+  if (__builtin_cpu_supports("avx2"))
+    return BCCpuAVX2;
+
+  return BCCpuSSE41;
+}
+
+BCCpuLevel bc_cpu_level()
+{
+  if (!level_initialized)
+  {
+    level_selected = bc_cpu_detect();
+    level_initialized = true;
+  }
+
+  return level_selected;
+}
+
+// byte granular permutes (vpermb/vpermi2b) on top of the AVX-512 level, e.g. Ice Lake and later, Zen 4
+bool bc_cpu_has_vbmi()
+{
+  return bc_cpu_level() >= BCCpuAVX512 && __builtin_cpu_supports("avx512vbmi");
+}
+
+// select a specific kernel variant, e.g. to compare them on the same machine.
+// levels not supported by this CPU are clamped to the best supported one, the selected level is returned.
+BCCpuLevel bc_cpu_set_level(BCCpuLevel level)
+{
+  const BCCpuLevel detected = bc_cpu_detect();
+
+  level_selected = level > detected ? detected : level;
+  level_initialized = true;
+  return level_selected;
+}
+
+int bc_cpu_parse_level(const char* str, BCCpuLevel* level)
+{
+  if (strcmp(str, "auto") == 0)
+  {
+    *level = bc_cpu_detect();
+    return 0;
+  }
+
+  for (int i = 0; i < BCCpuMax; ++i)
+  {
+    if (strcmp(str, bc_cpu_level_name[i]) == 0)
+    {
+      *level = (BCCpuLevel) i;
+      return 0;
+    }
+  }
+
+  return 1;
+}
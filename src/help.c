@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 
+#include "batch.h"
 #include "benchmark.h"
 #include "brightness_contrast.h"
 
@@ -11,10 +12,10 @@ void print_help()
     "Help Message\n"
     "Positional arguments:\n"
       "\t<input_file>\n"
-                "\t\tThe image to be processed (.ppm (P6), 24bpp)\n"
+                "\t\tThe image to be processed (.ppm (P6), 24bpp), - reads it from stdin\n"
     "Required arguments:\n"
       "\t-o <output_file>\n"
-                "\t\tOutput file\n"
+                "\t\tOutput file, - writes the image to stdout (messages go to stderr then)\n"
       "\t--brightness <brightness_value>\n"
                 "\t\tBrightness shift amount in [-255, 255] (integer)\n"
       "\t--contrast <contrast_value>\n"
@@ -24,31 +25,99 @@ void print_help()
                 "\t\tCoefficients of the grayscale conversion, where a, b and c are floating point values\n"
       "\t-V <version>\n"
                 "\t\tImplementation to be used. Available implementations:\n"
-        "\t\t0 .. Assembly SIMD (default)\n"
+        "\t\tauto .. Best implementation for this CPU (default)\n"
+        "\t\t0 .. Assembly SIMD\n"
         "\t\t1 .. C SIMD\n"
         "\t\t2 .. Assembly SISD\n"
         "\t\t3 .. C SISD\n"
         "\t\t4 .. C SISD Multithreaded\n"
         "\t\t5 .. C SISD using Heron's method to approximate square roots\n"
         "\t\t6 .. C SISD using square root approximation making use of the IEEE-754 representation\n"
+        "\t\t7 .. C SIMD using 256 bit registers (needs AVX2)\n"
+        "\t\t8 .. C SIMD using 512 bit registers (needs AVX-512)\n"
+        "\t\t9 .. C SIMD, mean and variance from a grayscale histogram (no separate variance pass)\n"
+        "\t\t10 .. C SIMD, mean and variance from a grayscale histogram, multithreaded\n"
+        "\t\t11 .. C SIMD, contrast applied via a 256 entry lookup table (pshufb/vpermi2b)\n"
+        "\t\t12 .. C SIMD Multithreaded, SIMD kernels on cache-sized row blocks\n"
+        "\t\t13 .. C SIMD, fixed point arithmetic on 16 bit lanes (pmaddubsw/pmulhrsw)\n"
+        "\t\t14 .. C SIMD, grayscale and sums on L2-sized tiles, contrast pass over the tiles in reverse order\n"
+      "\t--isa <sse4.1|avx2|avx512|auto>\n"
+                "\t\tInstruction set of the SIMD kernel variants. Default: auto (detected via CPUID at startup)\n"
+                "\t\tLevels not supported by this CPU fall back to the best supported one.\n"
+      "\t--nt-threshold <pixels|never>\n"
+                "\t\tImplementations 0 and 1 write the grayscale values of images with at least <pixels> pixels with\n"
+                "\t\tnon-temporal stores (movnti) and prefetch their input with prefetchnta. Default: never\n"
+  );
+
+  // one string per group of options, ISO C only guarantees string literals of 4095 characters
+  printf(
+      "\t--mmap\n"
+                "\t\tMemory map input and output file instead of reading/writing them via stdio (no copy of the input image)\n"
+      "\t--stream <band_rows>\n"
+                "\t\tProcess the image in bands of <band_rows> rows for images larger than memory (about 7 bytes per pixel\n"
+                "\t\tof one band are held in memory). Uses the SIMD stage kernels, -V is ignored.\n"
+      "\t--fused-read\n"
+                "\t\tConvert the image to grayscale chunk by chunk while it is read (reads overlap with the conversion on a\n"
+                "\t\thelper thread). Peak memory about 1 byte per pixel. Uses the SIMD stage kernels, -V is ignored.\n"
+      "\t--video\tThe input is a stream of concatenated P6 frames (ffmpeg -f image2pipe -c:v ppm), the output a stream of\n"
+                "\t\tP5 frames. The buffers are reused across frames, each frame is converted with its own statistics.\n"
+      "\t--temporal <alpha>\n"
+                "\t\tVideo mode: use mean and variance predicted from the previous frames (exponential smoothing,\n"
+                "\t\talpha in (0, 1], 1 reuses the previous frame's), grayscale and contrast run fused in one pass.\n"
+      "\t--sweep <brightness,...>:<contrast,...>\n"
+                "\t\tWrite one output per combination of the listed values, -o is the output directory\n"
+                "\t\t(<output_dir>/<input name>_b<brightness>_c<contrast>.pgm), can be given multiple times.\n"
+                "\t\t--brightness and --contrast are not needed. The image is read and converted to grayscale once,\n"
+                "\t\teach output is a single lookup table pass (bit-identical to the histogram implementations), -V is ignored.\n"
+      "\t--batch [<input_files> ...]\n"
+                "\t\tProcess many images in a pipeline of reader, kernel and writer threads, -o is the output directory\n"
+                "\t\t(<output_dir>/<input name>.pgm). Without input files the list is read from the manifest or stdin.\n"
+      "\t--manifest <file>\n"
+                "\t\tBatch mode with the input files listed in <file>, one per line (- .. stdin)\n"
+      "\t--batch-threads <readers,kernels,writers>\n"
+                "\t\tThreads per pipeline stage in batch mode. Default: %u,<number of cores>,%u\n",
+      bc_default_batch_readers,
+      bc_default_batch_writers
+  );
+
+  printf(
       "\t-B[<runs>]\n"
-                "\t\tPerform benchmark test. If <runs> is given: measure average over <runs> runs. Default: %u runs\n"
+                "\t\tPerform benchmark test. If <runs> is given: time <runs> runs individually. Default: %u runs\n"
+                "\t\tReports min, median, p90, p99, standard deviation and average of the per-run times\n"
+                "\t\tand the throughput of the median run in MP/s and GB/s.\n"
+      "\t--warmup <runs>\n"
+                "\t\tUntimed runs before the timed ones of each benchmark. Default: %u runs\n"
+      "\t--pin <cpu>\n"
+                "\t\tPin the single-threaded benchmarks to CPU <cpu> (the multithreaded ones run unpinned)\n"
+      "\t--json\tAdditionally write the benchmark results to %s\n"
+      "\t--perf\tCount cycles, instructions, LLC misses, branch misses and FP/vector instructions of the timed runs\n"
+                "\t\t(perf_event_open), counters not allowed by the kernel are reported as n/a\n"
+      "\t--trace[=<file>]\n"
+                "\t\tTime the stages of the implementation per thread (grayscale, histogram, stats, contrast) and print a\n"
+                "\t\tsummary, with -B only the timed runs. With <file> the events are written as Chrome trace JSON.\n"
+                "\t\tNot with --csv, --test, --batch, --stream or --fused-read.\n"
+      "\t--roofline\n"
+                "\t\tCalibrate read/write/copy bandwidth (STREAM) and scalar/SIMD peak FLOP/s, single-threaded and on all\n"
+                "\t\tcores, and report the GB/s of the implementations as percentage of min(bandwidth, peak / intensity)\n"
+      "\t--cold\tFlush input and result image from the caches before every timed run (default: warm caches)\n"
       "\t--csv\tBenchmark all implementations (impl. given via -V is ignored) and write result to CSV file\n"
-                "\t\tEach implementation is benchmarked %u times with an increasing image size, each time over a given number of runs\n"
+                "\t\tThe input image is resampled to sizes from a 16 KiB working set (4 bytes per pixel) up to the input size,\n"
+                "\t\tgrowing by a factor of sqrt(2), each size is benchmarked over a given number of runs\n"
                 "\t\t(can be specified via -B, else the default setting is used).\n"
-      "\t\tThe result of %s is written to the output file.\n"
-      "\t\tNumber of pixels starts with (input image size / 2^6) and is doubled on each benchmark.\n"
+      "\t\tImplementations not supported by this CPU are skipped. The result of the last benchmarked implementation is written to the output file.\n"
+      "\t\tEach size is labeled with the smallest cache level holding its working set, MP/s and GB/s are based on the median.\n"
       "\t--test\tRun tests of all implementations (either tests or benchmark can be executed, not both).\n"
                "\t\tTests are run with a maximum allowed delta of 1.\n"
                "\t\tThe idea of this delta is to counteract the floating point errors due to possible different order of calculations in different implementations.\n"
                "\t\tThe result of the default implementation is written to the output file.\n"
-      "\t--sqrt\tTest and benchmark all square root implementations. Benchmark result is written to %s.\n"
+      "\t--sqrt\tTest and benchmark all square root implementations, scalar and array (C and asm). Reports throughput\n"
+               "\t\ton random arrays, latency of dependent calls and max. relative error. Benchmark result is written to %s.\n"
                "\t\tNo brightness/contrast-implementation is executed.\n"
       "\t-h, --help\n"
                 "\t\tPrint help\n",
       bc_default_benchmark_runs,
-      benchmark_iterations_per_implementation,
-      bc_implementation[BCImplMax - 1].name,
+      bc_default_benchmark_warmup,
+      benchmark_json_out_file,
       benchmark_csv_out_file
     );
 }
@@ -58,8 +127,16 @@ void print_usage_err()
   fprintf(stderr, "Usage: ./BrightnessAndContrast.out <input_file> -o <output_file> "
                   "--brightness <brightness_value> --contrast <contrast_value> "
                   "[-V <implementation>] "
+                  "[--isa <level>] "
+                  "[--nt-threshold <pixels|never>] "
+                  "[--mmap] "
+                  "[--stream <band_rows>] "
+                  "[--fused-read] "
+                  "[--video] [--temporal <alpha>] "
+                  "[--sweep <b,...>:<c,...>] "
+                  "[--batch] [--manifest <file>] [--batch-threads <r,k,w>] "
                   "[--coeffs <a,b,c>] "
-                  "[-B[<runs>]] "
+                  "[-B[<runs>]] [--warmup <runs>] [--pin <cpu>] [--json] [--cold] [--perf] [--roofline] [--trace[=<file>]] "
                   "[--csv] "
                   "[--test] "
                   "[--sqrt] "
@@ -1,13 +1,26 @@
+#define _GNU_SOURCE // F_SETPIPE_SZ
 #include "image_io.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
+#include "buffer_pool.h"
 #include "input_parser.h"
 
+#define RESULT_HEADER_FORMAT "P5\n%lu %lu\n255\n"
+
+// pipe buffer for stdin/stdout (default 64 KiB), fewer wakeups of both ends. Capped by /proc/sys/fs/pipe-max-size
+#define PIPE_BUFFER_SIZE (1 << 20)
+
+int read_header(FILE* input_file, size_t* width, size_t* height);
 int check_input_format(FILE* input_file);
 int read_whitespaces(FILE* input_file);
 int read_until_next_whitespace(FILE* input_file, char* str, size_t n);
@@ -16,13 +29,168 @@ int check_max_c_val(FILE* input_file);
 int read_pixels_and_write_to_src(FILE* input_file, size_t width, size_t height, uint8_t** source_image);
 int read_comment(FILE* input_file);
 
-static const char* prog_name;
+// thread local, the batch mode reads and writes images on several threads
+static _Thread_local const char* prog_name;
+
+// descriptor the result image is written to for "-o -", see claim_stdout_for_image
+static int stdout_image_fd = STDOUT_FILENO;
+
+// NULL (e.g. no -o with --sqrt) is no stdio file
+bool is_stdio_file_name(const char* file_name)
+{
+  return file_name && strcmp(file_name, "-") == 0;
+}
+
+// best effort, a failure only costs some context switches
+static void enlarge_pipe(int fd)
+{
+  struct stat fd_stat;
+  if (fstat(fd, &fd_stat) == 0 && S_ISFIFO(fd_stat.st_mode))
+    fcntl(fd, F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
+}
+
+/*
+ * With "-o -" the image has to be the only thing written to stdout. The image stream gets its own descriptor and
+ * stdout is pointed to stderr, so the messages of all modes end up on stderr.
+ */
+int claim_stdout_for_image(const char* program_name)
+{
+  fflush(stdout);
+
+  const int fd = dup(STDOUT_FILENO);
+  if (fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+  {
+    fprintf(stderr, "%s: Failed to redirect stdout: %s\n", program_name, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+
+    return -1;
+  }
+
+  stdout_image_fd = fd;
+  enlarge_pipe(fd);
+  return 0;
+}
+
+// write(2) straight from the image buffer, no copy into a stdio buffer
+static int write_all(int fd, const uint8_t* data, size_t size)
+{
+  while (size > 0)
+  {
+    const ssize_t written = write(fd, data, size);
+    if (written < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      return -1;
+    }
+
+    data += written;
+    size -= (size_t) written;
+  }
+
+  return 0;
+}
+
+// header and raster of one image, e.g. to stdout or as a frame of a video
+int write_result_frame(int fd, const uint8_t* res_image, const size_t width, const size_t height,
+                       const char* program_name)
+{
+  char header[64];
+  const int header_size = snprintf(header, sizeof(header), RESULT_HEADER_FORMAT, width, height);
+
+  if (header_size < 0 || (size_t) header_size >= sizeof(header) ||
+      write_all(fd, (const uint8_t*) header, (size_t) header_size) ||
+      write_all(fd, res_image, width * height))
+  {
+    fprintf(stderr, "%s: Failed to write to output file: %s\n", program_name, strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+// output of a sequence of images written via write_result_frame, the image descriptor of stdout for "-"
+int open_result_stream(const char* output_file_name, const char* program_name)
+{
+  if (is_stdio_file_name(output_file_name))
+    return stdout_image_fd;
+
+  const int fd = open(output_file_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0)
+    fprintf(stderr, "%s: Failed to open output file: %s\n", program_name, output_file_name);
+
+  return fd;
+}
+
+int close_result_stream(int fd, const char* program_name)
+{
+  if (fd == stdout_image_fd)
+    return 0;
+
+  if (close(fd))
+  {
+    fprintf(stderr, "%s: Failed to write to output file: %s\n", program_name, strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Header of the next image in a stream of concatenated images (e.g. ffmpeg -f image2pipe -c:v ppm),
+ * end is set if the stream ended cleanly before it.
+ */
+int read_frame_header(FILE* input_file, size_t* width, size_t* height, bool* end, const char* program_name)
+{
+  prog_name = program_name;
+
+  const int c = getc(input_file);
+  *end = c == EOF;
+  if (*end)
+  {
+    if (!ferror(input_file))
+      return 0;
+
+    fprintf(stderr, "%s: Error reading input file\n", prog_name);
+    return -1;
+  }
+
+  ungetc(c, input_file);
+  return read_header(input_file, width, height);
+}
+
+// raster of one image of a stream, unlike read_source_image more data may follow
+int read_frame_pixels(FILE* input_file, uint8_t* frame, size_t width, size_t height, const char* program_name)
+{
+  if (fread(frame, 3, width * height, input_file) != width * height)
+  {
+    fprintf(stderr, "%s: Pixel count didn't match width * height\n", program_name);
+    return 1;
+  }
+
+  return 0;
+}
+
+// stdin for "-", which doesn't get any seeks (see read_whitespaces)
+static FILE* open_input(const char* input_file_name)
+{
+  if (!is_stdio_file_name(input_file_name))
+    return fopen(input_file_name, "r");
+
+  enlarge_pipe(STDIN_FILENO);
+  return stdin;
+}
 
 int write_to_res_img(const char* output_file_name, const uint8_t* res_image, const size_t width, const size_t height,
                      const char* program_name)
 {
   prog_name = program_name;
 
+  if (is_stdio_file_name(output_file_name))
+    return write_result_frame(stdout_image_fd, res_image, width, height, program_name);
+
   FILE* output_file = fopen(output_file_name, "w+");
   if (!output_file)
   {
@@ -32,7 +200,7 @@ int write_to_res_img(const char* output_file_name, const uint8_t* res_image, con
 
   int ret = 0;
 
-  if (fprintf(output_file, "P5\n%lu %lu\n255\n", width, height) < 0)
+  if (fprintf(output_file, RESULT_HEADER_FORMAT, width, height) < 0)
   {
     fprintf(stderr, "%s: Failed to write to output file: %s\n", prog_name, output_file_name);
     ret = -1;
@@ -56,7 +224,7 @@ int read_source_image(const char* input_file_name, uint8_t** source_image, size_
 {
   prog_name = program_name;
 
-  FILE* input_file = fopen(input_file_name, "r");
+  FILE* input_file = open_input(input_file_name);
 
   if (!input_file)
   {
@@ -64,6 +232,234 @@ int read_source_image(const char* input_file_name, uint8_t** source_image, size_
     return -1;
   }
 
+  int ret;
+
+  if ((ret = read_header(input_file, width, height)))
+    goto END;
+
+  //alloc source pointer
+  if ((ret = alloc_image_pointer(source_image, *width, *height, 3)))
+    goto END;
+
+  //process pixels
+  if ((ret = read_pixels_and_write_to_src(input_file, *width, *height, source_image)))
+    goto END;
+
+END:
+  if (input_file != stdin)
+    fclose(input_file);
+
+  return ret;
+}
+
+// opens the input file (stdin for "-") and parses the header, the file is positioned at the start of the raster afterwards
+int open_source_image(const char* input_file_name, FILE** input_file, size_t* width, size_t* height,
+                      const char* program_name)
+{
+  prog_name = program_name;
+
+  *input_file = open_input(input_file_name);
+  if (!*input_file)
+  {
+    fprintf(stderr, "%s: Error opening input file: %s\n", prog_name, input_file_name);
+    return -1;
+  }
+
+  const int ret = read_header(*input_file, width, height);
+  if (ret)
+  {
+    fclose(*input_file);
+    *input_file = NULL;
+  }
+
+  return ret;
+}
+
+// creates the output file (opened for reading and writing) and writes the header, raster_offset is the position behind it
+int open_result_image(const char* output_file_name, FILE** output_file, size_t width, size_t height, long* raster_offset,
+                      const char* program_name)
+{
+  prog_name = program_name;
+
+  *output_file = fopen(output_file_name, "w+");
+  if (!*output_file)
+  {
+    fprintf(stderr, "%s: Failed to open output file: %s\n", prog_name, output_file_name);
+    return 1;
+  }
+
+  if (fprintf(*output_file, RESULT_HEADER_FORMAT, width, height) < 0 || (*raster_offset = ftell(*output_file)) < 0)
+  {
+    fprintf(stderr, "%s: Failed to write to output file: %s\n", prog_name, output_file_name);
+    fclose(*output_file);
+    *output_file = NULL;
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Maps the whole input file instead of copying the raster into a malloc'd buffer, the kernels read the pixels directly
+ * from the page cache. The header is parsed via fmemopen on the mapping, so the same parser as for read_source_image is used.
+ */
+int map_source_image(const char* input_file_name, BCMappedImage* image, const char* program_name)
+{
+  prog_name = program_name;
+
+  const int fd = open(input_file_name, O_RDONLY);
+  if (fd < 0)
+  {
+    fprintf(stderr, "%s: Error opening input file: %s\n", prog_name, input_file_name);
+    return -1;
+  }
+
+  int ret = 0;
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat))
+  {
+    fprintf(stderr, "%s: Error opening input file: %s\n", prog_name, input_file_name);
+    ret = -1;
+    goto END;
+  }
+
+  if (file_stat.st_size == 0)
+  {
+    fprintf(stderr, "%s: Unexpected EOF\n", prog_name);
+    ret = 1;
+    goto END;
+  }
+
+  image->map_size = (size_t) file_stat.st_size;
+  image->map = mmap(NULL, image->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (image->map == MAP_FAILED)
+  {
+    fprintf(stderr, "%s: Failed to map input file: %s\n", prog_name, input_file_name);
+    image->map = NULL;
+    ret = -1;
+    goto END;
+  }
+
+  // every implementation walks the raster front to back => aggressive read-ahead, pages can be dropped early
+  madvise(image->map, image->map_size, MADV_SEQUENTIAL);
+
+  FILE* header = fmemopen(image->map, image->map_size, "r");
+  if (!header)
+  {
+    fprintf(stderr, "%s: Not enough memory\n", prog_name);
+    ret = -1;
+    goto END;
+  }
+
+  ret = read_header(header, &image->width, &image->height);
+  const long raster_offset = ftell(header);
+  fclose(header);
+
+  if (ret)
+    goto END;
+
+  const size_t raster_size = image->width * image->height * 3;
+  if (raster_size / 3 / image->width / image->height != 1)
+  {
+    fprintf(stderr, "%s: Image too large\n", prog_name);
+    ret = 1;
+    goto END;
+  }
+
+  if (raster_offset < 0 || image->map_size - (size_t) raster_offset != raster_size)
+  {
+    fprintf(stderr, "%s: Pixel count didn't match width * height\n", prog_name);
+    ret = 1;
+    goto END;
+  }
+
+  image->pixels = (uint8_t*) image->map + raster_offset;
+
+END:
+  close(fd);
+  return ret;
+}
+
+/*
+ * Creates the output file with its final size (ftruncate) and maps it, the header is written immediately.
+ * The implementations write their result directly into image->pixels, which ends up in the file on unmap_image.
+ */
+int map_result_image(const char* output_file_name, BCMappedImage* image, size_t width, size_t height,
+                     const char* program_name)
+{
+  prog_name = program_name;
+
+  char header[64];
+  const int header_size = snprintf(header, sizeof(header), RESULT_HEADER_FORMAT, width, height);
+  if (header_size < 0 || (size_t) header_size >= sizeof(header))
+  {
+    fprintf(stderr, "%s: Failed to write to output file: %s\n", prog_name, output_file_name);
+    return -1;
+  }
+
+  const size_t raster_size = width * height;
+  if (raster_size / width / height != 1 || raster_size > SIZE_MAX - (size_t) header_size)
+  {
+    fprintf(stderr, "%s: Image too large\n", prog_name);
+    return 1;
+  }
+
+  const int fd = open(output_file_name, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0)
+  {
+    fprintf(stderr, "%s: Failed to open output file: %s\n", prog_name, output_file_name);
+    return 1;
+  }
+
+  int ret = 0;
+
+  image->map_size = (size_t) header_size + raster_size;
+  if (ftruncate(fd, (off_t) image->map_size))
+  {
+    fprintf(stderr, "%s: Failed to write to output file: %s\n", prog_name, output_file_name);
+    ret = -1;
+    goto END;
+  }
+
+  // PROT_READ as well, the sigma and contrast passes read the grayscale values back
+  image->map = mmap(NULL, image->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (image->map == MAP_FAILED)
+  {
+    fprintf(stderr, "%s: Failed to map output file: %s\n", prog_name, output_file_name);
+    image->map = NULL;
+    ret = -1;
+    goto END;
+  }
+
+  madvise(image->map, image->map_size, MADV_SEQUENTIAL);
+
+  memcpy(image->map, header, (size_t) header_size);
+  image->pixels = (uint8_t*) image->map + header_size;
+  image->width = width;
+  image->height = height;
+
+END:
+  close(fd); // the mapping keeps the file referenced
+  return ret;
+}
+
+int unmap_image(BCMappedImage* image, const char* program_name)
+{
+  if (!image->map)
+    return 0;
+
+  const int ret = munmap(image->map, image->map_size);
+  if (ret)
+    fprintf(stderr, "%s: Failed to unmap image\n", program_name);
+
+  image->map = NULL;
+  image->pixels = NULL;
+  return ret;
+}
+
+int read_header(FILE* input_file, size_t* width, size_t* height)
+{
   /*
    * PPM-Format-Specification
    * wanted format: ppm
@@ -84,40 +480,39 @@ int read_source_image(const char* input_file_name, uint8_t** source_image, size_
    *    MSB first
   */
 
-  //global vars needed
   int ret;
 
   //check if first lines are comments
   if ((ret = read_whitespaces(input_file)))
-    goto END;
+    return ret;
 
   //Check for right input format
   if ((ret = check_input_format(input_file)))
-    goto END;
+    return ret;
 
   //check for whitespaces
   if ((ret = read_whitespaces(input_file)))
-    goto END;
+    return ret;
 
   //check for and read correct width
   if ((ret = read_size_t(input_file, width)))
-    goto END;
+    return ret;
 
   //check for whitespaces
   if ((ret = read_whitespaces(input_file)))
-    goto END;
+    return ret;
 
   //check for and read correct height
   if ((ret = read_size_t(input_file, height)))
-    goto END;
+    return ret;
 
   //check for whitespaces
   if ((ret = read_whitespaces(input_file)))
-    goto END;
+    return ret;
 
   //check for max color value
   if ((ret = check_max_c_val(input_file)))
-    goto END;
+    return ret;
 
   // no more whitespaces allowed after max. color value; single whitespace is checked already
 
@@ -127,17 +522,7 @@ int read_source_image(const char* input_file_name, uint8_t** source_image, size_
     return 1;
   }
 
-  //alloc source pointer
-  if ((ret = alloc_image_pointer(source_image, *width, *height, 3)))
-    goto END;
-
-  //process pixels
-  if ((ret = read_pixels_and_write_to_src(input_file, *width, *height, source_image)))
-    goto END;
-
-END:
-  fclose(input_file);
-  return ret;
+  return 0;
 }
 
 int check_input_format(FILE* input_file)
@@ -155,14 +540,15 @@ int check_input_format(FILE* input_file)
   return 0;
 }
 
+// the first non-whitespace char is pushed back via ungetc instead of seeking back, so pipes work as well
 int read_whitespaces(FILE* input_file)
 {
-  char c = ' ';
+  int c = ' ';
 
   while (isspace(c))
   {
-    const size_t length = fread(&c, 1, 1, input_file);
-    if (length != 1)
+    c = getc(input_file);
+    if (c == EOF)
     {
       fprintf(stderr, "%s: Unexpected EOF\n", prog_name);
       return 1;
@@ -177,7 +563,7 @@ int read_whitespaces(FILE* input_file)
     }
   }
 
-  fseek(input_file, -1, SEEK_CUR);
+  ungetc(c, input_file);
   return 0;
 }
 
@@ -261,7 +647,7 @@ int alloc_image_pointer(uint8_t** image, const size_t width, const size_t height
     return 1;
   }
 
-  *image = malloc(size);
+  *image = bc_buffer_alloc(size);
   if (!*image)
   {
     fprintf(stderr, "%s: Not enough memory\n", prog_name);
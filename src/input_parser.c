@@ -8,28 +8,71 @@
 #include <string.h>
 #include <stdbool.h>
 
+#include "image_io.h"
+
 #define INVALID_PARAM_MSG "%s: Parameter for option '-%c' invalid: %s\n"
 #define INVALID_PARAM_MSG_LONG "%s: Parameter for option '--%s' invalid: %s\n"
 
-#define OPT_LONG_OFFSET ('z' + 1)
-#define OPT_COEFFS      (OPT_LONG_OFFSET)
-#define OPT_BRIGHTNESS  (OPT_LONG_OFFSET + 1)
-#define OPT_CONTRAST    (OPT_LONG_OFFSET + 2)
-#define OPT_CSV         (OPT_LONG_OFFSET + 3)
-#define OPT_TEST        (OPT_LONG_OFFSET + 4)
-#define OPT_SQRT        (OPT_LONG_OFFSET + 5)
+// values per list of one --sweep
+#define SWEEP_MAX_VALUES 256
+
+#define OPT_LONG_OFFSET   ('z' + 1)
+#define OPT_COEFFS        (OPT_LONG_OFFSET)
+#define OPT_BRIGHTNESS    (OPT_LONG_OFFSET + 1)
+#define OPT_CONTRAST      (OPT_LONG_OFFSET + 2)
+#define OPT_CSV           (OPT_LONG_OFFSET + 3)
+#define OPT_TEST          (OPT_LONG_OFFSET + 4)
+#define OPT_SQRT          (OPT_LONG_OFFSET + 5)
+#define OPT_ISA           (OPT_LONG_OFFSET + 6)
+#define OPT_MMAP          (OPT_LONG_OFFSET + 7)
+#define OPT_STREAM        (OPT_LONG_OFFSET + 8)
+#define OPT_FUSED_READ    (OPT_LONG_OFFSET + 9)
+#define OPT_BATCH         (OPT_LONG_OFFSET + 10)
+#define OPT_MANIFEST      (OPT_LONG_OFFSET + 11)
+#define OPT_BATCH_THREADS (OPT_LONG_OFFSET + 12)
+#define OPT_WARMUP        (OPT_LONG_OFFSET + 13)
+#define OPT_PIN           (OPT_LONG_OFFSET + 14)
+#define OPT_JSON          (OPT_LONG_OFFSET + 15)
+#define OPT_COLD          (OPT_LONG_OFFSET + 16)
+#define OPT_PERF          (OPT_LONG_OFFSET + 17)
+#define OPT_TRACE         (OPT_LONG_OFFSET + 18)
+#define OPT_ROOFLINE      (OPT_LONG_OFFSET + 19)
+#define OPT_VIDEO         (OPT_LONG_OFFSET + 20)
+#define OPT_TEMPORAL      (OPT_LONG_OFFSET + 21)
+#define OPT_SWEEP         (OPT_LONG_OFFSET + 22)
+#define OPT_NT_THRESHOLD  (OPT_LONG_OFFSET + 23)
 
 int parse_coefficients(const char* exec_name, char* str, BCInput* input);
+int parse_batch_threads(const char* exec_name, char* str, BCInput* input);
+int parse_sweep(const char* exec_name, char* str, BCInput* input);
 
 static struct option options[] =
 {
-  {"coeffs",     required_argument, NULL, OPT_COEFFS},
-  {"brightness", required_argument, NULL, OPT_BRIGHTNESS},
-  {"contrast",   required_argument, NULL, OPT_CONTRAST},
-  {"csv",        no_argument,       NULL, OPT_CSV},
-  {"test",       no_argument,       NULL, OPT_TEST},
-  {"sqrt",       no_argument,       NULL, OPT_SQRT},
-  {"help",       no_argument,       NULL, 'h'},
+  {"coeffs",        required_argument, NULL, OPT_COEFFS},
+  {"brightness",    required_argument, NULL, OPT_BRIGHTNESS},
+  {"contrast",      required_argument, NULL, OPT_CONTRAST},
+  {"csv",           no_argument,       NULL, OPT_CSV},
+  {"test",          no_argument,       NULL, OPT_TEST},
+  {"sqrt",          no_argument,       NULL, OPT_SQRT},
+  {"isa",           required_argument, NULL, OPT_ISA},
+  {"mmap",          no_argument,       NULL, OPT_MMAP},
+  {"stream",        required_argument, NULL, OPT_STREAM},
+  {"fused-read",    no_argument,       NULL, OPT_FUSED_READ},
+  {"batch",         no_argument,       NULL, OPT_BATCH},
+  {"manifest",      required_argument, NULL, OPT_MANIFEST},
+  {"batch-threads", required_argument, NULL, OPT_BATCH_THREADS},
+  {"warmup",        required_argument, NULL, OPT_WARMUP},
+  {"pin",           required_argument, NULL, OPT_PIN},
+  {"json",          no_argument,       NULL, OPT_JSON},
+  {"cold",          no_argument,       NULL, OPT_COLD},
+  {"perf",          no_argument,       NULL, OPT_PERF},
+  {"trace",         optional_argument, NULL, OPT_TRACE},
+  {"roofline",      no_argument,       NULL, OPT_ROOFLINE},
+  {"video",         no_argument,       NULL, OPT_VIDEO},
+  {"temporal",      required_argument, NULL, OPT_TEMPORAL},
+  {"sweep",         required_argument, NULL, OPT_SWEEP},
+  {"nt-threshold",  required_argument, NULL, OPT_NT_THRESHOLD},
+  {"help",          no_argument,       NULL, 'h'},
   {0, 0, 0, 0}
 };
 
@@ -38,6 +81,7 @@ int parse_input(const int argc, char **argv, BCInput *input)
   bool brightness_set = false;
   bool contrast_set = false;
   bool benchmark_runs_set = false;
+  bool benchmark_options_set = false;
 
   while (true)
   {
@@ -129,10 +173,210 @@ int parse_input(const int argc, char **argv, BCInput *input)
         return 0;
       }
 
+      case OPT_ISA:
+      {
+        if (bc_cpu_parse_level(optarg, &input->cpu_level))
+        {
+          fprintf(stderr, INVALID_PARAM_MSG_LONG, argv[0], options[OPT_ISA - OPT_LONG_OFFSET].name, optarg);
+          print_usage_err();
+          return 1;
+        }
+
+        break;
+      }
+
+      case OPT_NT_THRESHOLD:
+      {
+        if (strcmp(optarg, "never") == 0)
+          input->streaming_threshold = BC_STREAMING_NEVER;
+        else if (parse_size_t(optarg, &input->streaming_threshold) || input->streaming_threshold > BC_STREAMING_NEVER)
+        {
+          fprintf(stderr, INVALID_PARAM_MSG_LONG, argv[0], options[OPT_NT_THRESHOLD - OPT_LONG_OFFSET].name, optarg);
+          print_usage_err();
+          return 1;
+        }
+
+        break;
+      }
+
+      case OPT_MMAP:
+      {
+        input->use_mmap = true;
+        break;
+      }
+
+      case OPT_STREAM:
+      {
+        if (parse_size_t(optarg, &input->stream_band_rows) || input->stream_band_rows == 0)
+        {
+          fprintf(stderr, INVALID_PARAM_MSG_LONG, argv[0], options[OPT_STREAM - OPT_LONG_OFFSET].name, optarg);
+          print_usage_err();
+          return 1;
+        }
+
+        break;
+      }
+
+      case OPT_FUSED_READ:
+      {
+        input->fused_read = true;
+        break;
+      }
+
+      case OPT_VIDEO:
+      {
+        input->video = true;
+        break;
+      }
+
+      case OPT_TEMPORAL:
+      {
+        if (parse_float(optarg, &input->video_alpha) || !(input->video_alpha > 0.0f && input->video_alpha <= 1.0f))
+        {
+          fprintf(stderr, INVALID_PARAM_MSG_LONG, argv[0], options[OPT_TEMPORAL - OPT_LONG_OFFSET].name, optarg);
+          print_usage_err();
+          return 1;
+        }
+
+        break;
+      }
+
+      case OPT_SWEEP:
+      {
+        const int ret = parse_sweep(argv[0], optarg, input);
+        if (ret == 1)
+          print_usage_err();
+
+        if (ret)
+          return ret;
+
+        break;
+      }
+
+      case OPT_BATCH:
+      {
+        input->batch = true;
+        break;
+      }
+
+      case OPT_MANIFEST:
+      {
+        const size_t len = strlen(optarg) + 1;
+        free(input->batch_manifest);
+        input->batch_manifest = malloc(len);
+        if (!input->batch_manifest)
+        {
+          fprintf(stderr, "%s: Out of memory\n", argv[0]);
+          return -1;
+        }
+
+        strncpy(input->batch_manifest, optarg, len);
+        input->batch = true;
+        break;
+      }
+
+      case OPT_BATCH_THREADS:
+      {
+        if (parse_batch_threads(argv[0], optarg, input))
+        {
+          print_usage_err();
+          return 1;
+        }
+
+        break;
+      }
+
+      case OPT_WARMUP:
+      {
+        if (parse_uint32(optarg, &input->benchmark_warmup))
+        {
+          fprintf(stderr, INVALID_PARAM_MSG_LONG, argv[0], options[OPT_WARMUP - OPT_LONG_OFFSET].name, optarg);
+          print_usage_err();
+          return 1;
+        }
+
+        benchmark_options_set = true;
+        break;
+      }
+
+      case OPT_PIN:
+      {
+        uint16_t cpu;
+        if (parse_uint16(optarg, &cpu))
+        {
+          fprintf(stderr, INVALID_PARAM_MSG_LONG, argv[0], options[OPT_PIN - OPT_LONG_OFFSET].name, optarg);
+          print_usage_err();
+          return 1;
+        }
+
+        input->benchmark_pin_cpu = cpu;
+        benchmark_options_set = true;
+        break;
+      }
+
+      case OPT_JSON:
+      {
+        input->benchmark_json = true;
+        benchmark_options_set = true;
+        break;
+      }
+
+      case OPT_COLD:
+      {
+        input->benchmark_cold = true;
+        benchmark_options_set = true;
+        break;
+      }
+
+      case OPT_PERF:
+      {
+        input->benchmark_perf = true;
+        benchmark_options_set = true;
+        break;
+      }
+
+      case OPT_ROOFLINE:
+      {
+        input->benchmark_roofline = true;
+        benchmark_options_set = true;
+        break;
+      }
+
+      case OPT_TRACE:
+      {
+#ifdef BC_NO_TRACE
+        fprintf(stderr, "%s: Option '--%s' not available, tracing was compiled out (BC_NO_TRACE)\n", argv[0],
+                options[OPT_TRACE - OPT_LONG_OFFSET].name);
+        return 1;
+#else
+        input->trace = true;
+        if (!optarg)
+          break;
+
+        const size_t len = strlen(optarg) + 1;
+        free(input->trace_file);
+        input->trace_file = malloc(len);
+        if (!input->trace_file)
+        {
+          fprintf(stderr, "%s: Out of memory\n", argv[0]);
+          return -1;
+        }
+
+        strncpy(input->trace_file, optarg, len);
+        break;
+#endif
+      }
+
       case 'V':
       {
         uint16_t version;
 
+        if (strcmp(optarg, "auto") == 0)
+        {
+          input->impl_auto = true;
+          break;
+        }
+
         if (parse_uint16(optarg, &version) || version >= BCImplMax)
         {
           fprintf(stderr, INVALID_PARAM_MSG, argv[0], c, optarg);
@@ -141,6 +385,7 @@ int parse_input(const int argc, char **argv, BCInput *input)
         }
 
         input->impl = (BCImplVersion) version;
+        input->impl_auto = false;
 
         break;
       }
@@ -211,7 +456,19 @@ int parse_input(const int argc, char **argv, BCInput *input)
     }
   }
 
-  if (optind == argc - 1)
+  if (input->batch)
+  {
+    if (optind < argc && input->batch_manifest)
+    {
+      fprintf(stderr, "%s: Either input files or a manifest can be given in batch mode\n", argv[0]);
+      print_usage_err();
+      return 1;
+    }
+
+    input->batch_files = &argv[optind];
+    input->batch_file_count = (size_t) (argc - optind);
+  }
+  else if (optind == argc - 1)
   {
     const size_t len = strlen(argv[optind]) + 1;
     input->input_file = malloc(len);
@@ -237,14 +494,14 @@ int parse_input(const int argc, char **argv, BCInput *input)
     return 1;
   }
 
-  if (!brightness_set)
+  if (!brightness_set && !input->sweep_count)
   {
     fprintf(stderr, "%s: Brightness not specified\n", argv[0]);
     print_usage_err();
     return 1;
   }
 
-  if (!contrast_set)
+  if (!contrast_set && !input->sweep_count)
   {
     fprintf(stderr, "%s: Contrast not specified\n", argv[0]);
     print_usage_err();
@@ -254,6 +511,13 @@ int parse_input(const int argc, char **argv, BCInput *input)
   if (input->benchmark_csv && !benchmark_runs_set)
     input->benchmark_runs = bc_default_benchmark_runs;
 
+  if (benchmark_options_set && input->benchmark_runs == 0)
+  {
+    fprintf(stderr, "%s: Invalid combination of arguments - --warmup, --pin, --json, --cold, --perf and --roofline need a benchmark (-B or --csv).\n", argv[0]);
+    print_usage_err();
+    return 1;
+  }
+
   if (input->benchmark_runs > 0 && input->run_tests)
   {
     fprintf(stderr, "%s: Invalid combination of arguments - Tests and benchmark together cannot be executed.\n", argv[0]);
@@ -261,6 +525,75 @@ int parse_input(const int argc, char **argv, BCInput *input)
     return 1;
   }
 
+  if (input->stream_band_rows > 0 && (input->benchmark_runs > 0 || input->run_tests || input->use_mmap || input->fused_read))
+  {
+    fprintf(stderr, "%s: Invalid combination of arguments - Streaming mode cannot be combined with tests, benchmarks, --mmap or --fused-read.\n", argv[0]);
+    print_usage_err();
+    return 1;
+  }
+
+  if (input->batch && (input->benchmark_runs > 0 || input->run_tests || input->use_mmap || input->stream_band_rows > 0 ||
+                       input->fused_read))
+  {
+    fprintf(stderr, "%s: Invalid combination of arguments - Batch mode cannot be combined with tests, benchmarks, --mmap, --stream or --fused-read.\n", argv[0]);
+    print_usage_err();
+    return 1;
+  }
+
+  if (input->trace && (input->benchmark_csv || input->run_tests || input->batch || input->stream_band_rows > 0 ||
+                       input->fused_read))
+  {
+    fprintf(stderr, "%s: Invalid combination of arguments - Tracing cannot be combined with --csv, tests, --batch, --stream or --fused-read.\n", argv[0]);
+    print_usage_err();
+    return 1;
+  }
+
+  if (input->fused_read && (input->benchmark_runs > 0 || input->run_tests || input->use_mmap))
+  {
+    fprintf(stderr, "%s: Invalid combination of arguments - Fused read cannot be combined with tests, benchmarks or --mmap.\n", argv[0]);
+    print_usage_err();
+    return 1;
+  }
+
+  if (input->video && (input->benchmark_runs > 0 || input->run_tests || input->use_mmap || input->stream_band_rows > 0 ||
+                       input->fused_read || input->batch || input->trace))
+  {
+    fprintf(stderr, "%s: Invalid combination of arguments - Video mode cannot be combined with tests, benchmarks, --mmap, --stream, --fused-read, --batch or --trace.\n", argv[0]);
+    print_usage_err();
+    return 1;
+  }
+
+  if (input->video_alpha > 0.0f && !input->video)
+  {
+    fprintf(stderr, "%s: Invalid combination of arguments - --temporal needs --video.\n", argv[0]);
+    print_usage_err();
+    return 1;
+  }
+
+  if (input->sweep_count && (input->benchmark_runs > 0 || input->run_tests || input->use_mmap ||
+                             input->stream_band_rows > 0 || input->fused_read || input->batch || input->video ||
+                             input->trace))
+  {
+    fprintf(stderr, "%s: Invalid combination of arguments - Sweep mode cannot be combined with tests, benchmarks, --mmap, --stream, --fused-read, --batch, --video or --trace.\n", argv[0]);
+    print_usage_err();
+    return 1;
+  }
+
+  if (input->use_mmap && (is_stdio_file_name(input->input_file) || is_stdio_file_name(input->output_file)))
+  {
+    fprintf(stderr, "%s: Invalid combination of arguments - stdin/stdout ('-') cannot be mapped (--mmap).\n", argv[0]);
+    print_usage_err();
+    return 1;
+  }
+
+  // the streaming mode reads its output back, the batch and sweep modes write many files into a directory
+  if (is_stdio_file_name(input->output_file) && (input->batch || input->stream_band_rows > 0 || input->sweep_count))
+  {
+    fprintf(stderr, "%s: Invalid combination of arguments - Output to stdout ('-o -') cannot be combined with --batch, --stream or --sweep.\n", argv[0]);
+    print_usage_err();
+    return 1;
+  }
+
   return 0;
 }
 
@@ -371,3 +704,109 @@ int parse_size_t(const char* str, size_t* param)
   *param = value;
   return 0;
 }
+
+int parse_batch_threads(const char* exec_name, char* str, BCInput* input)
+{
+  int stage = 0;
+
+  char* str_threads = strtok(str, ",");
+  while (str_threads)
+  {
+    if (stage == 3 || parse_uint32(str_threads, &input->batch_threads[stage]) || input->batch_threads[stage] == 0)
+    {
+      fprintf(stderr, "%s: Thread count could not be converted: %s\n", exec_name, str_threads);
+      return 1;
+    }
+
+    ++stage;
+    str_threads = strtok(NULL, ",");
+  }
+
+  if (stage != 3)
+  {
+    fprintf(stderr, "%s: Option '--%s' expects exactly three thread counts\n", exec_name,
+            options[OPT_BATCH_THREADS - OPT_LONG_OFFSET].name);
+    return 1;
+  }
+
+  return 0;
+}
+
+// <brightness,...>:<contrast,...>, adds every combination of the two lists to the sweep.
+// returns 1 for invalid values, -1 if out of memory
+int parse_sweep(const char* exec_name, char* str, BCInput* input)
+{
+  char* contrasts = strchr(str, ':');
+  if (!contrasts)
+  {
+    fprintf(stderr, "%s: Option '--%s' expects <brightness,...>:<contrast,...>\n", exec_name,
+            options[OPT_SWEEP - OPT_LONG_OFFSET].name);
+    return 1;
+  }
+
+  *contrasts++ = '\0';
+
+  int16_t brightness[SWEEP_MAX_VALUES];
+  float contrast[SWEEP_MAX_VALUES];
+  size_t brightness_count = 0;
+  size_t contrast_count = 0;
+
+  char* save;
+  for (char* value = strtok_r(str, ",", &save); value; value = strtok_r(NULL, ",", &save))
+  {
+    if (brightness_count == SWEEP_MAX_VALUES || parse_int16(value, &brightness[brightness_count]) ||
+        brightness[brightness_count] < -255 || brightness[brightness_count] > 255)
+    {
+      fprintf(stderr, "%s: Sweep brightness invalid or out of range: %s\n", exec_name, value);
+      return 1;
+    }
+
+    ++brightness_count;
+  }
+
+  for (char* value = strtok_r(contrasts, ",", &save); value; value = strtok_r(NULL, ",", &save))
+  {
+    if (contrast_count == SWEEP_MAX_VALUES || parse_float(value, &contrast[contrast_count]) ||
+        !(contrast[contrast_count] >= -255.0f && contrast[contrast_count] <= 255.0f))
+    {
+      fprintf(stderr, "%s: Sweep contrast invalid or out of range: %s\n", exec_name, value);
+      return 1;
+    }
+
+    ++contrast_count;
+  }
+
+  if (brightness_count == 0 || contrast_count == 0)
+  {
+    fprintf(stderr, "%s: Option '--%s' expects at least one brightness and one contrast\n", exec_name,
+            options[OPT_SWEEP - OPT_LONG_OFFSET].name);
+    return 1;
+  }
+
+  const size_t count = input->sweep_count + brightness_count * contrast_count;
+  int16_t* sweep_brightness = realloc(input->sweep_brightness, count * sizeof(*sweep_brightness));
+  if (sweep_brightness)
+    input->sweep_brightness = sweep_brightness;
+
+  float* sweep_contrast = realloc(input->sweep_contrast, count * sizeof(*sweep_contrast));
+  if (sweep_contrast)
+    input->sweep_contrast = sweep_contrast;
+
+  if (!sweep_brightness || !sweep_contrast)
+  {
+    fprintf(stderr, "%s: Out of memory\n", exec_name);
+    return -1;
+  }
+
+  for (size_t i = 0; i < brightness_count; ++i)
+  {
+    for (size_t j = 0; j < contrast_count; ++j)
+    {
+      input->sweep_brightness[input->sweep_count] = brightness[i];
+      input->sweep_contrast[input->sweep_count] = contrast[j];
+      ++input->sweep_count;
+    }
+  }
+
+  return 0;
+}
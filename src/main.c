@@ -1,12 +1,18 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "batch.h"
+#include "bc_trace.h"
 #include "benchmark.h"
 #include "brightness_contrast.h"
 #include "brightness_contrast_test.h"
+#include "buffer_pool.h"
 #include "image_io.h"
 #include "input_parser.h"
 #include "sqrt_test.h"
+#include "stream.h"
+#include "sweep.h"
 
 int main(const int argc, char **argv)
 {
@@ -15,6 +21,8 @@ int main(const int argc, char **argv)
   size_t height;
   uint8_t* source_image = NULL;
   uint8_t* result_image = NULL;
+  BCMappedImage source_map = { 0 };
+  BCMappedImage result_map = { 0 };
   BCInput input;
 
   bc_init_input(&input);
@@ -28,14 +36,68 @@ int main(const int argc, char **argv)
     goto CLEANUP;
   }
 
+  // nothing but the image may end up on stdout
+  if (is_stdio_file_name(input.output_file) && (ret = claim_stdout_for_image(argv[0])))
+    goto CLEANUP;
+
+  bc_cpu_set_level(input.cpu_level);
+
+  if (input.streaming_threshold != SIZE_MAX)
+    bc_set_streaming_threshold(input.streaming_threshold);
+
+  if (input.impl_auto)
+    input.impl = bc_auto_implementation();
+  else if (!bc_implementation_supported(input.impl))
+  {
+    fprintf(stderr, "%s: %s needs %s, which is not supported by this CPU\n", argv[0],
+            bc_implementation[input.impl].name, bc_cpu_level_name[bc_implementation[input.impl].level]);
+    ret = EXIT_FAILURE;
+    goto CLEANUP;
+  }
+
   if (input.run_sqrt_tests_benchmark)
   {
     test_sqrt_heron(argv[0]);
-    benchmark_sqrt(argv[0], 150000000); // hardcoded amount of runs, sorry
+    ret = benchmark_sqrt(argv[0], 1000); // passes over the array
+    goto CLEANUP;
+  }
+
+  if (input.video)
+  {
+    ret = bc_video_process(&input, argv[0]);
+    goto CLEANUP;
+  }
+
+  if (input.sweep_count)
+  {
+    ret = bc_sweep(&input, argv[0]);
+    goto CLEANUP;
+  }
+
+  if (input.batch)
+  {
+    ret = bc_batch_process(&input, argv[0]);
+    goto CLEANUP;
+  }
+
+  if (input.stream_band_rows > 0)
+  {
+    ret = bc_stream_image(&input, argv[0]);
+    goto CLEANUP;
+  }
+
+  if (input.fused_read)
+  {
+    ret = bc_fused_read_image(&input, argv[0]);
     goto CLEANUP;
   }
-  
-  if ((ret = read_source_image(input.input_file, &source_image, &width, &height, argv[0])))
+
+  if (input.use_mmap)
+    ret = map_source_image(input.input_file, &source_map, argv[0]);
+  else
+    ret = read_source_image(input.input_file, &source_image, &width, &height, argv[0]);
+
+  if (ret)
   {
     if (ret == 1)
       fprintf(stderr, "Invalid input image\n");
@@ -45,30 +107,71 @@ int main(const int argc, char **argv)
     goto CLEANUP;
   }
 
-  if ((ret = alloc_image_pointer(&result_image, width, height, 1)))
+  if (input.use_mmap)
+  {
+    source_image = source_map.pixels;
+    width = source_map.width;
+    height = source_map.height;
+
+    // the result is written directly into the output file
+    if ((ret = map_result_image(input.output_file, &result_map, width, height, argv[0])))
+      goto CLEANUP;
+
+    result_image = result_map.pixels;
+  }
+  else if ((ret = alloc_image_pointer(&result_image, width, height, 1)))
     goto CLEANUP;
 
   if (input.benchmark_csv)
-    benchmark_implementations_write_csv(&input, width, height, source_image, result_image, argv[0]);
+    ret = benchmark_implementations_write_csv(&input, width, height, source_image, result_image, argv[0]);
   else if (input.benchmark_runs > 0)
-    benchmark_implementation(&input, width, height, source_image, result_image, argv[0]);
+    ret = benchmark_implementation(&input, width, height, source_image, result_image, argv[0]);
   else if (input.run_tests)
     bc_test_implementations(&input, width, height, source_image, result_image, argv[0]);
   else
   {
+    if (input.trace)
+      bc_trace_enable(input.trace_file != NULL);
+
+    const uint64_t trace = bc_trace_begin();
     bc_implementation[input.impl].impl(source_image, width, height,
                                        input.coeffs[0], input.coeffs[1], input.coeffs[2],
                                        input.brightness, input.contrast, result_image);
+    bc_trace_end(BCTraceRun, trace);
+    bc_trace_disable();
     printf("%s: Conversion and brightness/contrast adjustment using %s successful.\n", argv[0], bc_implementation[input.impl].name);
+
+    if (input.trace)
+      bc_trace_print_summary(1);
+
+    if (input.trace_file && (ret = bc_trace_write_chrome(input.trace_file, argv[0])))
+      goto CLEANUP;
   }
 
-  if ((ret = write_to_res_img(input.output_file, result_image, width, height, argv[0])))
+  // out of memory or failed CSV/JSON writes of the benchmarks
+  if (ret)
+    goto CLEANUP;
+
+  if (!input.use_mmap && (ret = write_to_res_img(input.output_file, result_image, width, height, argv[0])))
     goto CLEANUP;
 
 CLEANUP:
+  if (input.use_mmap)
+  {
+    unmap_image(&source_map, argv[0]);
+    if (unmap_image(&result_map, argv[0]) && ret == 0)
+      ret = EXIT_FAILURE;
+  }
+  else
+  {
+    bc_buffer_free(source_image);
+    bc_buffer_free(result_image);
+  }
+
+  bc_buffer_pool_clear();
+  bc_trace_free();
+
   bc_destroy_input(&input);
-  free(source_image);
-  free(result_image);
 
   if (ret != 0)
     ret = EXIT_FAILURE;
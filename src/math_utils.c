@@ -1,5 +1,35 @@
 #include "math_utils.h"
 
+#include <immintrin.h>
+
+#include "cpu_features.h"
+
+// asm variants, see math_utils.S
+float sqrt_heron_sse41(float s);
+float sqrt_heron_avx(float s);
+float sqrt_heron_n_sse41(float s, uint8_t n);
+float sqrt_heron_n_avx(float s, uint8_t n);
+
+// the array variants only process whole vectors and return the number of processed floats
+size_t sqrt_heron_array_sse41(const float *src, float *dst, size_t count);
+size_t sqrt_heron_array_avx(const float *src, float *dst, size_t count);
+size_t sqrt_ieee_array_sse41(const float *src, float *dst, size_t count);
+size_t sqrt_ieee_array_avx(const float *src, float *dst, size_t count);
+size_t sqrt_rsqrt_array_sse41(const float *src, float *dst, size_t count);
+size_t sqrt_rsqrt_array_avx(const float *src, float *dst, size_t count);
+
+#define HERON_ITERATIONS 7 // same as sqrt_heron
+
+float sqrt_heron(float s)
+{
+  return bc_cpu_level() >= BCCpuAVX2 ? sqrt_heron_avx(s) : sqrt_heron_sse41(s);
+}
+
+float sqrt_heron_n(float s, uint8_t n)
+{
+  return bc_cpu_level() >= BCCpuAVX2 ? sqrt_heron_n_avx(s, n) : sqrt_heron_n_sse41(s, n);
+}
+
 // Source: https://en.wikipedia.org/wiki/Methods_of_computing_square_roots#Approximations_that_depend_on_the_floating_point_representation
 float sqrt_ieee(float z)
 {
@@ -20,3 +50,282 @@ float sqrt_ieee(float z)
 
   return val.f;		/* Interpret again as float */
 }
+
+// ================================================================
+// Array variants. Every step is done in the same order as in the scalar (asm) functions, so Heron and the IEEE trick
+// are bit-identical to them. The rsqrt variant does the refinement as (1.5 - (s * r) * r * 0.5) * (s * r) in
+// all versions, the remaining floats of the SSE loop use rsqrtss, which gives the same estimate as rsqrtps.
+// ================================================================
+
+static inline __m128 heron_ps(__m128 s)
+{
+  const __m128 half = _mm_set1_ps(0.5f);
+
+  __m128 x = _mm_mul_ps(_mm_add_ps(s, _mm_set1_ps(1.0f)), half);
+  for (int i = 0; i < HERON_ITERATIONS; ++i)
+    x = _mm_mul_ps(_mm_add_ps(_mm_div_ps(s, x), x), half);
+
+  return x;
+}
+
+static inline __m128i ieee_epi32(__m128i i)
+{
+  i = _mm_sub_epi32(i, _mm_set1_epi32(1 << 23));
+  i = _mm_srli_epi32(i, 1);
+  return _mm_add_epi32(i, _mm_set1_epi32(1 << 29));
+}
+
+// r is the estimate of 1 / sqrt(s), s = 0 gives inf * 0 => masked to 0
+static inline __m128 rsqrt_refine_ps(__m128 s, __m128 r)
+{
+  const __m128 sr = _mm_mul_ps(s, r);
+  const __m128 t = _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(_mm_mul_ps(sr, r), _mm_set1_ps(0.5f)));
+  return _mm_and_ps(_mm_mul_ps(t, sr), _mm_cmpneq_ps(s, _mm_setzero_ps()));
+}
+
+static float rsqrt_refine_ss(float s)
+{
+  const __m128 v = _mm_set_ss(s);
+  return _mm_cvtss_f32(rsqrt_refine_ps(v, _mm_rsqrt_ss(v)));
+}
+
+static void heron_array_sse41(const float *src, float *dst, size_t count)
+{
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4)
+    _mm_storeu_ps(dst + i, heron_ps(_mm_loadu_ps(src + i)));
+
+  for (; i < count; ++i)
+    dst[i] = sqrt_heron(src[i]);
+}
+
+static void ieee_array_sse41(const float *src, float *dst, size_t count)
+{
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4)
+    _mm_storeu_si128((__m128i*) (dst + i), ieee_epi32(_mm_loadu_si128((const __m128i*) (src + i))));
+
+  for (; i < count; ++i)
+    dst[i] = sqrt_ieee(src[i]);
+}
+
+static void rsqrt_array_sse41(const float *src, float *dst, size_t count)
+{
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    const __m128 s = _mm_loadu_ps(src + i);
+    _mm_storeu_ps(dst + i, rsqrt_refine_ps(s, _mm_rsqrt_ps(s)));
+  }
+
+  for (; i < count; ++i)
+    dst[i] = rsqrt_refine_ss(src[i]);
+}
+
+// AVX2: 8 floats per iteration, the remaining ones via the SSE loops
+
+__attribute__((target("avx2")))
+static void heron_array_avx2(const float *src, float *dst, size_t count)
+{
+  const __m256 half = _mm256_set1_ps(0.5f);
+  const __m256 one = _mm256_set1_ps(1.0f);
+
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    const __m256 s = _mm256_loadu_ps(src + i);
+    __m256 x = _mm256_mul_ps(_mm256_add_ps(s, one), half);
+    for (int it = 0; it < HERON_ITERATIONS; ++it)
+      x = _mm256_mul_ps(_mm256_add_ps(_mm256_div_ps(s, x), x), half);
+
+    _mm256_storeu_ps(dst + i, x);
+  }
+
+  heron_array_sse41(src + i, dst + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void ieee_array_avx2(const float *src, float *dst, size_t count)
+{
+  const __m256i bias = _mm256_set1_epi32(1 << 29);
+  const __m256i mantissa = _mm256_set1_epi32(1 << 23);
+
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    __m256i v = _mm256_loadu_si256((const __m256i*) (src + i));
+    v = _mm256_add_epi32(_mm256_srli_epi32(_mm256_sub_epi32(v, mantissa), 1), bias);
+    _mm256_storeu_si256((__m256i*) (dst + i), v);
+  }
+
+  ieee_array_sse41(src + i, dst + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void rsqrt_array_avx2(const float *src, float *dst, size_t count)
+{
+  const __m256 half = _mm256_set1_ps(0.5f);
+  const __m256 three_halves = _mm256_set1_ps(1.5f);
+
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    const __m256 s = _mm256_loadu_ps(src + i);
+    const __m256 r = _mm256_rsqrt_ps(s);
+    const __m256 sr = _mm256_mul_ps(s, r);
+    const __m256 t = _mm256_sub_ps(three_halves, _mm256_mul_ps(_mm256_mul_ps(sr, r), half));
+    const __m256 nonzero = _mm256_cmp_ps(s, _mm256_setzero_ps(), _CMP_NEQ_UQ);
+    _mm256_storeu_ps(dst + i, _mm256_and_ps(_mm256_mul_ps(t, sr), nonzero));
+  }
+
+  rsqrt_array_sse41(src + i, dst + i, count - i);
+}
+
+// AVX-512: 16 floats per iteration, the remaining ones via masked loads/stores
+
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+
+TARGET_AVX512
+static inline __m512 heron_ps512(__m512 s)
+{
+  const __m512 half = _mm512_set1_ps(0.5f);
+
+  __m512 x = _mm512_mul_ps(_mm512_add_ps(s, _mm512_set1_ps(1.0f)), half);
+  for (int i = 0; i < HERON_ITERATIONS; ++i)
+    x = _mm512_mul_ps(_mm512_add_ps(_mm512_div_ps(s, x), x), half);
+
+  return x;
+}
+
+TARGET_AVX512
+static inline __m512i ieee_epi32_512(__m512i i)
+{
+  i = _mm512_sub_epi32(i, _mm512_set1_epi32(1 << 23));
+  i = _mm512_srli_epi32(i, 1);
+  return _mm512_add_epi32(i, _mm512_set1_epi32(1 << 29));
+}
+
+TARGET_AVX512
+static inline __m512 rsqrt_ps512(__m512 s)
+{
+  const __m512 r = _mm512_rsqrt14_ps(s);
+  const __m512 sr = _mm512_mul_ps(s, r);
+  const __m512 t = _mm512_sub_ps(_mm512_set1_ps(1.5f), _mm512_mul_ps(_mm512_mul_ps(sr, r), _mm512_set1_ps(0.5f)));
+  const __mmask16 nonzero = _mm512_cmp_ps_mask(s, _mm512_setzero_ps(), _CMP_NEQ_UQ);
+  return _mm512_maskz_mul_ps(nonzero, t, sr);
+}
+
+TARGET_AVX512
+static void heron_array_avx512(const float *src, float *dst, size_t count)
+{
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16)
+    _mm512_storeu_ps(dst + i, heron_ps512(_mm512_loadu_ps(src + i)));
+
+  if (i < count)
+  {
+    // the masked out lanes are 1.0 to keep the division quiet
+    const __mmask16 mask = (__mmask16) ((1u << (count - i)) - 1);
+    const __m512 s = _mm512_mask_loadu_ps(_mm512_set1_ps(1.0f), mask, src + i);
+    _mm512_mask_storeu_ps(dst + i, mask, heron_ps512(s));
+  }
+}
+
+TARGET_AVX512
+static void ieee_array_avx512(const float *src, float *dst, size_t count)
+{
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16)
+    _mm512_storeu_si512(dst + i, ieee_epi32_512(_mm512_loadu_si512(src + i)));
+
+  if (i < count)
+  {
+    const __mmask16 mask = (__mmask16) ((1u << (count - i)) - 1);
+    _mm512_mask_storeu_epi32(dst + i, mask, ieee_epi32_512(_mm512_maskz_loadu_epi32(mask, src + i)));
+  }
+}
+
+TARGET_AVX512
+static void rsqrt_array_avx512(const float *src, float *dst, size_t count)
+{
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16)
+    _mm512_storeu_ps(dst + i, rsqrt_ps512(_mm512_loadu_ps(src + i)));
+
+  if (i < count)
+  {
+    const __mmask16 mask = (__mmask16) ((1u << (count - i)) - 1);
+    _mm512_mask_storeu_ps(dst + i, mask, rsqrt_ps512(_mm512_maskz_loadu_ps(mask, src + i)));
+  }
+}
+
+void sqrt_heron_array(const float *src, float *dst, size_t count)
+{
+  switch (bc_cpu_level())
+  {
+    case BCCpuAVX512:
+      heron_array_avx512(src, dst, count);
+      break;
+    case BCCpuAVX2:
+      heron_array_avx2(src, dst, count);
+      break;
+    default:
+      heron_array_sse41(src, dst, count);
+      break;
+  }
+}
+
+void sqrt_ieee_array(const float *src, float *dst, size_t count)
+{
+  switch (bc_cpu_level())
+  {
+    case BCCpuAVX512:
+      ieee_array_avx512(src, dst, count);
+      break;
+    case BCCpuAVX2:
+      ieee_array_avx2(src, dst, count);
+      break;
+    default:
+      ieee_array_sse41(src, dst, count);
+      break;
+  }
+}
+
+void sqrt_rsqrt_array(const float *src, float *dst, size_t count)
+{
+  switch (bc_cpu_level())
+  {
+    case BCCpuAVX512:
+      rsqrt_array_avx512(src, dst, count);
+      break;
+    case BCCpuAVX2:
+      rsqrt_array_avx2(src, dst, count);
+      break;
+    default:
+      rsqrt_array_sse41(src, dst, count);
+      break;
+  }
+}
+
+// the asm loops stop before the last partial vector, the remaining floats are done by the scalar functions
+
+void sqrt_heron_array_asm(const float *src, float *dst, size_t count)
+{
+  size_t i = bc_cpu_level() >= BCCpuAVX2 ? sqrt_heron_array_avx(src, dst, count) : sqrt_heron_array_sse41(src, dst, count);
+  for (; i < count; ++i)
+    dst[i] = sqrt_heron(src[i]);
+}
+
+void sqrt_ieee_array_asm(const float *src, float *dst, size_t count)
+{
+  size_t i = bc_cpu_level() >= BCCpuAVX2 ? sqrt_ieee_array_avx(src, dst, count) : sqrt_ieee_array_sse41(src, dst, count);
+  for (; i < count; ++i)
+    dst[i] = sqrt_ieee(src[i]);
+}
+
+void sqrt_rsqrt_array_asm(const float *src, float *dst, size_t count)
+{
+  size_t i = bc_cpu_level() >= BCCpuAVX2 ? sqrt_rsqrt_array_avx(src, dst, count) : sqrt_rsqrt_array_sse41(src, dst, count);
+  for (; i < count; ++i)
+    dst[i] = rsqrt_refine_ss(src[i]);
+}
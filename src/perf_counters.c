@@ -0,0 +1,153 @@
+#include "perf_counters.h"
+
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+const char* const bc_perf_counter_name[] =
+{
+  "cycles",        // BCPerfCycles
+  "instructions",  // BCPerfInstructions
+  "llc-misses",    // BCPerfLLCMisses
+  "branch-misses", // BCPerfBranchMisses
+  "fp-ops",        // BCPerfFPOps
+};
+
+static_assert((sizeof(bc_perf_counter_name) / sizeof(*bc_perf_counter_name)) == BCPerfMax, "Counter declared in enum is missing in "
+                                                                                           "bc_perf_counter_name array");
+
+// FP_ARITH_INST_RETIRED with all umasks (scalar, 128, 256 and 512 bit, single and double precision)
+#define INTEL_FP_ARITH_INST_RETIRED 0xFFC7
+// FpRetSseAvxOps (Zen), all umasks
+#define AMD_FP_RET_SSE_AVX_OPS      0xFF03
+
+static int perf_event_open(struct perf_event_attr *attr)
+{
+  // this process and its threads, any cpu
+  return (int) syscall(SYS_perf_event_open, attr, 0, -1, -1, 0);
+}
+
+static bool perf_counter_attr(BCPerfCounter counter, struct perf_event_attr *attr)
+{
+  memset(attr, 0, sizeof(*attr));
+  attr->size = sizeof(*attr);
+  attr->type = PERF_TYPE_HARDWARE;
+  attr->disabled = 1;
+  attr->inherit = 1;        // threads created afterwards are counted as well
+  attr->exclude_kernel = 1; // allowed with perf_event_paranoid <= 2
+  attr->exclude_hv = 1;
+  attr->read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  switch (counter)
+  {
+    case BCPerfCycles:
+      attr->config = PERF_COUNT_HW_CPU_CYCLES;
+      return true;
+
+    case BCPerfInstructions:
+      attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+      return true;
+
+    case BCPerfLLCMisses:
+      attr->config = PERF_COUNT_HW_CACHE_MISSES;
+      return true;
+
+    case BCPerfBranchMisses:
+      attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+      return true;
+
+    case BCPerfFPOps:
+    {
+      // there is no generic event for FP/vector instructions
+      __builtin_cpu_init();
+      attr->type = PERF_TYPE_RAW;
+
+      if (__builtin_cpu_is("intel"))
+        attr->config = INTEL_FP_ARITH_INST_RETIRED;
+      else if (__builtin_cpu_is("amd"))
+        attr->config = AMD_FP_RET_SSE_AVX_OPS;
+      else
+        return false;
+
+      return true;
+    }
+
+    default:
+      return false;
+  }
+}
+
+int bc_perf_open(BCPerfCounters *counters)
+{
+  int available = 0;
+
+  for (int i = 0; i < BCPerfMax; ++i)
+  {
+    struct perf_event_attr attr;
+
+    counters->fd[i] = perf_counter_attr((BCPerfCounter) i, &attr) ? perf_event_open(&attr) : -1;
+    if (counters->fd[i] >= 0)
+      ++available;
+  }
+
+  return available;
+}
+
+void bc_perf_close(BCPerfCounters *counters)
+{
+  for (int i = 0; i < BCPerfMax; ++i)
+  {
+    if (counters->fd[i] >= 0)
+      close(counters->fd[i]);
+
+    counters->fd[i] = -1;
+  }
+}
+
+static void perf_ioctl(const BCPerfCounters *counters, unsigned long request)
+{
+  for (int i = 0; i < BCPerfMax; ++i)
+  {
+    if (counters->fd[i] >= 0)
+      ioctl(counters->fd[i], request, 0);
+  }
+}
+
+// the requests apply to the inherited counters of the threads as well
+void bc_perf_reset(const BCPerfCounters *counters)
+{
+  perf_ioctl(counters, PERF_EVENT_IOC_RESET);
+}
+
+void bc_perf_enable(const BCPerfCounters *counters)
+{
+  perf_ioctl(counters, PERF_EVENT_IOC_ENABLE);
+}
+
+void bc_perf_disable(const BCPerfCounters *counters)
+{
+  perf_ioctl(counters, PERF_EVENT_IOC_DISABLE);
+}
+
+void bc_perf_read(const BCPerfCounters *counters, BCPerfValues *values)
+{
+  for (int i = 0; i < BCPerfMax; ++i)
+  {
+    uint64_t data[3]; // value, time enabled, time running
+
+    values->valid[i] = counters->fd[i] >= 0 && read(counters->fd[i], data, sizeof(data)) == (ssize_t) sizeof(data);
+    values->value[i] = 0.0;
+
+    if (!values->valid[i])
+      continue;
+
+    // multiplexed counters are scaled up, a counter that never got scheduled is not valid
+    if (data[2] == 0)
+      values->valid[i] = data[1] == 0 && data[0] == 0;
+    else
+      values->value[i] = (double) data[0] * ((double) data[1] / (double) data[2]);
+  }
+}
@@ -0,0 +1,215 @@
+#include "roofline.h"
+
+#include <assert.h>
+#include <string.h>
+#include <immintrin.h>
+#include <omp.h>
+
+#include "cpu_features.h"
+
+// iterations of the peak kernels per call, each does PEAK_CHAINS independent mul + add
+#define PEAK_ITERATIONS (1 << 16)
+#define PEAK_CHAINS 8
+
+const char* const bc_stream_kernel_name[] =
+{
+  "Read",  // BCStreamRead
+  "Write", // BCStreamWrite
+  "Copy",  // BCStreamCopy
+};
+
+const char* const bc_peak_kernel_name[] =
+{
+  "Scalar", // BCPeakScalar
+  "SIMD",   // BCPeakSIMD
+};
+
+static_assert((sizeof(bc_stream_kernel_name) / sizeof(*bc_stream_kernel_name)) == BCStreamMax, "Kernel declared in enum is missing in "
+                                                                                             "bc_stream_kernel_name array");
+static_assert((sizeof(bc_peak_kernel_name) / sizeof(*bc_peak_kernel_name)) == BCPeakMax, "Kernel declared in enum is missing in "
+                                                                                       "bc_peak_kernel_name array");
+
+// keeps the compiler from dropping the kernels
+static volatile uint64_t stream_sink;
+static volatile float peak_sink;
+// loaded at runtime, so the compiler can't evaluate the chains at compile time
+static volatile float peak_factor = 0.999999f;
+static volatile float peak_addend = 1e-6f;
+
+// ================================================================
+// Bandwidth
+// ================================================================
+
+// size is a multiple of 64, four independent accumulators so the adds don't limit the loads
+static uint64_t read_sse41(const uint8_t *buffer, size_t size)
+{
+  __m128i acc0 = _mm_setzero_si128(), acc1 = _mm_setzero_si128();
+  __m128i acc2 = _mm_setzero_si128(), acc3 = _mm_setzero_si128();
+
+  for (size_t i = 0; i < size; i += 64)
+  {
+    acc0 = _mm_add_epi64(acc0, _mm_load_si128((const __m128i*) &buffer[i]));
+    acc1 = _mm_add_epi64(acc1, _mm_load_si128((const __m128i*) &buffer[i + 16]));
+    acc2 = _mm_add_epi64(acc2, _mm_load_si128((const __m128i*) &buffer[i + 32]));
+    acc3 = _mm_add_epi64(acc3, _mm_load_si128((const __m128i*) &buffer[i + 48]));
+  }
+
+  const __m128i acc = _mm_add_epi64(_mm_add_epi64(acc0, acc1), _mm_add_epi64(acc2, acc3));
+  return (uint64_t) _mm_cvtsi128_si64(acc);
+}
+
+__attribute__((target("avx2")))
+static uint64_t read_avx2(const uint8_t *buffer, size_t size)
+{
+  __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+
+  for (size_t i = 0; i < size; i += 64)
+  {
+    acc0 = _mm256_add_epi64(acc0, _mm256_load_si256((const __m256i*) &buffer[i]));
+    acc1 = _mm256_add_epi64(acc1, _mm256_load_si256((const __m256i*) &buffer[i + 32]));
+  }
+
+  return (uint64_t) _mm256_extract_epi64(_mm256_add_epi64(acc0, acc1), 0);
+}
+
+__attribute__((target("avx512f")))
+static uint64_t read_avx512(const uint8_t *buffer, size_t size)
+{
+  __m512i acc0 = _mm512_setzero_si512(), acc1 = _mm512_setzero_si512();
+  size_t i = 0;
+
+  for (; i + 128 <= size; i += 128)
+  {
+    acc0 = _mm512_add_epi64(acc0, _mm512_load_si512(&buffer[i]));
+    acc1 = _mm512_add_epi64(acc1, _mm512_load_si512(&buffer[i + 64]));
+  }
+
+  if (i < size)
+    acc0 = _mm512_add_epi64(acc0, _mm512_load_si512(&buffer[i]));
+
+  return (uint64_t) _mm512_reduce_add_epi64(_mm512_add_epi64(acc0, acc1));
+}
+
+// write and copy use memset/memcpy, glibc picks the best variant for the CPU and size (incl. non-temporal stores)
+static void stream_kernel(BCStreamKernel kernel, uint8_t *buffer, size_t size)
+{
+  switch (kernel)
+  {
+    case BCStreamRead:
+    {
+      const BCCpuLevel level = bc_cpu_level();
+      stream_sink = level >= BCCpuAVX512 ? read_avx512(buffer, size) :
+                    level >= BCCpuAVX2   ? read_avx2(buffer, size) : read_sse41(buffer, size);
+      break;
+    }
+
+    case BCStreamWrite:
+      memset(buffer, (int) stream_sink & 0xFF, size);
+      break;
+
+    case BCStreamCopy:
+      memcpy(buffer + size / 2, buffer, size / 2);
+      break;
+
+    default:
+      break;
+  }
+}
+
+size_t bc_stream_run(BCStreamKernel kernel, uint8_t *buffer, size_t size, bool multithreaded)
+{
+  // whole cache lines, copy needs two halves of whole cache lines
+  size &= ~(size_t) 127;
+
+  if (!multithreaded)
+    stream_kernel(kernel, buffer, size);
+  else
+  {
+    #pragma omp parallel
+    {
+      // every thread gets a contiguous part, copy works within the part of each thread
+      const size_t threads = (size_t) omp_get_num_threads();
+      const size_t part = (size / threads) & ~(size_t) 127;
+      const size_t thread = (size_t) omp_get_thread_num();
+      const size_t part_size = thread + 1 == threads ? size - thread * part : part;
+
+      stream_kernel(kernel, buffer + thread * part, part_size & ~(size_t) 127);
+    }
+  }
+
+  return size;
+}
+
+// ================================================================
+// Peak float throughput
+// ================================================================
+
+// PEAK_CHAINS independent acc = acc * m + a chains, so latency doesn't limit the throughput
+#define PEAK_KERNEL(type, set1, mul, add)                                                    \
+  const type m = set1(peak_factor);                                                          \
+  const type a = set1(peak_addend);                                                          \
+  type acc[PEAK_CHAINS];                                                                     \
+  for (int c = 0; c < PEAK_CHAINS; ++c)                                                      \
+    acc[c] = set1((float) c);                                                                \
+                                                                                             \
+  for (int i = 0; i < PEAK_ITERATIONS; ++i)                                                  \
+  {                                                                                          \
+    for (int c = 0; c < PEAK_CHAINS; ++c)                                                    \
+      acc[c] = add(mul(acc[c], m), a);                                                       \
+  }                                                                                          \
+                                                                                             \
+  for (int c = 1; c < PEAK_CHAINS; ++c)                                                      \
+    acc[0] = add(acc[0], acc[c]);
+
+// mulss/addss only touch the lowest lane => one operation per instruction
+static double peak_scalar()
+{
+  PEAK_KERNEL(__m128, _mm_set1_ps, _mm_mul_ss, _mm_add_ss)
+  peak_sink = _mm_cvtss_f32(acc[0]);
+  return 2.0 * PEAK_CHAINS * PEAK_ITERATIONS;
+}
+
+static double peak_sse41()
+{
+  PEAK_KERNEL(__m128, _mm_set1_ps, _mm_mul_ps, _mm_add_ps)
+  peak_sink = _mm_cvtss_f32(acc[0]);
+  return 2.0 * 4 * PEAK_CHAINS * PEAK_ITERATIONS;
+}
+
+__attribute__((target("avx2")))
+static double peak_avx2()
+{
+  PEAK_KERNEL(__m256, _mm256_set1_ps, _mm256_mul_ps, _mm256_add_ps)
+  peak_sink = _mm256_cvtss_f32(acc[0]);
+  return 2.0 * 8 * PEAK_CHAINS * PEAK_ITERATIONS;
+}
+
+__attribute__((target("avx512f")))
+static double peak_avx512()
+{
+  PEAK_KERNEL(__m512, _mm512_set1_ps, _mm512_mul_ps, _mm512_add_ps)
+  peak_sink = _mm512_cvtss_f32(acc[0]);
+  return 2.0 * 16 * PEAK_CHAINS * PEAK_ITERATIONS;
+}
+
+static double peak_kernel(BCPeakKernel kernel)
+{
+  if (kernel == BCPeakScalar)
+    return peak_scalar();
+
+  const BCCpuLevel level = bc_cpu_level();
+  return level >= BCCpuAVX512 ? peak_avx512() : level >= BCCpuAVX2 ? peak_avx2() : peak_sse41();
+}
+
+double bc_peak_run(BCPeakKernel kernel, bool multithreaded)
+{
+  if (!multithreaded)
+    return peak_kernel(kernel);
+
+  double flops = 0.0;
+
+  #pragma omp parallel reduction(+:flops)
+  flops += peak_kernel(kernel);
+
+  return flops;
+}
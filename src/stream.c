@@ -0,0 +1,403 @@
+#include "stream.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "bc_stages.h"
+#include "buffer_pool.h"
+#include "chunk_reader.h"
+#include "image_io.h"
+
+// 768 KiB of rgb data per chunk: large enough for efficient reads, two of them still fit into L2/L3
+#define FUSED_READ_CHUNK_PIXELS (256 * 1024)
+
+// video mode: 96 KiB of rgb data and 32 KiB of grayscale values per block, stay in L2 between the fused stages
+#define VIDEO_BLOCK_PIXELS (32 * 1024)
+
+static void normalized_coeffs(const BCInput* input, float* a, float* b, float* c)
+{
+  const float coeff_sum = input->coeffs[0] + input->coeffs[1] + input->coeffs[2];
+  *a = input->coeffs[0] / coeff_sum;
+  *b = input->coeffs[1] / coeff_sum;
+  *c = input->coeffs[2] / coeff_sum;
+}
+
+static void contrast_lut(const BCInput* input, const uint64_t hist[BC_HISTOGRAM_BINS], uint8_t lut[BC_HISTOGRAM_BINS])
+{
+  float avg, sigma;
+  bc_histogram_stats(hist, &avg, &sigma);
+
+  float div, adjusted_avg;
+  bc_contrast_factors(input->contrast, avg, sigma, &sqrtf, &div, &adjusted_avg);
+
+  bc_contrast_lut_build(lut, div, adjusted_avg);
+}
+
+/*
+ * Out-of-core mode for images which don't fit into memory: the image is processed in bands of
+ * input->stream_band_rows rows, so only about 7 bytes per pixel of one band (two rgb bands for the reader + grayscale band)
+ * are held in memory.
+ *
+ * Pass 1 reads a band (on the helper thread of the chunk reader), converts it to grayscale, counts the values in a histogram
+ * and writes the band to the output file. Mean and variance follow exactly from the histogram (as in the histogram implementations).
+ * Pass 2 reads the grayscale bands back from the output file and applies the contrast via lookup table in place.
+ *
+ * The SIMD stage kernels are used, -V has no effect. The result is identical to the histogram implementations.
+ */
+int bc_stream_image(const BCInput* input, const char* prog_name)
+{
+  FILE* input_file = NULL;
+  FILE* output_file = NULL;
+  uint8_t* band_gray = NULL;
+  BCChunkReader reader;
+  bool reader_started = false;
+  size_t width;
+  size_t height;
+  long raster_offset;
+  int ret;
+
+  if ((ret = open_source_image(input->input_file, &input_file, &width, &height, prog_name)))
+  {
+    fprintf(stderr, ret == 1 ? "Invalid input image\n" : "Failed to read input image\n");
+    return ret;
+  }
+
+  const size_t band_rows = input->stream_band_rows < height ? input->stream_band_rows : height;
+
+  // the rgb buffer isn't allocated, but the raster size has to be valid for the reader
+  if (width * height * 3 / 3 / width / height != 1)
+  {
+    fprintf(stderr, "%s: Image too large\n", prog_name);
+    ret = 1;
+    goto CLEANUP;
+  }
+
+  if ((ret = alloc_image_pointer(&band_gray, width, band_rows, 1)))
+    goto CLEANUP;
+
+  if ((ret = open_result_image(input->output_file, &output_file, width, height, &raster_offset, prog_name)))
+    goto CLEANUP;
+
+  if ((ret = bc_chunk_reader_start(&reader, input_file, width * height, band_rows * width)))
+  {
+    fprintf(stderr, "%s: Failed to start reader thread\n", prog_name);
+    goto CLEANUP;
+  }
+
+  reader_started = true;
+
+  float a, b, c;
+  normalized_coeffs(input, &a, &b, &c);
+
+  uint64_t hist[BC_HISTOGRAM_BINS] = { 0 };
+
+  const uint8_t* band_rgb;
+  size_t count;
+  while ((band_rgb = bc_chunk_reader_next(&reader, &count)))
+  {
+    bc_stage_grayscale(band_rgb, count, a, b, c, input->brightness, band_gray, NULL);
+    bc_histogram_add(band_gray, count, hist);
+
+    if (fwrite(band_gray, 1, count, output_file) != count)
+    {
+      fprintf(stderr, "%s: Failed to write to output file: %s\n", prog_name, input->output_file);
+      ret = -1;
+      goto CLEANUP;
+    }
+  }
+
+  reader_started = false;
+  if ((ret = bc_chunk_reader_finish(&reader)))
+  {
+    fprintf(stderr, "%s: Pixel count didn't match width * height\n", prog_name);
+    goto CLEANUP;
+  }
+
+  uint8_t lut[BC_HISTOGRAM_BINS];
+  contrast_lut(input, hist, lut);
+
+  for (size_t row = 0; row < height; row += band_rows)
+  {
+    count = (height - row < band_rows ? height - row : band_rows) * width;
+    const off_t band_offset = (off_t) raster_offset + (off_t) (row * width);
+
+    // switching between reading and writing needs a seek in between
+    if (fseeko(output_file, band_offset, SEEK_SET) || fread(band_gray, 1, count, output_file) != count)
+    {
+      fprintf(stderr, "%s: Failed to read back output file: %s\n", prog_name, input->output_file);
+      ret = -1;
+      goto CLEANUP;
+    }
+
+    bc_stage_contrast_lut(band_gray, count, lut);
+
+    if (fseeko(output_file, band_offset, SEEK_SET) || fwrite(band_gray, 1, count, output_file) != count)
+    {
+      fprintf(stderr, "%s: Failed to write to output file: %s\n", prog_name, input->output_file);
+      ret = -1;
+      goto CLEANUP;
+    }
+  }
+
+  printf("%s: Conversion and brightness/contrast adjustment in bands of %zu rows successful.\n", prog_name, band_rows);
+
+CLEANUP:
+  if (reader_started)
+    bc_chunk_reader_finish(&reader);
+
+  if (output_file && fclose(output_file) && ret == 0)
+  {
+    fprintf(stderr, "%s: Failed to write to output file: %s\n", prog_name, input->output_file);
+    ret = -1;
+  }
+
+  fclose(input_file);
+  bc_buffer_free(band_gray);
+  return ret;
+}
+
+/*
+ * Reads the image in chunks of FUSED_READ_CHUNK_PIXELS pixels and converts every chunk to grayscale (+ histogram) right
+ * after it was read, while the helper thread of the chunk reader already reads the next one. The full rgb image is never
+ * resident => peak memory is about 1 byte per pixel plus two chunks, compared to 4 bytes per pixel for the other implementations.
+ * As the statistics come from the histogram, the contrast is applied in a single pass via lookup table afterwards.
+ */
+int bc_fused_read_image(const BCInput* input, const char* prog_name)
+{
+  FILE* input_file = NULL;
+  uint8_t* result = NULL;
+  BCChunkReader reader;
+  size_t width;
+  size_t height;
+  int ret;
+
+  if ((ret = open_source_image(input->input_file, &input_file, &width, &height, prog_name)))
+  {
+    fprintf(stderr, ret == 1 ? "Invalid input image\n" : "Failed to read input image\n");
+    return ret;
+  }
+
+  // the rgb buffer isn't allocated, but the raster size has to be valid for the reader
+  if (width * height * 3 / 3 / width / height != 1)
+  {
+    fprintf(stderr, "%s: Image too large\n", prog_name);
+    ret = 1;
+    goto CLEANUP;
+  }
+
+  const size_t pixel_count = width * height;
+
+  if ((ret = alloc_image_pointer(&result, width, height, 1)))
+    goto CLEANUP;
+
+  if ((ret = bc_chunk_reader_start(&reader, input_file, pixel_count, FUSED_READ_CHUNK_PIXELS)))
+  {
+    fprintf(stderr, "%s: Failed to start reader thread\n", prog_name);
+    goto CLEANUP;
+  }
+
+  float a, b, c;
+  normalized_coeffs(input, &a, &b, &c);
+
+  uint64_t hist[BC_HISTOGRAM_BINS] = { 0 };
+  size_t from = 0;
+
+  const uint8_t* chunk;
+  size_t count;
+  while ((chunk = bc_chunk_reader_next(&reader, &count)))
+  {
+    bc_stage_grayscale(chunk, count, a, b, c, input->brightness, &result[from], NULL);
+    bc_histogram_add(&result[from], count, hist);
+    from += count;
+  }
+
+  if ((ret = bc_chunk_reader_finish(&reader)))
+  {
+    fprintf(stderr, "%s: Pixel count didn't match width * height\n", prog_name);
+    goto CLEANUP;
+  }
+
+  uint8_t lut[BC_HISTOGRAM_BINS];
+  contrast_lut(input, hist, lut);
+
+  bc_stage_contrast_lut(result, pixel_count, lut);
+
+  if ((ret = write_to_res_img(input->output_file, result, width, height, prog_name)))
+    goto CLEANUP;
+
+  printf("%s: Conversion and brightness/contrast adjustment fused into the read successful.\n", prog_name);
+
+CLEANUP:
+  fclose(input_file);
+  bc_buffer_free(result);
+  return ret;
+}
+
+/*
+ * Grayscale of a frame on all cores, block by block, mean and variance follow from the exact sums.
+ * With a lookup table the contrast of a block is applied right after its grayscale values, while the block is still
+ * in the cache => one pass over the frame.
+ */
+static void video_frame_fused(const uint8_t* frame, size_t pixel_count, float a, float b, float c, int16_t brightness,
+                              const uint8_t* lut, uint8_t* result, float* avg, float* sigma)
+{
+  const size_t blocks = (pixel_count + VIDEO_BLOCK_PIXELS - 1) / VIDEO_BLOCK_PIXELS;
+  uint64_t sum = 0;
+  uint64_t sum_squares = 0;
+
+  // integer sums => the order of the reduction doesn't change the result
+  #pragma omp parallel for schedule(static) reduction(+:sum, sum_squares)
+  for (size_t block = 0; block < blocks; ++block)
+  {
+    const size_t from = block * VIDEO_BLOCK_PIXELS;
+    const size_t count = pixel_count - from < VIDEO_BLOCK_PIXELS ? pixel_count - from : VIDEO_BLOCK_PIXELS;
+
+    uint64_t block_squares;
+    sum += bc_stage_grayscale(&frame[from * 3], count, a, b, c, brightness, &result[from], &block_squares);
+    sum_squares += block_squares;
+
+    if (lut)
+      bc_stage_contrast_lut(&result[from], count, lut);
+  }
+
+  bc_stats_from_sums(sum, sum_squares, pixel_count, avg, sigma);
+}
+
+/*
+ * Video mode: the input is a stream of concatenated P6 frames (e.g. ffmpeg -f image2pipe -c:v ppm), every frame is
+ * written as P5 to the output stream. The frame buffers are kept across frames and only reallocated for a larger frame.
+ *
+ * Without temporal smoothing (input->video_alpha == 0) every frame is converted by the selected implementation (-V)
+ * with its own statistics, identical to converting the frames one by one.
+ * Otherwise the contrast of a frame uses the mean and variance predicted from the previous frames,
+ * predicted = alpha * (stats of the previous frame) + (1 - alpha) * (previous prediction), alpha = 1 reuses the stats
+ * of the previous frame. The stats of the current frame aren't needed before its contrast pass, so grayscale (with the
+ * sums for the next prediction) and contrast run fused in one pass, see video_frame_fused.
+ * The first frame (and the first one after a size change) is converted with its own stats.
+ */
+int bc_video_process(const BCInput* input, const char* prog_name)
+{
+  FILE* input_file = NULL;
+  int output_fd = -1;
+  uint8_t* frame = NULL;
+  uint8_t* result = NULL;
+  size_t capacity = 0; // pixels of the buffers
+  size_t frames = 0;
+  size_t width;
+  size_t height;
+  int ret;
+
+  if ((ret = open_source_image(input->input_file, &input_file, &width, &height, prog_name)))
+  {
+    fprintf(stderr, ret == 1 ? "Invalid input image\n" : "Failed to read input image\n");
+    return ret;
+  }
+
+  if ((output_fd = open_result_stream(input->output_file, prog_name)) < 0)
+  {
+    ret = -1;
+    goto CLEANUP;
+  }
+
+  float a, b, c;
+  normalized_coeffs(input, &a, &b, &c);
+
+  const bool temporal = input->video_alpha > 0.0f;
+  bool predicted = false;
+  float avg_predicted = 0.0f;
+  float sigma_predicted = 0.0f;
+  size_t previous_pixels = 0;
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (bool stream_end = false; !stream_end;)
+  {
+    const size_t pixel_count = width * height;
+    if (pixel_count > capacity)
+    {
+      bc_buffer_free(frame);
+      bc_buffer_free(result);
+      frame = result = NULL;
+
+      if ((ret = alloc_image_pointer(&frame, width, height, 3)) || (ret = alloc_image_pointer(&result, width, height, 1)))
+        goto CLEANUP;
+
+      capacity = pixel_count;
+    }
+
+    if ((ret = read_frame_pixels(input_file, frame, width, height, prog_name)))
+      goto CLEANUP;
+
+    if (!temporal)
+      bc_implementation[input->impl].impl(frame, width, height, input->coeffs[0], input->coeffs[1], input->coeffs[2],
+                                          input->brightness, input->contrast, result);
+    else
+    {
+      // a different resolution is most likely a different video
+      if (pixel_count != previous_pixels)
+        predicted = false;
+
+      uint8_t lut[BC_HISTOGRAM_BINS];
+      float div, adjusted_avg;
+      if (predicted)
+      {
+        bc_contrast_factors(input->contrast, avg_predicted, sigma_predicted, &sqrtf, &div, &adjusted_avg);
+        bc_contrast_lut_build(lut, div, adjusted_avg);
+      }
+
+      float avg, sigma;
+      video_frame_fused(frame, pixel_count, a, b, c, input->brightness, predicted ? lut : NULL, result, &avg, &sigma);
+
+      if (!predicted)
+      {
+        bc_contrast_factors(input->contrast, avg, sigma, &sqrtf, &div, &adjusted_avg);
+        bc_contrast_lut_build(lut, div, adjusted_avg);
+        bc_stage_contrast_lut(result, pixel_count, lut);
+
+        avg_predicted = avg;
+        sigma_predicted = sigma;
+        predicted = true;
+      }
+      else
+      {
+        avg_predicted = input->video_alpha * avg + (1.0f - input->video_alpha) * avg_predicted;
+        sigma_predicted = input->video_alpha * sigma + (1.0f - input->video_alpha) * sigma_predicted;
+      }
+
+      previous_pixels = pixel_count;
+    }
+
+    if ((ret = write_result_frame(output_fd, result, width, height, prog_name)))
+      goto CLEANUP;
+
+    frames += 1;
+
+    if ((ret = read_frame_header(input_file, &width, &height, &stream_end, prog_name)))
+    {
+      if (ret == 1)
+        fprintf(stderr, "Invalid frame %zu\n", frames + 1);
+
+      goto CLEANUP;
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  const double seconds = (double) (end.tv_sec - start.tv_sec) + 1e-9 * (double) (end.tv_nsec - start.tv_nsec);
+
+  printf("%s: Converted %zu frames in %.3f seconds (%.1f frames/s) using %s.\n", prog_name, frames, seconds,
+         seconds > 0.0 ? (double) frames / seconds : 0.0,
+         temporal ? "fused passes with temporal statistics" : bc_implementation[input->impl].name);
+
+CLEANUP:
+  if (output_fd >= 0 && close_result_stream(output_fd, prog_name) && ret == 0)
+    ret = -1;
+
+  fclose(input_file);
+  bc_buffer_free(frame);
+  bc_buffer_free(result);
+  return ret;
+}
@@ -0,0 +1,343 @@
+#include "sweep.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bc_context.h"
+#include "bc_stages.h"
+#include "buffer_pool.h"
+#include "image_io.h"
+
+/*
+ * Parameter sweep: many (brightness, contrast) outputs of one image.
+ * The rgb image is read and converted once, with brightness 0, into a base plane and its histogram. With non-negative
+ * coefficients the weighted sum w is already in [0, 255], so a brightness B only shifts the base values:
+ * gray = min(max(rint(w) + B, 0), 255). The histogram of every output follows from the base histogram, and brightness
+ * and contrast of one output are folded into a single 256 entry lookup table => one table pass over the base plane per
+ * output. The outputs are distributed over the cores, each core maps and writes whole outputs.
+ * rint(w) + B only differs from rint(w + B) if w is within a rounding error of k + 0.5, these pixels are kept in a
+ * (short) list with their w and corrected in histogram and output => same results as the histogram implementations.
+ */
+
+// 32 KiB of base values and 32 KiB of output per block, same as the histogram implementations
+#define SWEEP_BLOCK_PIXELS (32 * 1024)
+
+// w + B is below 255 where it matters, its ulp is at most 2^-16 there => everything further from k + 0.5 is safe
+#define SWEEP_TIE_DISTANCE (1.0f / 32768.0f)
+
+// more ties than pixels / SWEEP_MAX_TIE_RATIO (e.g. coefficients 1,1,0) => one grayscale pass per brightness instead
+#define SWEEP_MAX_TIE_RATIO 16
+
+static inline int clamp_gray(int value)
+{
+  return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+// same calculation as bc_grayscale_sisd, which all grayscale kernels match
+static inline uint8_t tie_gray(const BCSweepTie* tie, int16_t brightness)
+{
+  const float value = tie->sum + (float) brightness;
+  return (uint8_t) rintf(value < 0.0f ? 0.0f : (value > 255.0f ? 255.0f : value));
+}
+
+static char* sweep_output_file(const char* output_dir, const char* input_file, int16_t brightness, float contrast)
+{
+  const char* name = "stdin";
+  int name_length = (int) strlen(name);
+
+  if (!is_stdio_file_name(input_file))
+  {
+    name = strrchr(input_file, '/');
+    name = name ? name + 1 : input_file;
+
+    const char* extension = strrchr(name, '.');
+    name_length = (int) (extension && extension != name ? (size_t) (extension - name) : strlen(name));
+  }
+
+  const int size = snprintf(NULL, 0, "%s/%.*s_b%d_c%g.pgm", output_dir, name_length, name, brightness,
+                            (double) contrast) + 1;
+  char* output_file = malloc((size_t) size);
+  if (output_file)
+    snprintf(output_file, (size_t) size, "%s/%.*s_b%d_c%g.pgm", output_dir, name_length, name, brightness,
+             (double) contrast);
+
+  return output_file;
+}
+
+static bool ties_push(BCSweep* sweep, size_t index, float sum)
+{
+  if (sweep->tie_count == sweep->tie_capacity)
+  {
+    const size_t capacity = sweep->tie_capacity ? 2 * sweep->tie_capacity : 64;
+    BCSweepTie* grown = realloc(sweep->ties, capacity * sizeof(*grown));
+    if (!grown)
+      return false;
+
+    sweep->ties = grown;
+    sweep->tie_capacity = capacity;
+  }
+
+  sweep->ties[sweep->tie_count++] = (BCSweepTie) { index, sum };
+  return true;
+}
+
+// appends the pixels of img[from .. from + count) whose weighted sum is close to k + 0.5.
+// the block was just converted => the rgb values come from L1/L2
+static bool ties_add_block(BCSweep* sweep, const uint8_t* img, size_t from, size_t count, float a, float b, float c)
+{
+  for (size_t i = from; i < from + count; ++i)
+  {
+    const float sum = a * img[i * 3] + b * img[i * 3 + 1] + c * img[i * 3 + 2];
+    if (fabsf(sum - floorf(sum) - 0.5f) <= SWEEP_TIE_DISTANCE && !ties_push(sweep, i, sum))
+      return false;
+  }
+
+  return true;
+}
+
+// grayscale plane without brightness, its histogram and the ties, on all cores.
+// returns false if out of memory
+static bool sweep_base(BCSweep* sweep, const uint8_t* img, float a, float b, float c)
+{
+  const size_t pixel_count = sweep->width * sweep->height;
+  const size_t blocks = (pixel_count + SWEEP_BLOCK_PIXELS - 1) / SWEEP_BLOCK_PIXELS;
+  bool ok = true;
+
+  #pragma omp parallel
+  {
+    uint64_t hist_thread[BC_HISTOGRAM_BINS] = { 0 };
+    BCSweep ties_thread = { 0 }; // only its tie list
+    bool ok_thread = true;
+
+    #pragma omp for schedule(static)
+    for (size_t block = 0; block < blocks; ++block)
+    {
+      const size_t from = block * SWEEP_BLOCK_PIXELS;
+      const size_t count = pixel_count - from < SWEEP_BLOCK_PIXELS ? pixel_count - from : SWEEP_BLOCK_PIXELS;
+
+      bc_stage_grayscale(&img[from * 3], count, a, b, c, 0, &sweep->base[from], NULL);
+      bc_histogram_add(&sweep->base[from], count, hist_thread);
+      ok_thread = ok_thread && ties_add_block(&ties_thread, img, from, count, a, b, c);
+    }
+
+    // integer counts => the order of the reduction doesn't change the result, the order of the ties doesn't matter
+    #pragma omp critical
+    {
+      for (int bin = 0; bin < BC_HISTOGRAM_BINS; ++bin)
+        sweep->base_hist[bin] += hist_thread[bin];
+
+      for (size_t i = 0; ok && ok_thread && i < ties_thread.tie_count; ++i)
+        ok_thread = ties_push(sweep, ties_thread.ties[i].index, ties_thread.ties[i].sum);
+
+      ok = ok && ok_thread;
+    }
+
+    free(ties_thread.ties);
+  }
+
+  return ok;
+}
+
+// lookup tables from base values and from exact grayscale values (for the ties) to the output values of one
+// (brightness, contrast) pair
+static void sweep_lut(const BCSweep* sweep, int16_t brightness, float contrast, uint8_t lut[BC_HISTOGRAM_BINS],
+                      uint8_t contrast_lut[BC_HISTOGRAM_BINS])
+{
+  uint64_t hist[BC_HISTOGRAM_BINS] = { 0 };
+  for (int value = 0; value < BC_HISTOGRAM_BINS; ++value)
+    hist[clamp_gray(value + brightness)] += sweep->base_hist[value];
+
+  for (size_t i = 0; i < sweep->tie_count; ++i)
+  {
+    --hist[clamp_gray(sweep->base[sweep->ties[i].index] + brightness)];
+    ++hist[tie_gray(&sweep->ties[i], brightness)];
+  }
+
+  float avg, sigma, div, adjusted_avg;
+  bc_histogram_stats(hist, &avg, &sigma);
+  bc_contrast_factors(contrast, avg, sigma, &sqrtf, &div, &adjusted_avg);
+  bc_contrast_lut_build(contrast_lut, div, adjusted_avg);
+
+  for (int value = 0; value < BC_HISTOGRAM_BINS; ++value)
+    lut[value] = contrast_lut[clamp_gray(value + brightness)];
+}
+
+static void sweep_release_base(BCSweep* sweep)
+{
+  bc_buffer_free(sweep->base);
+  free(sweep->ties);
+  sweep->base = NULL;
+  sweep->ties = NULL;
+  sweep->tie_count = 0;
+  sweep->tie_capacity = 0;
+}
+
+int bc_sweep_init(BCSweep* sweep, const uint8_t* img, size_t width, size_t height, float a, float b, float c)
+{
+  *sweep = (BCSweep) { .width = width, .height = height, .coeffs = { a, b, c } };
+
+  const size_t pixel_count = width * height;
+  if (width != 0 && (pixel_count / width != height || pixel_count > SIZE_MAX / 3))
+    return 1;
+
+  const float coeff_sum = a + b + c;
+  const float a_norm = a / coeff_sum;
+  const float b_norm = b / coeff_sum;
+  const float c_norm = c / coeff_sum;
+
+  if (a_norm >= 0.0f && b_norm >= 0.0f && c_norm >= 0.0f)
+  {
+    sweep->base = bc_buffer_alloc(pixel_count);
+    if (!sweep->base || !sweep_base(sweep, img, a_norm, b_norm, c_norm))
+    {
+      sweep_release_base(sweep);
+      return -1;
+    }
+
+    if (sweep->tie_count <= pixel_count / SWEEP_MAX_TIE_RATIO)
+      return 0;
+
+    sweep_release_base(sweep);
+  }
+
+  // negative coefficients can push the weighted sum out of [0, 255] before the brightness is added, the base plane
+  // can't represent that (and too many ties make the correction expensive)
+  // => one grayscale pass per brightness, consecutive outputs with the same one share it
+  sweep->per_brightness = true;
+  return bc_context_init(&sweep->ctx, img, width, height);
+}
+
+void bc_sweep_destroy(BCSweep* sweep)
+{
+  if (sweep->per_brightness)
+    bc_context_destroy(&sweep->ctx);
+
+  sweep_release_base(sweep);
+}
+
+void bc_sweep_apply(BCSweep* sweep, int16_t brightness, float contrast, uint8_t* result)
+{
+  if (sweep->per_brightness)
+  {
+    bc_context_apply(&sweep->ctx, sweep->coeffs[0], sweep->coeffs[1], sweep->coeffs[2], brightness, contrast, result);
+    return;
+  }
+
+  const size_t pixel_count = sweep->width * sweep->height;
+  const size_t blocks = (pixel_count + SWEEP_BLOCK_PIXELS - 1) / SWEEP_BLOCK_PIXELS;
+
+  uint8_t lut[BC_HISTOGRAM_BINS];
+  uint8_t contrast_lut[BC_HISTOGRAM_BINS];
+  sweep_lut(sweep, brightness, contrast, lut, contrast_lut);
+
+  // every block is copied and mapped in place while it is still in L1/L2
+  for (size_t block = 0; block < blocks; ++block)
+  {
+    const size_t from = block * SWEEP_BLOCK_PIXELS;
+    const size_t count = pixel_count - from < SWEEP_BLOCK_PIXELS ? pixel_count - from : SWEEP_BLOCK_PIXELS;
+
+    memcpy(&result[from], &sweep->base[from], count);
+    bc_stage_contrast_lut(&result[from], count, lut);
+  }
+
+  for (size_t tie = 0; tie < sweep->tie_count; ++tie)
+    result[sweep->ties[tie].index] = contrast_lut[tie_gray(&sweep->ties[tie], brightness)];
+}
+
+// returns 1 if the output couldn't be written
+static size_t sweep_write(const BCInput* input, size_t i, BCSweep* sweep, uint8_t* result, const char* prog_name)
+{
+  char* output_file = sweep_output_file(input->output_file, input->input_file, input->sweep_brightness[i],
+                                        input->sweep_contrast[i]);
+  if (!output_file)
+  {
+    fprintf(stderr, "%s: Not enough memory\n", prog_name);
+    return 1;
+  }
+
+  bc_sweep_apply(sweep, input->sweep_brightness[i], input->sweep_contrast[i], result);
+  const size_t failed = write_to_res_img(output_file, result, sweep->width, sweep->height, prog_name) ? 1 : 0;
+
+  free(output_file);
+  return failed;
+}
+
+int bc_sweep(const BCInput* input, const char* prog_name)
+{
+  int ret;
+  size_t width;
+  size_t height;
+  size_t failed = 0;
+  uint8_t* img = NULL;
+  BCSweep sweep = { 0 };
+  struct timespec start, end;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  if ((ret = read_source_image(input->input_file, &img, &width, &height, prog_name)))
+  {
+    if (ret == 1)
+      fprintf(stderr, "Invalid input image\n");
+    else
+      fprintf(stderr, "Failed to read input image\n");
+
+    goto END;
+  }
+
+  if ((ret = bc_sweep_init(&sweep, img, width, height, input->coeffs[0], input->coeffs[1], input->coeffs[2])))
+  {
+    fprintf(stderr, ret == 1 ? "%s: Image too large\n" : "%s: Not enough memory\n", prog_name);
+    goto END;
+  }
+
+  if (sweep.per_brightness)
+  {
+    uint8_t* result = NULL;
+    if ((ret = alloc_image_pointer(&result, width, height, 1)))
+      goto END;
+
+    for (size_t i = 0; i < input->sweep_count; ++i)
+      failed += sweep_write(input, i, &sweep, result, prog_name);
+
+    bc_buffer_free(result);
+    goto DONE;
+  }
+
+  // the rgb image isn't needed anymore, its memory goes back to the system for the outputs of the threads
+  // (a different size class, the pool wouldn't hand it out again)
+  bc_buffer_free(img);
+  img = NULL;
+  bc_buffer_pool_clear();
+
+  #pragma omp parallel reduction(+:failed)
+  {
+    // the outputs of a thread without a buffer fail, the others go on. Not alloc_image_pointer: the worker threads
+    // made no image_io call yet, its error message would lack the program name
+    uint8_t* result = bc_buffer_alloc(width * height);
+    if (!result)
+      fprintf(stderr, "%s: Not enough memory\n", prog_name);
+
+    #pragma omp for schedule(dynamic)
+    for (size_t i = 0; i < input->sweep_count; ++i)
+      failed += result ? sweep_write(input, i, &sweep, result, prog_name) : 1;
+
+    bc_buffer_free(result);
+  }
+
+DONE:
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  const double seconds = (double) (end.tv_sec - start.tv_sec) + 1e-9 * (double) (end.tv_nsec - start.tv_nsec);
+  printf("%s: Wrote %zu of %zu outputs in %.3f seconds.\n", prog_name, input->sweep_count - failed, input->sweep_count,
+         seconds);
+
+  ret = failed ? -1 : 0;
+
+END:
+  bc_sweep_destroy(&sweep);
+  bc_buffer_free(img);
+  return ret;
+}
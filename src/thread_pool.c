@@ -0,0 +1,247 @@
+#include "thread_pool.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <immintrin.h>
+
+#define POOL_MAX_THREADS 256
+// pause iterations before a waiting thread yields (barrier) or goes to sleep (idle worker), roughly 100 us
+#define POOL_SPIN_ITERATIONS (16 * 1024)
+
+// remaining tasks of a thread, packed as (begin << 32) | end, so owner and thieves can update it with one CAS
+typedef struct
+{
+  alignas(64) _Atomic uint64_t range;
+} BCPoolRange;
+
+static struct
+{
+  pthread_once_t once;
+  unsigned size;
+
+  pthread_mutex_t region_mutex; // one region at a time, concurrent callers run inline
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  atomic_uint_fast64_t generation;
+
+  BCPoolRegionFunc func;
+  void* ctx;
+  unsigned thread_count;
+  atomic_uint running;
+
+  alignas(64) atomic_uint barrier_count;
+  alignas(64) atomic_bool barrier_sense;
+
+  BCPoolRange ranges[POOL_MAX_THREADS];
+} pool = { .once = PTHREAD_ONCE_INIT };
+
+static inline uint64_t range_pack(size_t begin, size_t end)
+{
+  return ((uint64_t) begin << 32) | (uint64_t) end;
+}
+
+static void* pool_worker(void* arg)
+{
+  const unsigned thread = (unsigned) (uintptr_t) arg;
+  uint_fast64_t seen = 0;
+
+  while (true)
+  {
+    // spin first: regions often follow each other closely (e.g. benchmark runs), sleeping would add the wake-up latency
+    uint_fast64_t generation;
+    for (int i = 0; i < POOL_SPIN_ITERATIONS && (generation = atomic_load(&pool.generation)) == seen; ++i)
+      _mm_pause();
+
+    if (generation == seen)
+    {
+      pthread_mutex_lock(&pool.mutex);
+      while ((generation = atomic_load(&pool.generation)) == seen)
+        pthread_cond_wait(&pool.cond, &pool.mutex);
+      pthread_mutex_unlock(&pool.mutex);
+    }
+
+    seen = generation;
+
+    if (thread < pool.thread_count)
+    {
+      BCPoolRegion region = { .thread = thread, .thread_count = pool.thread_count,
+                              .barrier_sense = atomic_load(&pool.barrier_sense) };
+      pool.func(&region, pool.ctx);
+    }
+
+    atomic_fetch_sub(&pool.running, 1);
+  }
+
+  return NULL;
+}
+
+static void pool_init()
+{
+  // BC_NUM_THREADS overrides the number of threads (like OMP_NUM_THREADS for the OpenMP implementations)
+  const char* num_threads = getenv("BC_NUM_THREADS");
+  long threads = num_threads ? strtol(num_threads, NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+  pool.size = threads < 1 ? 1 : (threads > POOL_MAX_THREADS ? POOL_MAX_THREADS : (unsigned) threads);
+
+  pthread_mutex_init(&pool.region_mutex, NULL);
+  pthread_mutex_init(&pool.mutex, NULL);
+  pthread_cond_init(&pool.cond, NULL);
+  atomic_init(&pool.generation, 0);
+  atomic_init(&pool.running, 0);
+  atomic_init(&pool.barrier_count, 0);
+  atomic_init(&pool.barrier_sense, false);
+
+  for (unsigned thread = 1; thread < pool.size; ++thread)
+  {
+    pthread_t handle;
+    if (pthread_create(&handle, NULL, &pool_worker, (void*) (uintptr_t) thread))
+    {
+      // continue with the threads started so far
+      pool.size = thread;
+      break;
+    }
+
+    pthread_detach(handle);
+  }
+}
+
+unsigned bc_pool_size()
+{
+  pthread_once(&pool.once, &pool_init);
+  return pool.size;
+}
+
+void bc_pool_parallel(size_t work, BCPoolRegionFunc func, void* ctx)
+{
+  const size_t useful_threads = work / BC_POOL_MIN_WORK_PER_THREAD;
+  BCPoolRegion region = { .thread = 0, .thread_count = 1, .barrier_sense = false };
+
+  if (useful_threads < 2 || bc_pool_size() < 2 || pthread_mutex_trylock(&pool.region_mutex))
+  {
+    func(&region, ctx);
+    return;
+  }
+
+  region.thread_count = useful_threads < pool.size ? (unsigned) useful_threads : pool.size;
+  // the barrier sense isn't reset between regions => all threads of the region start with its current value
+  region.barrier_sense = atomic_load(&pool.barrier_sense);
+
+  pool.func = func;
+  pool.ctx = ctx;
+  pool.thread_count = region.thread_count;
+  atomic_store(&pool.running, pool.size - 1);
+
+  pthread_mutex_lock(&pool.mutex);
+  atomic_fetch_add(&pool.generation, 1);
+  pthread_cond_broadcast(&pool.cond);
+  pthread_mutex_unlock(&pool.mutex);
+
+  func(&region, ctx);
+
+  // all workers have to be out of func before the next region can replace it
+  while (atomic_load(&pool.running) > 0)
+    sched_yield();
+
+  pthread_mutex_unlock(&pool.region_mutex);
+}
+
+// returns the next task of the thread's own range, false if it is empty
+static bool pool_pop(BCPoolRange* own, size_t* task)
+{
+  uint64_t range = atomic_load(&own->range);
+  while (true)
+  {
+    const size_t begin = (size_t) (range >> 32);
+    const size_t end = (size_t) (range & UINT32_MAX);
+    if (begin >= end)
+      return false;
+
+    if (atomic_compare_exchange_weak(&own->range, &range, range_pack(begin + 1, end)))
+    {
+      *task = begin;
+      return true;
+    }
+  }
+}
+
+// moves the upper half of the remaining tasks of another thread into the own range
+static bool pool_steal(const BCPoolRegion* region, BCPoolRange* own)
+{
+  for (unsigned i = 1; i < region->thread_count; ++i)
+  {
+    BCPoolRange* victim = &pool.ranges[(region->thread + i) % region->thread_count];
+    uint64_t range = atomic_load(&victim->range);
+
+    while (true)
+    {
+      const size_t begin = (size_t) (range >> 32);
+      const size_t end = (size_t) (range & UINT32_MAX);
+      if (begin >= end)
+        break;
+
+      const size_t split = end - (end - begin + 1) / 2;
+      if (atomic_compare_exchange_weak(&victim->range, &range, range_pack(begin, split)))
+      {
+        atomic_store(&own->range, range_pack(split, end));
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+void bc_pool_for(BCPoolRegion* region, size_t task_count, BCPoolTaskFunc func, void* ctx)
+{
+  if (region->thread_count == 1)
+  {
+    for (size_t task = 0; task < task_count; ++task)
+      func(ctx, task);
+
+    return;
+  }
+
+  // ranges of the last loop are all empty (barrier at the end) => nothing can be stolen before the owner set its range
+  BCPoolRange* own = &pool.ranges[region->thread];
+  atomic_store(&own->range, range_pack(task_count * region->thread / region->thread_count,
+                                       task_count * (region->thread + 1) / region->thread_count));
+
+  size_t task;
+  do
+  {
+    while (pool_pop(own, &task))
+      func(ctx, task);
+  }
+  while (pool_steal(region, own));
+
+  bc_pool_barrier(region);
+}
+
+// sense reversing barrier
+void bc_pool_barrier(BCPoolRegion* region)
+{
+  if (region->thread_count == 1)
+    return;
+
+  region->barrier_sense = !region->barrier_sense;
+  const bool sense = region->barrier_sense;
+
+  if (atomic_fetch_add(&pool.barrier_count, 1) == region->thread_count - 1)
+  {
+    atomic_store(&pool.barrier_count, 0);
+    atomic_store(&pool.barrier_sense, sense);
+    return;
+  }
+
+  for (unsigned i = 0; atomic_load(&pool.barrier_sense) != sense; ++i)
+  {
+    if (i < POOL_SPIN_ITERATIONS)
+      _mm_pause();
+    else
+      sched_yield();
+  }
+}
@@ -1,23 +1,469 @@
 #include "brightness_contrast_test.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 
+#include "bc_context.h"
+#include "bc_stages.h"
+#include "buffer_pool.h"
+#include "cpu_features.h"
+#include "sweep.h"
 #include "test_utils.h"
 
 #define MULTITHREADED_TESTRUNS 750
 
+static int stage_equals(const char* stage, const size_t size, const uint8_t* expected, const uint8_t* actual,
+                        const uint8_t allowed_delta)
+{
+  uint8_t max_delta = 0;
+  size_t differing_pixels = 0;
+
+  for (size_t i = 0; i < size; ++i)
+  {
+    const uint8_t delta = (uint8_t) abs((int16_t) actual[i] - expected[i]);
+    if (delta > allowed_delta)
+    {
+      printf(TEST_FAILED " %s: Value mismatch at index %lu - expected: %u, actual: %u\n",
+             stage, i, expected[i], actual[i]);
+      return 1;
+    }
+
+    if (delta > max_delta)
+      max_delta = delta;
+
+    if (delta != 0)
+      differing_pixels += 1;
+  }
+
+  printf(TEST_PASSED " %s (max. delta: %u, diff. pixels: %lu)\n", stage, max_delta, differing_pixels);
+  return 0;
+}
+
+// div of the additional contrast checked by bc_test_fixed_point_stages, inside the range of bc_fixed_contrast
+#define TEST_FIXED_CONTRAST_DIV 0.5f
+
+/*
+ * The fixed point kernels have to stay within test_delta of the float kernels for the same input, which is checked
+ * per stage here. The whole pipeline is compared with the same delta like every other implementation.
+ * The contrast of the input may be out of the fixed point range (V13 uses the float stages then), so the contrast
+ * stage and the whole pipeline are also checked with a contrast giving div = TEST_FIXED_CONTRAST_DIV.
+ */
+static void bc_test_fixed_point_stages(const BCInput* input, const size_t width, const size_t height,
+                                       const uint8_t* source_img, const char* prog_name)
+{
+  const size_t pixel_count = width * height;
+  const float coeff_sum = input->coeffs[0] + input->coeffs[1] + input->coeffs[2];
+  const float a = input->coeffs[0] / coeff_sum;
+  const float b = input->coeffs[1] / coeff_sum;
+  const float c = input->coeffs[2] / coeff_sum;
+
+  BCFixedCoeffs coeffs;
+  if (!bc_fixed_coeffs(a, b, c, &coeffs))
+  {
+    printf("[Test skipped] Fixed point stages (coefficients not representable, float fallback is used)\n");
+    return;
+  }
+
+  uint8_t* gray = malloc(pixel_count);
+  uint8_t* expected = malloc(pixel_count);
+  uint8_t* actual = malloc(pixel_count);
+  if (!gray || !expected || !actual)
+  {
+    fprintf(stderr, "%s: Test error: Not enough memory", prog_name);
+    goto END;
+  }
+
+  uint64_t expected_sum_squares;
+  const uint64_t expected_sum = bc_stage_grayscale(source_img, pixel_count, a, b, c, input->brightness, gray,
+                                                   &expected_sum_squares);
+
+  float avg, sigma;
+  bc_stats_from_sums(expected_sum, expected_sum_squares, pixel_count, &avg, &sigma);
+
+  uint64_t sum_squares;
+  const uint64_t sum = bc_stage_grayscale_fixed(source_img, pixel_count, &coeffs, input->brightness, actual,
+                                                &sum_squares);
+
+  if (stage_equals("Fixed point grayscale stage", pixel_count, gray, actual, input->test_delta))
+    goto END;
+
+  uint64_t actual_sum = 0;
+  uint64_t actual_sum_squares = 0;
+  for (size_t i = 0; i < pixel_count; ++i)
+  {
+    actual_sum += actual[i];
+    actual_sum_squares += (uint64_t) actual[i] * actual[i];
+  }
+
+  if (sum != actual_sum || sum_squares != actual_sum_squares)
+  {
+    printf(TEST_FAILED " Fixed point grayscale stage: sum %lu / %lu, sum of squares %lu / %lu\n",
+           actual_sum, sum, actual_sum_squares, sum_squares);
+    goto END;
+  }
+
+  const float contrast[2] = { input->contrast, TEST_FIXED_CONTRAST_DIV * sqrtf(sigma) };
+  for (size_t i = 0; i < sizeof(contrast) / sizeof(*contrast); ++i)
+  {
+    float div, adjusted_avg;
+    bc_contrast_factors(contrast[i], avg, sigma, &sqrtf, &div, &adjusted_avg);
+
+    BCFixedContrast fixed_contrast;
+    if (!bc_fixed_contrast(div, adjusted_avg, &fixed_contrast))
+    {
+      printf("[Test skipped] Fixed point contrast stage, contrast %g (div %f too large, float fallback is used)\n",
+             (double) contrast[i], (double) div);
+      continue;
+    }
+
+    char name[128];
+    snprintf(name, sizeof(name), "Fixed point contrast stage, contrast %g (div %.2f)", (double) contrast[i],
+             (double) div);
+
+    memcpy(expected, gray, pixel_count);
+    memcpy(actual, gray, pixel_count);
+    bc_stage_contrast(expected, pixel_count, div, adjusted_avg);
+    bc_stage_contrast_fixed(actual, pixel_count, &fixed_contrast);
+
+    if (stage_equals(name, pixel_count, expected, actual, input->test_delta))
+      continue;
+
+    // the whole pipeline with the contrast of the input is tested by bc_test_implementations_level
+    if (i == 0)
+      continue;
+
+    snprintf(name, sizeof(name), "%s, contrast %g (div %.2f)", bc_implementation[BCImplCSIMD_Fixed].name,
+             (double) contrast[i], (double) div);
+
+    bc_implementation[0].impl(source_img, width, height, input->coeffs[0], input->coeffs[1], input->coeffs[2],
+                              input->brightness, contrast[i], expected);
+    bc_implementation[BCImplCSIMD_Fixed].impl(source_img, width, height, input->coeffs[0], input->coeffs[1],
+                                              input->coeffs[2], input->brightness, contrast[i], actual);
+
+    stage_equals(name, pixel_count, expected, actual, input->test_delta);
+  }
+
+END:
+  free(gray);
+  free(expected);
+  free(actual);
+}
+
 int array_equals(int impl, const size_t size, const uint8_t *result_img, const uint8_t *curr_result,
                  const uint8_t allowed_delta, uint8_t* max_delta, size_t* differing_pixels);
 
+/*
+ * The context API against the reference implementation: the first call, a contrast change (has to use the cached
+ * grayscale plane) and a brightness change (has to recompute it). reference is the result for the input parameters.
+ */
+static void bc_test_context(const BCInput* input, const size_t width, const size_t height, const uint8_t* source_img,
+                            const uint8_t* reference, const char* prog_name)
+{
+  const size_t pixel_count = width * height;
+  const float* coeffs = input->coeffs;
+  const float contrast = input->contrast / 2.0f + 10.0f;
+  const int16_t brightness = (int16_t) (input->brightness > 0 ? input->brightness - 20 : input->brightness + 20);
+
+  BCContext ctx;
+  uint8_t* expected = malloc(pixel_count);
+  uint8_t* actual = malloc(pixel_count);
+  if (!expected || !actual || bc_context_init(&ctx, source_img, width, height))
+  {
+    fprintf(stderr, "%s: Test error: Not enough memory", prog_name);
+    free(expected);
+    free(actual);
+    return;
+  }
+
+  if (bc_context_apply(&ctx, coeffs[0], coeffs[1], coeffs[2], input->brightness, input->contrast, actual))
+    printf(TEST_FAILED " Context: Cached grayscale plane used on the first call\n");
+  else if (stage_equals("Context", pixel_count, reference, actual, input->test_delta))
+    goto END;
+
+  bc_implementation[0].impl(source_img, width, height, coeffs[0], coeffs[1], coeffs[2], input->brightness, contrast,
+                            expected);
+  if (!bc_context_apply(&ctx, coeffs[0], coeffs[1], coeffs[2], input->brightness, contrast, actual))
+    printf(TEST_FAILED " Context, contrast changed: Grayscale plane recomputed\n");
+  else if (stage_equals("Context, contrast changed", pixel_count, expected, actual, input->test_delta))
+    goto END;
+
+  bc_implementation[0].impl(source_img, width, height, coeffs[0], coeffs[1], coeffs[2], brightness, contrast, expected);
+  if (bc_context_apply(&ctx, coeffs[0], coeffs[1], coeffs[2], brightness, contrast, actual))
+    printf(TEST_FAILED " Context, brightness changed: Stale grayscale plane used\n");
+  else
+    stage_equals("Context, brightness changed", pixel_count, expected, actual, input->test_delta);
+
+END:
+  bc_context_destroy(&ctx);
+  free(expected);
+  free(actual);
+}
+
+// one sweep against the histogram implementation (same results, delta 0) for a few brightness and contrast values.
+// returns 1 on failure
+static int sweep_equals(const char* stage, BCSweep* sweep, const uint8_t* img, const float coeffs[3],
+                        const BCInput* input, uint8_t* expected, uint8_t* actual)
+{
+  const int16_t brightness[] = { input->brightness, -40, 0, 60 };
+  const float contrast[] = { input->contrast, input->contrast / 2.0f + 10.0f };
+  const size_t pixel_count = sweep->width * sweep->height;
+
+  for (size_t i = 0; i < sizeof(brightness) / sizeof(*brightness); ++i)
+  {
+    for (size_t j = 0; j < sizeof(contrast) / sizeof(*contrast); ++j)
+    {
+      bc_implementation[BCImplCSIMD_Hist].impl(img, sweep->width, sweep->height, coeffs[0], coeffs[1], coeffs[2],
+                                                brightness[i], contrast[j], expected);
+      bc_sweep_apply(sweep, brightness[i], contrast[j], actual);
+
+      if (memcmp(expected, actual, pixel_count) != 0)
+      {
+        char name[128];
+        snprintf(name, sizeof(name), "%s, brightness %d, contrast %g", stage, brightness[i], (double) contrast[j]);
+        return stage_equals(name, pixel_count, expected, actual, 0);
+      }
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * The sweep with its three paths: base plane with a few ties corrected in histogram and output, and the fallback to
+ * one grayscale pass per brightness for too many ties and for negative coefficients. Coefficients 1,1,0 give a tie
+ * wherever r + g is odd, the green channel of a copy of the image is adjusted to control how many there are.
+ */
+static void bc_test_sweep(const BCInput* input, const size_t width, const size_t height, const uint8_t* source_img,
+                          const char* prog_name)
+{
+  const size_t pixel_count = width * height;
+  const float ties_coeffs[] = { 1.0f, 1.0f, 0.0f };
+  const float negative_coeffs[] = { 1.0f, -0.2f, 0.3f };
+
+  struct
+  {
+    const char* name;
+    const float* coeffs;
+    size_t tie_spacing; // every tie_spacing-th pixel of the copy is a tie with ties_coeffs, 0 .. the image as is
+    int per_brightness; // expected path, -1 .. depends on the image
+  } cases[] = {
+    { "Sweep", input->coeffs, 0, -1 },
+    { "Sweep, ties corrected", ties_coeffs, 64, false },
+    { "Sweep, too many ties", ties_coeffs, 2, true },
+    { "Sweep, negative coefficients", negative_coeffs, 0, true },
+  };
+
+  uint8_t* img = malloc(pixel_count * 3);
+  uint8_t* expected = malloc(pixel_count);
+  uint8_t* actual = malloc(pixel_count);
+  if (!img || !expected || !actual)
+  {
+    fprintf(stderr, "%s: Test error: Not enough memory", prog_name);
+    goto END;
+  }
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(*cases); ++i)
+  {
+    memcpy(img, source_img, pixel_count * 3);
+    for (size_t pixel = 0; cases[i].tie_spacing && pixel < pixel_count; ++pixel)
+    {
+      const bool tie = pixel % cases[i].tie_spacing == 0;
+      const uint8_t g = img[pixel * 3 + 1];
+      if ((bool) ((img[pixel * 3] + g) % 2) != tie)
+        img[pixel * 3 + 1] = (uint8_t) (g < 255 ? g + 1 : g - 1);
+    }
+
+    BCSweep sweep;
+    if (bc_sweep_init(&sweep, img, width, height, cases[i].coeffs[0], cases[i].coeffs[1], cases[i].coeffs[2]))
+    {
+      fprintf(stderr, "%s: Test error: Not enough memory", prog_name);
+      goto END;
+    }
+
+    if (cases[i].per_brightness >= 0 && sweep.per_brightness != (bool) cases[i].per_brightness)
+      printf(TEST_FAILED " %s: %s path taken\n", cases[i].name, sweep.per_brightness ? "Per brightness" : "Base plane");
+    else if (cases[i].tie_spacing && !cases[i].per_brightness && sweep.tie_count < pixel_count / cases[i].tie_spacing)
+      printf(TEST_FAILED " %s: %zu ties found\n", cases[i].name, sweep.tie_count);
+    else if (!sweep_equals(cases[i].name, &sweep, img, cases[i].coeffs, input, expected, actual))
+      printf(TEST_PASSED " %s (%s, %zu ties)\n", cases[i].name,
+             sweep.per_brightness ? "per brightness" : "base plane", sweep.tie_count);
+
+    bc_sweep_destroy(&sweep);
+  }
+
+END:
+  free(img);
+  free(expected);
+  free(actual);
+}
+
+// the streaming store variants with the threshold at 0, into a result buffer which isn't 16 byte aligned
+// (movnti stores 4 bytes at a time at any offset)
+static void bc_test_streaming(const BCInput* input, const size_t width, const size_t height, const uint8_t* source_img,
+                              const uint8_t* reference, const char* prog_name)
+{
+  const size_t pixel_count = width * height;
+  const size_t threshold = bc_streaming_threshold();
+
+  uint8_t* actual = malloc(pixel_count + 1);
+  if (!actual)
+  {
+    fprintf(stderr, "%s: Test error: Not enough memory", prog_name);
+    return;
+  }
+
+  bc_set_streaming_threshold(0);
+
+  for (int impl = 0; impl < BCImplMax; ++impl)
+  {
+    if (!bc_implementation[impl].streaming_name || !bc_implementation_supported(impl))
+      continue;
+
+    bc_implementation[impl].impl(source_img, width, height, input->coeffs[0], input->coeffs[1], input->coeffs[2],
+                                 input->brightness, input->contrast, actual + 1);
+    stage_equals(bc_implementation[impl].streaming_name, pixel_count, reference, actual + 1, input->test_delta);
+  }
+
+  bc_set_streaming_threshold(threshold);
+  free(actual);
+}
+
+// alignment of the image buffers below and above the huge page threshold, a freed buffer is handed out again
+// for a size of the same class
+static void bc_test_buffer_pool(const size_t pixel_count, const char* prog_name)
+{
+  const size_t sizes[] = { 1, pixel_count, pixel_count * 3, BC_BUFFER_HUGEPAGE_THRESHOLD + 1 };
+
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); ++i)
+  {
+    uint8_t* buffer = bc_buffer_alloc(sizes[i]);
+    if (!buffer)
+    {
+      fprintf(stderr, "%s: Test error: Not enough memory", prog_name);
+      return;
+    }
+
+    memset(buffer, 0, sizes[i]);
+    bc_buffer_free(buffer);
+
+    if ((uintptr_t) buffer % BC_BUFFER_ALIGNMENT)
+    {
+      printf(TEST_FAILED " Buffer pool: Buffer of %lu bytes not %d byte aligned\n", sizes[i], BC_BUFFER_ALIGNMENT);
+      return;
+    }
+
+    uint8_t* reused = bc_buffer_alloc(sizes[i]);
+    bc_buffer_free(reused);
+    if (reused != buffer)
+    {
+      printf(TEST_FAILED " Buffer pool: Buffer of %lu bytes not reused\n", sizes[i]);
+      return;
+    }
+  }
+
+  printf(TEST_PASSED " Buffer pool\n");
+}
+
+/*
+ * Every lookup table kernel this CPU can run, called directly against bc_contrast_lut_sisd. bc_stage_contrast_lut
+ * always takes the VBMI kernel on VBMI hardware, the AVX-512BW one would stay untested there.
+ * The table is a permutation, so a wrong index shows up, the length leaves a tail for the scalar remainder loop.
+ */
+static void bc_test_contrast_lut_kernels(const size_t pixel_count, const char* prog_name)
+{
+  const BCCpuLevel detected = bc_cpu_detect();
+  const bool vbmi = detected >= BCCpuAVX512 && __builtin_cpu_supports("avx512vbmi");
+
+  struct
+  {
+    const char* name;
+    void (*kernel)(uint8_t*, size_t, const uint8_t*);
+    bool supported;
+  } kernels[] = {
+    { "Contrast LUT kernel SSE4.1", &bc_contrast_lut_sse41, true },
+    { "Contrast LUT kernel AVX2", &bc_contrast_lut_avx2, detected >= BCCpuAVX2 },
+    { "Contrast LUT kernel AVX-512BW", &bc_contrast_lut_avx512, detected >= BCCpuAVX512 },
+    { "Contrast LUT kernel AVX-512 VBMI", &bc_contrast_lut_avx512vbmi, vbmi },
+  };
+
+  const size_t count = pixel_count | 1;
+  uint8_t lut[BC_HISTOGRAM_BINS];
+  for (int value = 0; value < BC_HISTOGRAM_BINS; ++value)
+    lut[value] = (uint8_t) (value * 167 + 13);
+
+  uint8_t* values = malloc(count);
+  uint8_t* expected = malloc(count);
+  uint8_t* actual = malloc(count);
+  if (!values || !expected || !actual)
+  {
+    fprintf(stderr, "%s: Test error: Not enough memory", prog_name);
+    goto END;
+  }
+
+  for (size_t i = 0; i < count; ++i)
+    values[i] = (uint8_t) (i * 7 + i / 256);
+
+  memcpy(expected, values, count);
+  bc_contrast_lut_sisd(expected, count, lut);
+
+  for (size_t i = 0; i < sizeof(kernels) / sizeof(*kernels); ++i)
+  {
+    if (!kernels[i].supported)
+    {
+      printf("[Test skipped] %s (not supported by this CPU)\n", kernels[i].name);
+      continue;
+    }
+
+    memcpy(actual, values, count);
+    kernels[i].kernel(actual, count, lut);
+    stage_equals(kernels[i].name, count, expected, actual, 0);
+  }
+
+END:
+  free(values);
+  free(expected);
+  free(actual);
+}
+
+static void bc_test_implementations_level(const BCInput* input, const size_t width, const size_t height,
+                                          const uint8_t* source_img, uint8_t* result_img, const char* prog_name);
+
 void bc_test_implementations(const BCInput* input, const size_t width, const size_t height,
                              const uint8_t* source_img, uint8_t* result_img, const char* prog_name)
 {
-  printf("%s: Running tests with %s as reference implementation...\n", prog_name, bc_implementation[0].name);
+  const BCCpuLevel selected = bc_cpu_level();
+
+  bc_test_buffer_pool(width * height, prog_name);
+  bc_test_contrast_lut_kernels(width * height, prog_name);
+
+  // test every kernel variant this CPU can run, the selected one last so its result ends up in the output file
+  for (int level = BCCpuSSE41; level <= (int) bc_cpu_detect(); ++level)
+  {
+    if (level == (int) selected)
+      continue;
+
+    bc_cpu_set_level((BCCpuLevel) level);
+    bc_test_implementations_level(input, width, height, source_img, result_img, prog_name);
+  }
+
+  bc_cpu_set_level(selected);
+  bc_test_implementations_level(input, width, height, source_img, result_img, prog_name);
+}
+
+static void bc_test_implementations_level(const BCInput* input, const size_t width, const size_t height,
+                                          const uint8_t* source_img, uint8_t* result_img, const char* prog_name)
+{
+  printf("%s: Running tests of %s kernels with %s as reference implementation...\n",
+         prog_name, bc_cpu_level_name[bc_cpu_level()], bc_implementation[0].name);
 
   // run default implementation as a reference
   bc_implementation[0].impl(source_img, width, height, input->coeffs[0], input->coeffs[1], input->coeffs[2],
                             input->brightness, input->contrast, result_img);
 
+  bc_test_fixed_point_stages(input, width, height, source_img, prog_name);
+
   uint8_t* test_results[BCImplMax - 1];
 
   // initialize with NULL so we can always call free in END (even on error when not all elements have been malloced)
@@ -26,6 +472,12 @@ void bc_test_implementations(const BCInput* input, const size_t width, const siz
 
   for (int impl = 1; impl < BCImplMax; ++impl)
   {
+    if (!bc_implementation_supported(impl))
+    {
+      printf("[Test skipped] %s (needs %s)\n", bc_implementation[impl].name, bc_cpu_level_name[bc_implementation[impl].level]);
+      continue;
+    }
+
     uint8_t** curr_result = &test_results[impl - 1];
     uint8_t max_delta = 0;
     size_t differing_pixels = 0;
@@ -37,7 +489,7 @@ void bc_test_implementations(const BCInput* input, const size_t width, const siz
       goto END;
     }
 
-    if (impl == BCImplCSISD_MT)
+    if (impl == BCImplCSISD_MT || impl == BCImplCSIMD_Hist_MT || impl == BCImplCSIMD_MT)
     {
       bool failed = false;
 
@@ -75,6 +527,10 @@ void bc_test_implementations(const BCInput* input, const size_t width, const siz
     }
   }
 
+  bc_test_context(input, width, height, source_img, result_img, prog_name);
+  bc_test_streaming(input, width, height, source_img, result_img, prog_name);
+  bc_test_sweep(input, width, height, source_img, prog_name);
+
 END:
   for (int i = 0; i < BCImplMax - 1; ++i)
     free(test_results[i]);
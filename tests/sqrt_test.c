@@ -3,14 +3,23 @@
 #include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include <test_utils.h>
 
+#include "cpu_features.h"
 #include "math_utils.h"
 
 // arbitrary epsilon, seemed good after trial&error testing
 static const double epsilon = 0.0001f;
 
+// max. relative error of the rsqrt estimate after one Newton-Raphson step
+static const double rsqrt_epsilon = 1e-6;
+
+// not a multiple of any vector width => the remaining floats are tested too
+#define ARRAY_TEST_COUNT 1003
+
 static void test_sqrt(const char* name, float (sqrt_func)(float num));
+static void test_sqrt_arrays();
 
 void test_sqrt_heron(const char* prog_name)
 {
@@ -19,6 +28,18 @@ void test_sqrt_heron(const char* prog_name)
 
   test_sqrt("sqrt_heron", &sqrt_heron);
   test_sqrt("sqrt_ieee", &sqrt_ieee);
+
+  printf("Array implementations are tested against the scalar ones on %d values of both intervals and 0, "
+         "sqrt_rsqrt_array against sqrtf with max. allowed relative error %g, on every instruction set level:\n",
+         ARRAY_TEST_COUNT, rsqrt_epsilon);
+
+  const BCCpuLevel selected = bc_cpu_level();
+  for (int level = BCCpuSSE41; level <= (int) bc_cpu_detect(); ++level)
+  {
+    bc_cpu_set_level((BCCpuLevel) level);
+    test_sqrt_arrays();
+  }
+  bc_cpu_set_level(selected);
 }
 
 static void test_sqrt(const char* name, float (*sqrt_func)(float))
@@ -55,3 +76,72 @@ static void test_sqrt(const char* name, float (*sqrt_func)(float))
   if (!fail)
     printf(TEST_PASSED " %s: Test passed\n", name);
 }
+
+static void test_sqrt_array(const char* name, void (*array_func)(const float*, float*, size_t),
+                            float (*sqrt_func)(float), const float *src, size_t count)
+{
+  float dst[ARRAY_TEST_COUNT];
+  array_func(src, dst, count);
+
+  for (size_t i = 0; i < count; ++i)
+  {
+    const float expected = sqrt_func(src[i]);
+    if (memcmp(&dst[i], &expected, sizeof(float)) == 0)
+      continue;
+
+    printf(TEST_FAILED " %s (%s): Unexpected value for %f - expected: %f, actual: %f\n", name,
+           bc_cpu_level_name[bc_cpu_level()], (double) src[i], (double) expected, (double) dst[i]);
+    return;
+  }
+
+  printf(TEST_PASSED " %s (%s): Test passed\n", name, bc_cpu_level_name[bc_cpu_level()]);
+}
+
+static void test_rsqrt_array(const char* name, void (*array_func)(const float*, float*, size_t),
+                             const float *src, size_t count)
+{
+  float dst[ARRAY_TEST_COUNT];
+  array_func(src, dst, count);
+
+  double max_error = 0.0;
+  for (size_t i = 0; i < count; ++i)
+  {
+    const double expected = sqrtf(src[i]);
+    const double error = expected > 0.0 ? fabs((double) dst[i] - expected) / expected : fabs((double) dst[i]);
+
+    if (error > rsqrt_epsilon)
+    {
+      printf(TEST_FAILED " %s (%s): Unexpected value for %f - expected: %f, actual: %f\n", name,
+             bc_cpu_level_name[bc_cpu_level()], (double) src[i], expected, (double) dst[i]);
+      return;
+    }
+
+    if (error > max_error)
+      max_error = error;
+  }
+
+  printf(TEST_PASSED " %s (%s): Test passed (max. relative error: %g)\n", name, bc_cpu_level_name[bc_cpu_level()],
+         max_error);
+}
+
+static void test_sqrt_arrays()
+{
+  float src[ARRAY_TEST_COUNT];
+
+  // half of the values in [0.0, 10.0], the other half in [1000.0, 10000.0]
+  src[0] = 0.0f;
+  for (size_t i = 1; i < ARRAY_TEST_COUNT; ++i)
+  {
+    if (i < ARRAY_TEST_COUNT / 2)
+      src[i] = 10.0f * (float) i / (ARRAY_TEST_COUNT / 2);
+    else
+      src[i] = 1000.0f + 9000.0f * (float) (i - ARRAY_TEST_COUNT / 2) / (ARRAY_TEST_COUNT - ARRAY_TEST_COUNT / 2);
+  }
+
+  test_sqrt_array("sqrt_heron_array", &sqrt_heron_array, &sqrt_heron, src, ARRAY_TEST_COUNT);
+  test_sqrt_array("sqrt_heron_array_asm", &sqrt_heron_array_asm, &sqrt_heron, src, ARRAY_TEST_COUNT);
+  test_sqrt_array("sqrt_ieee_array", &sqrt_ieee_array, &sqrt_ieee, src, ARRAY_TEST_COUNT);
+  test_sqrt_array("sqrt_ieee_array_asm", &sqrt_ieee_array_asm, &sqrt_ieee, src, ARRAY_TEST_COUNT);
+  test_rsqrt_array("sqrt_rsqrt_array", &sqrt_rsqrt_array, src, ARRAY_TEST_COUNT);
+  test_rsqrt_array("sqrt_rsqrt_array_asm", &sqrt_rsqrt_array_asm, src, ARRAY_TEST_COUNT);
+}